@@ -0,0 +1,479 @@
+/**
+ * Microbenchmarks for microgpt-cpp
+ * Times the building blocks of training and inference (autograd factory ops,
+ * layers, one forward / backward / optimizer step, tokenization and model
+ * files) for several model sizes, with the harness in bench.h. Prints a table
+ * and optionally writes JSON for comparing runs.
+ *
+ * With --sweep FILE it instead sweeps a grid of model shapes and writes one
+ * CSV row per point: forward and backward time over a full block, graph size
+ * and footprint, and generation speed, showing where the scalar graph stops
+ * scaling (attention copies growing with block_size squared, the 1000000
+ * node limits of ValueStorage and backward).
+ *
+ * With --profile (in a build configured with -DMICROGPT_PROFILE=ON) it runs
+ * one training step per config and prints the graph nodes, bytes and backward
+ * time per op and model region.
+ */
+
+#include <microgpt/microgpt.h>
+#include <microgpt/bench.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace microgpt;
+
+struct NamedConfig {
+    std::string name;
+    Config config;
+};
+
+// Sizes between the default training config and what one scalar graph can hold
+static const std::vector<NamedConfig> kConfigs = {
+    {"tiny", {27, 16, 4, 1, 16}},
+    {"small", {27, 32, 4, 2, 16}},
+    {"medium", {27, 64, 4, 2, 32}},
+};
+
+static std::string describe(const Config& c) {
+    std::ostringstream out;
+    out << "embd=" << c.n_embd << " head=" << c.n_head << " layer=" << c.n_layer << " block=" << c.block_size
+        << " vocab=" << c.vocab_size;
+    return out.str();
+}
+
+/**
+ * Inputs of n random values held in storage; positive, so log is defined
+ */
+static std::vector<Value*> random_inputs(int n, ValueStorage& storage) {
+    std::uniform_real_distribution<double> dist(0.5, 1.5);
+    std::vector<Value*> x;
+    x.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        x.push_back(storage.constant(dist(get_rng())));
+    }
+    return x;
+}
+
+/**
+ * Autograd factory ops: kOps nodes per repetition
+ */
+static void bench_value_ops(Bench& bench) {
+    constexpr int kOps = 10000;
+    ValueStorage storage;
+    std::vector<Value*> x;
+    auto reset = [&] {
+        storage.clear();
+        x = random_inputs(64, storage);
+    };
+    auto op = [&](const std::string& name, auto fn) {
+        bench.run("value." + name, "n=" + std::to_string(kOps), kOps, "node", [&] {
+            for (int i = 0; i < kOps; ++i) {
+                fn(x[i & 63], x[(i + 1) & 63]);
+            }
+        }, reset);
+    };
+    op("constant", [&](Value*, Value*) { return storage.constant(0.5); });
+    op("add", [&](Value* a, Value* b) { return storage.add(a, b); });
+    op("mul", [&](Value* a, Value* b) { return storage.mul(a, b); });
+    op("pow", [&](Value* a, Value*) { return storage.pow(a, 2.0); });
+    op("exp", [&](Value* a, Value*) { return storage.exp(a); });
+    op("log", [&](Value* a, Value*) { return storage.log(a); });
+    op("relu", [&](Value* a, Value*) { return storage.relu(a); });
+}
+
+static void bench_tokenizer(Bench& bench, const std::vector<std::string>& docs) {
+    Tokenizer tokenizer;
+    tokenizer.fit(docs);
+    size_t chars = 0;
+    for (const auto& d : docs) {
+        chars += d.size();
+    }
+    std::vector<int> tokens;
+    bench.run("tokenizer.encode", "docs=" + std::to_string(docs.size()), static_cast<double>(chars), "char", [&] {
+        for (const auto& d : docs) {
+            tokens = tokenizer.encode(d);
+        }
+    });
+}
+
+static void bench_config(Bench& bench, const NamedConfig& named, const std::string& scratch) {
+    const Config& config = named.config;
+    const std::string params = named.name + " " + describe(config);
+    GPT model(config);
+    auto all_params = model.state_dict.get_all_params();
+    const double n_params = static_cast<double>(all_params.size());
+    const double d = config.n_embd;
+    ValueStorage storage;
+
+    // Layers: one position's worth of work each
+    std::vector<Value*> x;
+    auto fresh_input = [&](int n) {
+        return [&, n] {
+            storage.clear();
+            x = random_inputs(n, storage);
+        };
+    };
+    auto& wq = model.state_dict.weights.at("layer0.attn_wq");
+    bench.run("linear", params, d * d, "mac", [&] { linear(x, wq, storage); }, fresh_input(config.n_embd));
+    bench.run("rmsnorm", params, d, "elem", [&] { rmsnorm(x, storage); }, fresh_input(config.n_embd));
+    bench.run("softmax", params, config.vocab_size, "elem", [&] { softmax(x, storage); },
+              fresh_input(config.vocab_size));
+
+    // One forward at position 0 (empty KV cache)
+    std::vector<std::vector<std::vector<Value*>>> keys;
+    std::vector<std::vector<std::vector<Value*>>> values;
+    bench.run("gpt.forward", params, n_params, "param", [&] { model.forward(1, 0, keys, values, storage); }, [&] {
+        storage.clear();
+        keys.assign(config.n_layer, {});
+        values.assign(config.n_layer, {});
+    });
+
+    // One backward over a short sequence; the graph is rebuilt untimed each time
+    std::uniform_int_distribution<int> token(0, config.vocab_size - 1);
+    std::vector<int> sequence(std::min(config.block_size, 4) + 1);
+    for (int& t : sequence) {
+        t = token(get_rng());
+    }
+    Value* loss = nullptr;
+    storage.clear();
+    loss = model.sequence_loss(sequence, -1, storage);
+    const double nodes = static_cast<double>(storage.size());
+    bench.run("gpt.backward", params + " seq=" + std::to_string(sequence.size() - 1), nodes, "node",
+              [&] { loss->backward(); }, [&] {
+        storage.clear();
+        loss = model.sequence_loss(sequence, -1, storage);
+    });
+    storage.clear();
+
+    Adam optimizer;
+    optimizer.init(all_params.size());
+    bench.run("adam.step", params, n_params, "param", [&] { optimizer.step(all_params, 1000000); });
+
+    // Model files (f64, versioned format), through the page cache
+    Tokenizer tokenizer;
+    tokenizer.fit(std::vector<std::string>{"abcdefghijklmnopqrstuvwxyz"});
+    const std::string path = scratch + "/" + named.name + ".bin";
+    model.save_weights(path, tokenizer);
+    const double file_bytes = static_cast<double>(std::filesystem::file_size(path));
+    bench.run("save_weights", params, file_bytes, "byte", [&] { model.save_weights(path, tokenizer); });
+    bench.run("load_weights", params, file_bytes, "byte", [&] { GPT::load_weights(path); });
+    std::filesystem::remove(path);
+}
+
+/**
+ * Shapes to sweep: every combination of the listed values
+ */
+struct SweepGrid {
+    std::vector<int> n_embd = {16, 32, 64};
+    std::vector<int> n_head = {4};
+    std::vector<int> n_layer = {1, 2};
+    std::vector<int> block_size = {8, 16, 32};
+    std::vector<int> vocab_size = {27, 256};
+};
+
+static std::vector<int> parse_list(const std::string& text) {
+    std::vector<int> values;
+    std::stringstream list(text);
+    for (std::string item; std::getline(list, item, ',');) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+/**
+ * One training window of block_size + 1 tokens: documents of the corpus
+ * joined by BOS, or uniform random tokens when there is no corpus
+ */
+static std::vector<int> sweep_window(const Config& config, const std::vector<std::string>& corpus,
+                                     const Tokenizer& tokenizer) {
+    std::vector<int> window;
+    if (corpus.empty()) {
+        std::uniform_int_distribution<int> token(0, config.vocab_size - 2);
+        window.push_back(config.vocab_size - 1);
+        while (static_cast<int>(window.size()) <= config.block_size) {
+            window.push_back(token(get_rng()));
+        }
+        return window;
+    }
+    for (size_t i = 0; static_cast<int>(window.size()) <= config.block_size; ++i) {
+        tokenizer.encode_into(corpus[i % corpus.size()], window);
+        window.pop_back();  // the next document's opening BOS separates them
+    }
+    window.resize(config.block_size + 1);
+    return window;
+}
+
+/**
+ * Generation speed: fn samples and returns the positions it ran; summed over
+ * all timed repetitions, since sample lengths vary
+ */
+template <typename Fn>
+static double positions_per_second(const BenchOptions& options, Fn fn) {
+    for (int i = 0; i < options.warmup; ++i) {
+        fn();
+    }
+    size_t positions = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < std::max(1, options.reps); ++i) {
+        positions += fn();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return seconds > 0.0 ? positions / seconds : 0.0;
+}
+
+/**
+ * Measure every grid point and write one CSV row each. A point that hits a
+ * graph size limit keeps the measurements it got and names the limit in status.
+ */
+static void run_sweep(const SweepGrid& grid, const BenchOptions& options, const std::vector<std::string>& corpus,
+                      std::ostream& csv) {
+    Tokenizer tokenizer;
+    if (!corpus.empty()) {
+        tokenizer.fit(corpus);
+    }
+    const std::vector<int> vocabs = corpus.empty() ? grid.vocab_size : std::vector<int>{tokenizer.vocab_size};
+
+    csv << "n_embd,n_head,n_layer,block_size,vocab_size,params,nodes,forward_ms,forward_us_per_pos,backward_ms,"
+           "graph_peak_bytes,gen_tok_s,nograd_gen_tok_s,status\n";
+    for (int n_embd : grid.n_embd) {
+        for (int n_head : grid.n_head) {
+            if (n_embd % n_head != 0) {
+                continue;
+            }
+            for (int n_layer : grid.n_layer) {
+                for (int block_size : grid.block_size) {
+                    for (int vocab_size : vocabs) {
+                        const Config config{vocab_size, n_embd, n_head, n_layer, block_size};
+                        GPT model(config);
+                        const std::vector<int> window = sweep_window(config, corpus, tokenizer);
+                        const int bos = corpus.empty() ? -1 : tokenizer.BOS;
+                        const int start = corpus.empty() ? vocab_size - 1 : tokenizer.BOS;
+
+                        Bench bench(options);
+                        ValueStorage storage;
+                        Value* loss = nullptr;
+                        size_t nodes = 0;
+                        double forward_ms = 0.0;
+                        double backward_ms = 0.0;
+                        double gen_tok_s = 0.0;
+                        std::string phase = "forward";  // the phase running when a limit is hit
+                        std::string status = "ok";
+                        try {
+                            forward_ms = bench.run("forward", "", block_size, "position", [&] {
+                                loss = model.sequence_loss(window, bos, storage);
+                            }, [&] { storage.clear(); }).median_ns / 1e6;
+                            nodes = storage.size();
+                            phase = "backward";
+                            backward_ms = bench.run("backward", "", static_cast<double>(nodes), "node",
+                                                    [&] { loss->backward(); }, [&] {
+                                storage.clear();
+                                loss = model.sequence_loss(window, bos, storage);
+                            }).median_ns / 1e6;
+                            phase = "generate";
+                            gen_tok_s = positions_per_second(options, [&] {
+                                return std::min<size_t>(block_size, model.generate(start, block_size).size() + 1);
+                            });
+                        } catch (const std::exception& e) {
+                            const std::string what = e.what();
+                            status = phase + (what.find("size limit") != std::string::npos ? ":storage_limit"
+                                              : what.find("too large") != std::string::npos ? ":topo_limit"
+                                                                                             : ":error");
+                        }
+
+                        // Batched no-grad sampling has no graph, so it runs at every size
+                        const FlatWeights weights(model.state_dict);
+                        NoGradModel sampler(config, weights, 8);
+                        const double nograd_gen_tok_s = positions_per_second(options, [&] {
+                            size_t positions = 0;
+                            for (const auto& sample : sampler.generate(8, start, 1.0)) {
+                                positions += std::min<size_t>(block_size, sample.size() + 1);
+                            }
+                            return positions;
+                        });
+
+                        // Phases that did not complete leave their cells empty
+                        auto cell = [&](bool measured, double value, int precision) {
+                            std::ostringstream text;
+                            text << std::fixed << std::setprecision(precision) << value;
+                            return measured ? text.str() : std::string();
+                        };
+                        const bool forward_ok = nodes > 0;
+                        const bool backward_ok = backward_ms > 0.0;
+                        csv << n_embd << ',' << n_head << ',' << n_layer << ',' << block_size << ',' << vocab_size
+                            << ',' << weights.size() << ',' << cell(forward_ok, static_cast<double>(nodes), 0) << ','
+                            << cell(forward_ok, forward_ms, 3) << ',' << cell(forward_ok, forward_ms * 1e3 / block_size, 3)
+                            << ',' << cell(backward_ok, backward_ms, 3) << ',' << storage.peak_bytes() << ','
+                            << cell(gen_tok_s > 0.0, gen_tok_s, 1) << ',' << cell(true, nograd_gen_tok_s, 1) << ','
+                            << status << std::endl;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * One training step (loss over a full block of documents, then backward) with
+ * the graph profile of its storage
+ */
+static void run_profile(const NamedConfig& named, const std::vector<std::string>& docs) {
+    Tokenizer tokenizer;
+    tokenizer.fit(docs);
+    Config config = named.config;
+    config.vocab_size = tokenizer.vocab_size;
+    GPT model(config);
+    const std::vector<int> window = sweep_window(config, docs, tokenizer);
+
+    std::cout << "== " << named.name << " (" << describe(config) << ", " << config.block_size << " positions)"
+              << std::endl;
+    ValueStorage storage;
+    try {
+        Value* loss = model.sequence_loss(window, tokenizer.BOS, storage);
+        loss->backward();
+    } catch (const std::exception& e) {
+        std::cout << "skipped: " << e.what() << std::endl << std::endl;
+        return;
+    }
+    storage.profile().print(std::cout);
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    std::string json_path;
+    std::string only;
+    std::string data_path = "data/names.txt";
+    bool profile = false;
+    std::string sweep_path;
+    std::string corpus_path;
+    SweepGrid grid;
+    bool reps_given = false;
+    bool warmup_given = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--reps" && i + 1 < argc) {
+            options.reps = std::stoi(argv[++i]);
+            reps_given = true;
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            options.warmup = std::stoi(argv[++i]);
+            warmup_given = true;
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else if (arg == "--config" && i + 1 < argc) {
+            only = argv[++i];
+        } else if (arg == "--data" && i + 1 < argc) {
+            data_path = argv[++i];
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--sweep" && i + 1 < argc) {
+            sweep_path = argv[++i];
+        } else if (arg == "--corpus" && i + 1 < argc) {
+            corpus_path = argv[++i];
+        } else if (arg == "--embd" && i + 1 < argc) {
+            grid.n_embd = parse_list(argv[++i]);
+        } else if (arg == "--heads" && i + 1 < argc) {
+            grid.n_head = parse_list(argv[++i]);
+        } else if (arg == "--layers" && i + 1 < argc) {
+            grid.n_layer = parse_list(argv[++i]);
+        } else if (arg == "--blocks" && i + 1 < argc) {
+            grid.block_size = parse_list(argv[++i]);
+        } else if (arg == "--vocabs" && i + 1 < argc) {
+            grid.vocab_size = parse_list(argv[++i]);
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--reps N] [--warmup N] [--json FILE]"
+                      << " [--config tiny|small|medium] [--data docs.txt]\n       " << argv[0]
+                      << " --sweep FILE.csv [--embd N,..] [--heads N,..] [--layers N,..] [--blocks N,..]"
+                      << " [--vocabs N,..] [--corpus docs.txt] [--reps N] [--warmup N]\n       " << argv[0]
+                      << " --profile [--config tiny|small|medium] [--data docs.txt]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!sweep_path.empty()) {
+        std::vector<std::string> corpus;
+        if (!corpus_path.empty()) {
+            corpus = load_docs(corpus_path);
+            if (corpus.empty()) {
+                std::cerr << "Error: Could not load " << corpus_path << std::endl;
+                return 1;
+            }
+        }
+        std::ofstream csv(sweep_path);
+        if (!csv.is_open()) {
+            std::cerr << "Error: Could not open " << sweep_path << std::endl;
+            return 1;
+        }
+        // Each point costs several full-block graphs; a few repetitions are enough
+        options.reps = reps_given ? options.reps : 3;
+        options.warmup = warmup_given ? options.warmup : 1;
+        try {
+            run_sweep(grid, options, corpus, csv);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << sweep_path << std::endl;
+        return 0;
+    }
+
+    std::vector<std::string> docs = load_docs(data_path);
+    if (docs.empty()) {
+        std::cerr << "Error: Could not load " << data_path << std::endl;
+        return 1;
+    }
+    docs.resize(std::min<size_t>(docs.size(), 1000));
+
+    if (profile) {
+        if (!MICROGPT_PROFILE) {
+            std::cerr << "Error: --profile needs a build configured with -DMICROGPT_PROFILE=ON" << std::endl;
+            return 1;
+        }
+        for (const auto& named : kConfigs) {
+            if (only.empty() || named.name == only) {
+                run_profile(named, docs);
+            }
+        }
+        return 0;
+    }
+
+    const std::string scratch =
+        (std::filesystem::temp_directory_path() / ("microgpt-bench-" + std::to_string(::getpid()))).string();
+    std::filesystem::create_directories(scratch);
+
+    Bench bench(options);
+    try {
+        bench_value_ops(bench);
+        bench_tokenizer(bench, docs);
+        for (const auto& named : kConfigs) {
+            if (only.empty() || named.name == only) {
+                bench_config(bench, named, scratch);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::filesystem::remove_all(scratch);
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    std::filesystem::remove_all(scratch);
+
+    bench.print_table(std::cout);
+    if (!json_path.empty()) {
+        std::ofstream out(json_path);
+        if (!out.is_open()) {
+            std::cerr << "Error: Could not open " << json_path << std::endl;
+            return 1;
+        }
+        bench.write_json(out, "{\"cpu\":\"" + cpu_model_key() + "\",\"warmup\":" + std::to_string(options.warmup) +
+                                  ",\"reps\":" + std::to_string(options.reps) + "}");
+        std::cout << "Wrote " << json_path << std::endl;
+    }
+    return 0;
+}
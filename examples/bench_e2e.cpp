@@ -0,0 +1,283 @@
+/**
+ * End-to-end throughput driver for microgpt-cpp
+ * Trains and samples with the configuration of microgpt.py (n_embd 16, 4
+ * heads, 1 layer, block size 8, Adam 1e-2 with cosine decay, one document per
+ * step, temperature 0.5) and reports steps/s, tokens/s and samples/s for each
+ * C++ execution mode:
+ *
+ *   scalar    GPT::train_step / GPT::generate on the Value graph (the port)
+ *   no-grad   NoGradModel: batched double kernels, for loss and sampling
+ *   threaded  no-grad split across threads, one NoGradModel each
+ *
+ * Training only exists in scalar mode: the no-grad kernels have no backward,
+ * and pipeline parallelism needs more than the one layer of this config.
+ * scripts/bench_python.py runs this driver next to microgpt.py on the same
+ * document order and compares loss curves and throughput.
+ */
+
+#include <microgpt/microgpt.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace microgpt;
+
+struct E2EOptions {
+    std::string docs_path = "data/names.txt";
+    bool shuffle_docs = true;      // false: the file is already in training order
+    int steps = 500;
+    int block_size = 8;
+    int samples = 20;
+    int eval_docs = 2000;          // documents for no-grad loss throughput
+    int threads = 0;               // 0: hardware concurrency
+    std::string json_path;         // one JSON object per mode
+    std::string loss_log_path;     // step,loss CSV of scalar training
+    std::string trace_path;        // Chrome/Perfetto trace of every mode
+};
+
+struct ModeResult {
+    std::string mode;
+    int steps = 0;
+    double train_seconds = 0.0;
+    size_t train_tokens = 0;       // positions trained on
+    double eval_seconds = 0.0;
+    size_t eval_tokens = 0;        // positions scored without gradients
+    double sample_seconds = 0.0;
+    int samples = 0;
+    double final_loss = 0.0;       // mean of the last 50 steps (training modes)
+
+    double steps_per_sec() const { return train_seconds > 0.0 ? steps / train_seconds : 0.0; }
+    double tokens_per_sec() const {
+        if (train_seconds > 0.0) {
+            return train_tokens / train_seconds;
+        }
+        return eval_seconds > 0.0 ? eval_tokens / eval_seconds : 0.0;
+    }
+    double samples_per_sec() const { return sample_seconds > 0.0 ? samples / sample_seconds : 0.0; }
+
+    std::string to_json() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(4)
+            << "{\"impl\":\"c++\",\"mode\":\"" << mode << "\""
+            << ",\"steps\":" << steps
+            << ",\"train_s\":" << train_seconds
+            << ",\"steps_per_sec\":" << steps_per_sec()
+            << ",\"tokens_per_sec\":" << tokens_per_sec()
+            << ",\"samples_per_sec\":" << samples_per_sec()
+            << ",\"final_loss\":";
+        if (steps > 0) {
+            out << final_loss;
+        } else {
+            out << "null";
+        }
+        out << "}";
+        return out.str();
+    }
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * No-grad loss over eval and sampling, split across n_threads models
+ */
+static ModeResult run_nograd(const std::string& mode, const Config& config, const FlatWeights& weights,
+                             const std::vector<std::vector<int>>& eval, int bos, int n_samples, int n_threads) {
+    constexpr int kBatch = 32;
+    ModeResult r;
+    r.mode = mode;
+    auto split = [&](size_t n, int t) { return n * t / n_threads; };
+    auto parallel = [&](auto&& fn) {
+        std::vector<std::thread> workers;
+        for (int t = 1; t < n_threads; ++t) {
+            workers.emplace_back([&fn, t] {
+                trace_thread_name("worker " + std::to_string(t));
+                fn(t);
+            });
+        }
+        fn(0);
+        for (auto& w : workers) {
+            w.join();
+        }
+    };
+
+    std::vector<size_t> positions(n_threads, 0);
+    auto start = std::chrono::steady_clock::now();
+    parallel([&](int t) {
+        NoGradModel model(config, weights, kBatch);
+        std::vector<std::span<const int>> batch;
+        for (size_t first = split(eval.size(), t); first < split(eval.size(), t + 1); first += kBatch) {
+            batch.clear();
+            for (size_t i = first; i < std::min(split(eval.size(), t + 1), first + kBatch); ++i) {
+                batch.emplace_back(eval[i]);
+            }
+            positions[t] += model.loss(batch, bos).second;
+        }
+    });
+    r.eval_seconds = seconds_since(start);
+    for (size_t p : positions) {
+        r.eval_tokens += p;
+    }
+
+    start = std::chrono::steady_clock::now();
+    parallel([&](int t) {
+        const int n = static_cast<int>(split(n_samples, t + 1) - split(n_samples, t));
+        if (n > 0) {
+            NoGradModel model(config, weights, std::min(n, kBatch));
+            model.generate(n, bos, 0.5);
+        }
+    });
+    r.sample_seconds = seconds_since(start);
+    r.samples = n_samples;
+    return r;
+}
+
+int main(int argc, char** argv) {
+    E2EOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--docs" && i + 1 < argc) {
+            options.docs_path = argv[++i];
+        } else if (arg == "--no-shuffle") {
+            options.shuffle_docs = false;
+        } else if (arg == "--steps" && i + 1 < argc) {
+            options.steps = std::stoi(argv[++i]);
+        } else if (arg == "--block-size" && i + 1 < argc) {
+            options.block_size = std::stoi(argv[++i]);
+        } else if (arg == "--samples" && i + 1 < argc) {
+            options.samples = std::stoi(argv[++i]);
+        } else if (arg == "--eval-docs" && i + 1 < argc) {
+            options.eval_docs = std::stoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            options.threads = std::stoi(argv[++i]);
+        } else if (arg == "--json" && i + 1 < argc) {
+            options.json_path = argv[++i];
+        } else if (arg == "--loss-log" && i + 1 < argc) {
+            options.loss_log_path = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            options.trace_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--docs FILE] [--no-shuffle] [--steps N] [--block-size N]"
+                      << " [--samples N] [--eval-docs N] [--threads N] [--json FILE] [--loss-log FILE]"
+                      << " [--trace FILE]" << std::endl;
+            return 1;
+        }
+    }
+    if (options.threads <= 0) {
+        options.threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    if (!options.trace_path.empty()) {
+        trace_thread_name("main");
+        trace_start();
+    }
+
+    std::vector<std::string> docs = load_docs(options.docs_path);
+    if (docs.empty() || options.steps <= 0) {
+        std::cerr << "Error: Could not load " << options.docs_path << std::endl;
+        return 1;
+    }
+    if (options.shuffle_docs) {
+        shuffle(docs);
+    }
+    Tokenizer tokenizer;
+    tokenizer.fit(docs);
+    const Config config{tokenizer.vocab_size, 16, 4, 1, options.block_size};
+    GPT model(config);
+    auto params = model.state_dict.get_all_params();
+    Adam optimizer(1e-2, 0.9, 0.95, 1e-8);
+    optimizer.init(params.size());
+    std::cout << "num docs: " << docs.size() << ", vocab size: " << tokenizer.vocab_size
+              << ", num params: " << params.size() << ", threads: " << options.threads << std::endl;
+
+    // Scalar: training exactly as microgpt.py, then sampling one sequence at a time
+    ModeResult scalar;
+    scalar.mode = "scalar";
+    scalar.steps = options.steps;
+    std::vector<double> losses;
+    losses.reserve(options.steps);
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < options.steps; ++step) {
+        ValueStorage storage;
+        const auto tokens = tokenizer.encode(docs[step % docs.size()]);
+        losses.push_back(model.train_step(tokens, optimizer, storage, options.steps));
+        scalar.train_tokens += std::min(config.block_size, static_cast<int>(tokens.size()) - 1);
+    }
+    scalar.train_seconds = seconds_since(start);
+    const size_t tail = std::min<size_t>(50, losses.size());
+    for (size_t i = losses.size() - tail; i < losses.size(); ++i) {
+        scalar.final_loss += losses[i] / tail;
+    }
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < options.samples; ++i) {
+        model.generate(tokenizer.BOS, config.block_size, 0.5);
+    }
+    scalar.sample_seconds = seconds_since(start);
+    scalar.samples = options.samples;
+
+    // No-grad modes share one snapshot of the trained weights
+    const FlatWeights weights(model.state_dict);
+    std::vector<std::vector<int>> eval;
+    for (size_t i = 0; i < docs.size() && static_cast<int>(i) < options.eval_docs; ++i) {
+        eval.push_back(tokenizer.encode(docs[i]));
+    }
+    std::vector<ModeResult> results = {scalar};
+    results.push_back(run_nograd("no-grad", config, weights, eval, tokenizer.BOS, options.samples, 1));
+    results.push_back(run_nograd("threaded", config, weights, eval, tokenizer.BOS, options.samples,
+                                 options.threads));
+
+    std::cout << std::left << std::setw(10) << "mode" << std::right << std::setw(12) << "steps/s" << std::setw(12)
+              << "tokens/s" << std::setw(12) << "samples/s" << std::setw(12) << "final loss" << std::endl;
+    for (const auto& r : results) {
+        auto cell = [&](double value, int precision) {
+            std::ostringstream text;
+            text << std::fixed << std::setprecision(precision) << value;
+            return r.steps > 0 ? text.str() : std::string("-");
+        };
+        std::cout << std::left << std::setw(10) << r.mode << std::right << std::setw(12) << cell(r.steps_per_sec(), 2)
+                  << std::fixed << std::setprecision(2) << std::setw(12) << r.tokens_per_sec() << std::setw(12)
+                  << r.samples_per_sec() << std::setw(12) << cell(r.final_loss, 4) << std::endl;
+    }
+    std::cout << "(tokens/s: positions trained on in scalar mode, positions scored in the no-grad modes)"
+              << std::endl;
+
+    if (!options.json_path.empty()) {
+        std::ofstream out(options.json_path);
+        for (const auto& r : results) {
+            out << r.to_json() << '\n';
+        }
+        if (!out) {
+            std::cerr << "Error: Could not write " << options.json_path << std::endl;
+            return 1;
+        }
+    }
+    if (!options.trace_path.empty()) {
+        trace_stop();
+        try {
+            trace_write_json(options.trace_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (!options.loss_log_path.empty()) {
+        std::ofstream out(options.loss_log_path);
+        out << "step,loss\n" << std::setprecision(6);
+        for (size_t i = 0; i < losses.size(); ++i) {
+            out << i + 1 << ',' << losses[i] << '\n';
+        }
+        if (!out) {
+            std::cerr << "Error: Could not write " << options.loss_log_path << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
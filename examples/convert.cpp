@@ -0,0 +1,308 @@
+/**
+ * Model converter for microgpt-cpp
+ * Reads a model in any supported format (versioned file of any dtype, or the
+ * legacy raw dump) and rewrites it in the versioned, 64-byte aligned format,
+ * optionally at reduced precision, with a per-tensor size and error report.
+ * Training state (optimizer moments, progress) is dropped.
+ *
+ * With --calibrate, a sample of documents is run through the model first; the
+ * int8/int4 scale of every row is then clipped to minimize the weight error
+ * weighted by the mean squared input each column sees, and the loss on the
+ * sample is compared before and after conversion.
+ *
+ * With --verify FILE nothing is written: the metadata and every tensor of
+ * FILE are checked against their checksums and the exit status is nonzero if
+ * any is corrupt.
+ */
+
+#include <microgpt/microgpt.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <span>
+#include <string>
+#include <vector>
+
+using namespace microgpt;
+
+struct ConvertOptions {
+    std::string input;
+    std::string output;
+    DType dtype = DType::F64;
+    std::string calibration_path;  // empty: no calibration
+    int samples = 256;
+};
+
+/**
+ * Mean next-token loss of a model over tokenized documents
+ */
+static double sample_loss(const Config& config, const FlatWeights& weights, const std::vector<std::vector<int>>& docs,
+                          int bos, NoGradModel::InputObserver observer = {}) {
+    NoGradModel model(config, weights, 32);
+    model.set_input_observer(std::move(observer));
+    double total = 0.0;
+    size_t count = 0;
+    for (size_t first = 0; first < docs.size(); first += 32) {
+        std::vector<std::span<const int>> batch;
+        for (size_t i = first; i < std::min(docs.size(), first + 32); ++i) {
+            batch.emplace_back(docs[i]);
+        }
+        const auto [sum, n] = model.loss(batch, bos);
+        total += sum;
+        count += n;
+    }
+    return count > 0 ? total / count : 0.0;
+}
+
+template <typename Tok>
+static int convert(const GPT& model, const Tok& tokenizer, const ConvertOptions& options) {
+    const Config& config = model.config;
+    const FlatWeights original(model.state_dict);
+
+    // Calibration: mean squared input of every column of every matrix product
+    std::vector<std::vector<int>> sample;
+    std::map<const double*, std::pair<std::vector<double>, size_t>> input_power;  // tensor -> (sum x^2, rows)
+    double loss_before = 0.0;
+    if (!options.calibration_path.empty()) {
+        const std::vector<std::string> docs = load_docs(options.calibration_path);
+        if (docs.empty()) {
+            std::cerr << "Error: Could not load " << options.calibration_path << std::endl;
+            return 1;
+        }
+        for (size_t i = 0; i < docs.size() && static_cast<int>(i) < options.samples; ++i) {
+            sample.push_back(tokenizer.encode(docs[i]));
+        }
+        loss_before = sample_loss(config, original, sample, tokenizer.BOS,
+                                  [&](const TensorView& w, const double* x, int batch) {
+            auto& [power, rows] = input_power[w.data];
+            power.resize(w.cols);
+            for (int b = 0; b < batch; ++b) {
+                for (int i = 0; i < w.cols; ++i) {
+                    const double v = x[static_cast<size_t>(b) * w.cols + i];
+                    power[i] += v * v;
+                }
+            }
+            rows += batch;
+        });
+    }
+
+    struct Report {
+        std::string name;
+        int rows;
+        int cols;
+        uint64_t stored_bytes;
+        double max_error;
+        double rms_error;
+        double weighted_error;  // relative, weighted by the calibration input power
+    };
+    std::vector<Report> reports;
+    std::vector<std::vector<std::byte>> buffers;
+    std::vector<ModelTensorSource> tensors;
+    buffers.reserve(original.entries().size());
+
+    const int qmax = quantized_max(options.dtype);
+    for (const auto& [name, entry] : original.entries()) {
+        const TensorView w = original.tensor(name);
+        const std::span<const double> values(w.data, static_cast<size_t>(w.rows) * w.cols);
+
+        // Column importance: embeddings and unobserved tensors weigh every column alike
+        std::vector<double> importance(w.cols, 1.0);
+        const auto observed = input_power.find(w.data);
+        if (observed != input_power.end() && observed->second.second > 0) {
+            for (int c = 0; c < w.cols; ++c) {
+                importance[c] = observed->second.first[c] / static_cast<double>(observed->second.second);
+            }
+        }
+
+        // Per-row scales: max |w| unless calibration finds a clipped one with less weighted error
+        std::vector<float> scales;
+        if (qmax > 0 && observed != input_power.end()) {
+            for (int r = 0; r < w.rows; ++r) {
+                const double* row = w.row(r);
+                double max_abs = 0.0;
+                for (int c = 0; c < w.cols; ++c) {
+                    max_abs = std::max(max_abs, std::abs(row[c]));
+                }
+                float best_scale = static_cast<float>(max_abs / qmax);
+                double best_error = std::numeric_limits<double>::infinity();
+                for (int step = 0; step <= 10 && max_abs > 0.0; ++step) {
+                    const auto scale = static_cast<float>((1.0 - 0.05 * step) * max_abs / qmax);
+                    double error = 0.0;
+                    for (int c = 0; c < w.cols; ++c) {
+                        const double q = std::clamp(std::round(row[c] / scale), -1.0 * qmax, 1.0 * qmax);
+                        const double diff = row[c] - q * scale;
+                        error += importance[c] * diff * diff;
+                    }
+                    if (error < best_error) {
+                        best_error = error;
+                        best_scale = scale;
+                    }
+                }
+                scales.push_back(best_scale);
+            }
+        }
+
+        const std::vector<std::byte>& bytes = buffers.emplace_back(
+            encode_tensor(values, static_cast<uint64_t>(w.rows), options.dtype, scales));
+        tensors.push_back(ModelTensorSource{name, options.dtype,
+                                            {static_cast<uint64_t>(w.rows), static_cast<uint64_t>(w.cols)}, bytes});
+
+        // Error of the stored tensor against the original
+        std::vector<double> decoded(values.size());
+        decode_tensor(bytes, options.dtype, w.rows, w.cols, decoded);
+        Report report{name, w.rows, w.cols, bytes.size(), 0.0, 0.0, 0.0};
+        double sq = 0.0;
+        double weighted = 0.0;
+        double weighted_norm = 0.0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            const double diff = decoded[i] - values[i];
+            const double s = importance[i % w.cols];
+            report.max_error = std::max(report.max_error, std::abs(diff));
+            sq += diff * diff;
+            weighted += s * diff * diff;
+            weighted_norm += s * values[i] * values[i];
+        }
+        report.rms_error = values.empty() ? 0.0 : std::sqrt(sq / values.size());
+        report.weighted_error = weighted_norm > 0.0 ? std::sqrt(weighted / weighted_norm) : 0.0;
+        reports.push_back(report);
+    }
+
+    ModelFileInfo info;
+    info.vocab_size = config.vocab_size;
+    info.n_embd = config.n_embd;
+    info.n_head = config.n_head;
+    info.n_layer = config.n_layer;
+    info.block_size = config.block_size;
+    info.tokenizer_kind = std::is_same_v<Tok, BPETokenizer> ? TokenizerKind::BPE : TokenizerKind::Chars;
+    info.bos = tokenizer.BOS;
+    info.tokenizer = tokenizer_section(tokenizer);
+    const uint64_t file_bytes = write_model_file(options.output, info, tensors);
+
+    // Per-tensor report
+    uint64_t f64_total = 0;
+    std::cout << std::left << std::setw(16) << "tensor" << std::right << std::setw(11) << "shape" << std::setw(6)
+              << "dtype" << std::setw(10) << "f64 B" << std::setw(10) << "stored B" << std::setw(7) << "ratio"
+              << std::setw(12) << "max err" << std::setw(12) << "rms err" << std::setw(12) << "rel err" << std::endl;
+    for (const auto& r : reports) {
+        const uint64_t f64_bytes = static_cast<uint64_t>(r.rows) * r.cols * sizeof(double);
+        f64_total += f64_bytes;
+        std::cout << std::left << std::setw(16) << r.name << std::right << std::setw(11)
+                  << (std::to_string(r.rows) + "x" + std::to_string(r.cols)) << std::setw(6)
+                  << dtype_name(options.dtype) << std::setw(10) << f64_bytes << std::setw(10) << r.stored_bytes
+                  << std::setw(7) << std::fixed << std::setprecision(2)
+                  << static_cast<double>(f64_bytes) / r.stored_bytes << std::scientific << std::setprecision(3)
+                  << std::setw(12) << r.max_error << std::setw(12) << r.rms_error << std::setw(12)
+                  << r.weighted_error << std::defaultfloat << std::endl;
+    }
+    std::cout << "Wrote " << options.output << ": " << file_bytes << " bytes (weights " << f64_total
+              << " bytes as f64)" << std::endl;
+
+    // End-to-end effect on the calibration sample
+    if (!sample.empty()) {
+        const ModelFile converted(options.output);
+        const FlatWeights weights = map_weights(converted);
+        const double loss_after = sample_loss(config, weights, sample, tokenizer.BOS);
+        std::cout << std::fixed << std::setprecision(4) << "calibration loss on " << sample.size()
+                  << " docs: " << loss_before << " -> " << loss_after << " (" << std::showpos
+                  << loss_after - loss_before << std::noshowpos << ")" << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Check the metadata and every tensor of a model file against their checksums
+ */
+static int verify(const std::string& path) {
+    const auto start = std::chrono::steady_clock::now();
+    const ModelFile file(path);
+    if (!file.has_checksums()) {
+        std::cout << path << ": format v" << file.header().version << " has no checksums; nothing to verify"
+                  << std::endl;
+        return 0;
+    }
+    const std::vector<std::string> corrupt = file.verify();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (const auto& e : file.tensors()) {
+        const bool ok = std::find(corrupt.begin(), corrupt.end(), e.tensor_name()) == corrupt.end();
+        std::cout << std::left << std::setw(20) << e.tensor_name() << std::right << std::setw(6)
+                  << dtype_name(DType(e.dtype)) << std::setw(12) << e.bytes << "  " << std::hex << std::setw(16)
+                  << std::setfill('0') << e.checksum << std::dec << std::setfill(' ') << "  "
+                  << (ok ? "ok" : "CORRUPT") << std::endl;
+    }
+    std::cout << path << ": " << file.tensors().size() - corrupt.size() << "/" << file.tensors().size()
+              << " tensors intact (" << file.header().file_bytes << " bytes in " << std::fixed
+              << std::setprecision(3) << seconds << " s)" << std::endl;
+    return corrupt.empty() ? 0 : 2;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 3 && std::string(argv[1]) == "--verify") {
+        try {
+            return verify(argv[2]);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    ConvertOptions options;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--dtype" && i + 1 < argc) {
+            try {
+                options.dtype = parse_weight_dtype(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        } else if (arg == "--calibrate" && i + 1 < argc) {
+            options.calibration_path = argv[++i];
+        } else if (arg == "--samples" && i + 1 < argc) {
+            options.samples = std::stoi(argv[++i]);
+        } else if (arg.rfind("--", 0) != 0) {
+            positional.push_back(arg);
+        } else {
+            positional.clear();
+            break;
+        }
+    }
+    if (positional.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " INPUT OUTPUT [--dtype f64|f16|bf16|i8|i4] [--calibrate docs.txt]"
+                  << " [--samples N]\n       " << argv[0] << " --verify FILE" << std::endl;
+        return 1;
+    }
+    options.input = positional[0];
+    options.output = positional[1];
+
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        int status;
+        if (is_model_file(options.input)) {
+            const ModelFile file(options.input);
+            const GPT model = GPT::from_model_file(file);
+            std::cout << "Read " << options.input << " (format v" << file.header().version << ")" << std::endl;
+            status = file.tokenizer_kind() == TokenizerKind::BPE ? convert(model, file.bpe_tokenizer(), options)
+                                                                 : convert(model, file.tokenizer(), options);
+        } else if (GPT::uses_bpe_tokenizer(options.input)) {
+            const auto [model, tokenizer] = GPT::load_weights_bpe(options.input);
+            std::cout << "Read " << options.input << " (legacy format)" << std::endl;
+            status = convert(model, tokenizer, options);
+        } else {
+            const auto [model, tokenizer] = GPT::load_weights(options.input);
+            std::cout << "Read " << options.input << " (legacy format)" << std::endl;
+            status = convert(model, tokenizer, options);
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (status == 0) {
+            std::cout << "Converted in " << std::fixed << std::setprecision(2) << seconds << " s" << std::endl;
+        }
+        return status;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+}
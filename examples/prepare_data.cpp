@@ -0,0 +1,55 @@
+/**
+ * Dataset converter for microgpt-cpp
+ * Tokenizes a text corpus (one document per line) into the memory-mapped
+ * binary format read by TokenDataset, for use with ./train --data FILE.
+ */
+
+#include <microgpt/microgpt.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+using namespace microgpt;
+
+int main(int argc, char** argv) {
+    const std::string input = argc > 1 ? argv[1] : "data/names.txt";
+    const std::string output = argc > 2 ? argv[2] : "data/names.tok";
+    if (argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " [input.txt] [output.tok]" << std::endl;
+        return 1;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    Corpus corpus = load_corpus(input);
+    auto& docs = corpus.docs;
+    if (docs.empty()) {
+        std::cerr << "Error: Could not load " << input << std::endl;
+        return 1;
+    }
+    // Stored pre-shuffled, so walking the file in order matches ./train on the text
+    shuffle(docs);
+
+    Tokenizer tokenizer;
+    tokenizer.fit(docs);
+
+    try {
+        const auto header = write_token_dataset(output, docs, tokenizer);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "docs: " << header.num_docs << ", tokens: " << header.num_tokens
+                  << ", vocab size: " << header.vocab_size << ", token bytes: " << header.token_bytes << std::endl;
+        std::cout << "Wrote " << output << " in " << seconds << " s" << std::endl;
+
+        // Read it back through the mapping as a check
+        TokenDataset dataset(output);
+        std::vector<int> first;
+        dataset.append_doc(0, first);
+        if (first != tokenizer.encode(docs[0])) {
+            std::cerr << "Error: round trip mismatch" << std::endl;
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
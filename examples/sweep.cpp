@@ -0,0 +1,87 @@
+/**
+ * Population-based hyperparameter sweep example for microgpt-cpp
+ * Trains several small models concurrently and writes a results table.
+ * Based on Andrej Karpathy's microGPT: https://gist.github.com/karpathy/8627fe009c40f57531cb18360106ce95
+ */
+
+#include <microgpt/microgpt.h>
+#include <iostream>
+#include <string>
+
+using namespace microgpt;
+
+int main(int argc, char** argv) {
+    // Command line options
+    SweepOptions options;
+    std::string results_path = "sweep_results.csv";  // --out FILE
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--steps" && i + 1 < argc) {
+            options.total_steps = std::stoi(argv[++i]);
+        } else if (arg == "--interval" && i + 1 < argc) {
+            options.exploit_interval = std::stoi(argv[++i]);
+        } else if (arg == "--workers" && i + 1 < argc) {
+            options.n_workers = std::stoi(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            results_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--steps N] [--interval N] [--workers N] [--out FILE]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    // Load dataset
+    std::cout << "Loading dataset..." << std::endl;
+    auto docs = load_docs("data/names.txt");
+    if (docs.empty()) {
+        std::cerr << "Error: Could not load data/names.txt" << std::endl;
+        return 1;
+    }
+    shuffle(docs);
+    auto [train_docs, val_docs] = split_docs(docs, 0.05);
+
+    Tokenizer tokenizer;
+    tokenizer.fit(docs);
+
+    // Tokenized once and shared read-only by every member
+    const auto train = TokenizedDocs::encode(train_docs, tokenizer);
+    const auto val = TokenizedDocs::encode(val_docs, tokenizer);
+
+    // Population: two model widths crossed with four learning rates
+    std::vector<TrialSpec> specs;
+    for (int n_embd : {8, 16}) {
+        for (double lr : {3e-3, 1e-2, 3e-2, 1e-1}) {
+            TrialSpec spec;
+            spec.name = "e" + std::to_string(n_embd) + "_lr" + std::to_string(lr).substr(0, 5);
+            spec.config = Config{
+                .vocab_size = tokenizer.vocab_size,
+                .n_embd = n_embd,
+                .n_head = 4,
+                .n_layer = 1,
+                .block_size = 8
+            };
+            spec.learning_rate = lr;
+            specs.push_back(spec);
+        }
+    }
+
+    // Worker count tuned for this CPU unless given with --workers
+    if (options.n_workers <= 0) {
+        options.n_workers = tuned_settings(specs.back().config).threads;
+    }
+
+    get_rng().seed(42);
+    PopulationSweep sweep(specs, train, &val, options);
+    std::cout << "population: " << specs.size() << ", steps: " << options.total_steps
+              << ", exploit every: " << options.exploit_interval << ", workers: " << options.n_workers << "\n"
+              << std::endl;
+
+    sweep.run();
+
+    std::cout << std::endl;
+    sweep.print_results();
+    sweep.write_results(results_path);
+    std::cout << "\nResults written to " << results_path << std::endl;
+    return 0;
+}
@@ -4,31 +4,190 @@
  */
 
 #include <microgpt/microgpt.h>
-#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <memory>
+#include <sstream>
+#include <string>
 
 using namespace microgpt;
 
-int main() {
-    // Load dataset
-    std::cout << "Loading dataset..." << std::endl;
-    auto docs = load_docs("data/names.txt");
-    if (docs.empty()) {
-        std::cerr << "Error: Could not load data/names.txt" << std::endl;
+int main(int argc, char** argv) {
+    // Command line options
+    bool pack = false;           // --pack: fill every block_size window with several documents
+    std::string telemetry_path;  // --telemetry FILE: per-step JSON lines + periodic summary
+    double val_fraction = 0.0;   // --val-fraction F: hold out this share of the docs
+    int eval_every = 50;         // --eval-every N: validate in the background every N steps
+    std::string data_path;       // --data FILE: pre-tokenized dataset from prepare_data
+    std::vector<std::string> shards;  // --stream A,B,...: stream text/token shards larger than RAM
+    int bpe_vocab = 0;           // --bpe N: byte-level BPE with N tokens instead of characters
+    int checkpoint_every = 0;    // --checkpoint-every N: write checkpoint.bin in the background every N steps
+    int delta_base_every = 0;    // --delta-checkpoints N: checkpoint-STEP.bin deltas, a full base every N
+    std::string resume_path;     // --resume FILE: continue exactly from a checkpoint (or delta) of this trainer
+    DType export_dtype = DType::F64;  // --export-dtype f16|bf16|i8|i4: smaller model_weights.bin
+    std::string trace_path;      // --trace FILE: Chrome/Perfetto trace of forward, backward, data and checkpoints
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--pack") {
+            pack = true;
+        } else if (arg == "--telemetry" && i + 1 < argc) {
+            telemetry_path = argv[++i];
+        } else if (arg == "--val-fraction" && i + 1 < argc) {
+            val_fraction = std::stod(argv[++i]);
+        } else if (arg == "--eval-every" && i + 1 < argc) {
+            eval_every = std::stoi(argv[++i]);
+        } else if (arg == "--data" && i + 1 < argc) {
+            data_path = argv[++i];
+        } else if (arg == "--stream" && i + 1 < argc) {
+            std::stringstream list(argv[++i]);
+            for (std::string shard; std::getline(list, shard, ',');) {
+                shards.push_back(shard);
+            }
+        } else if (arg == "--bpe" && i + 1 < argc) {
+            bpe_vocab = std::stoi(argv[++i]);
+        } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+            checkpoint_every = std::stoi(argv[++i]);
+        } else if (arg == "--delta-checkpoints" && i + 1 < argc) {
+            delta_base_every = std::stoi(argv[++i]);
+        } else if (arg == "--resume" && i + 1 < argc) {
+            resume_path = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--export-dtype" && i + 1 < argc) {
+            try {
+                export_dtype = parse_weight_dtype(argv[++i]);
+            } catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [--pack] [--telemetry FILE] [--val-fraction F] [--eval-every N] [--data FILE]"
+                      << " [--stream SHARD,...] [--bpe N] [--checkpoint-every N]"
+                      << " [--delta-checkpoints N] [--resume FILE] [--export-dtype f64|f16|bf16|i8|i4]"
+                      << " [--trace FILE]" << std::endl;
+            return 1;
+        }
+    }
+    if ((!data_path.empty() || !shards.empty()) && val_fraction > 0.0) {
+        std::cerr << "Error: --val-fraction needs the text dataset; it cannot be combined with --data or --stream"
+                  << std::endl;
         return 1;
     }
-    shuffle(docs);
-    std::cout << "num docs: " << docs.size() << std::endl;
+    if (!shards.empty() && (pack || !data_path.empty())) {
+        std::cerr << "Error: --stream cannot be combined with --pack or --data" << std::endl;
+        return 1;
+    }
+    if (bpe_vocab > 0 && (!data_path.empty() || !shards.empty())) {
+        std::cerr << "Error: --bpe needs the text dataset; it cannot be combined with --data or --stream"
+                  << std::endl;
+        return 1;
+    }
+    if (!trace_path.empty()) {
+        trace_thread_name("trainer");
+        trace_start();
+    }
 
-    // Create tokenizer
+    // A training checkpoint carries the weights, optimizer state, RNG and data position
+    std::unique_ptr<ModelFile> checkpoint;
+    TrainingProgress progress;
+    if (!resume_path.empty()) {
+        try {
+            if (is_delta_checkpoint(resume_path)) {
+                reconstruct_checkpoint(resume_path, resume_path + ".full");
+                resume_path += ".full";
+                std::cout << "reconstructed " << resume_path << " from its base" << std::endl;
+            }
+            checkpoint = std::make_unique<ModelFile>(resume_path);
+            if (!load_training_progress(*checkpoint, progress)) {
+                throw std::runtime_error(resume_path + " is not a training checkpoint");
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (checkpoint->tokenizer_kind() == TokenizerKind::BPE && (!data_path.empty() || !shards.empty())) {
+            std::cerr << "Error: a BPE checkpoint needs the text dataset" << std::endl;
+            return 1;
+        }
+    }
+
+    // Load dataset: streamed shards, a memory-mapped pre-tokenized file, or the text file
+    std::cout << "Loading dataset..." << std::endl;
+    std::unique_ptr<StreamingDataset> stream;
+    std::unique_ptr<TokenDataset> dataset;
+    Corpus corpus;  // text documents as views into one buffer
+    auto& docs = corpus.docs;
     Tokenizer tokenizer;
-    tokenizer.fit(docs);
-    std::cout << "vocab size: " << tokenizer.vocab_size << std::endl;
+    if (!shards.empty()) {
+        try {
+            // Token shards carry their tokenizer; text-only streams need one pass over the text
+            bool any_binary = false;
+            for (const auto& shard : shards) {
+                any_binary = any_binary || is_token_dataset(shard);
+            }
+            if (!any_binary) {
+                tokenizer = fit_tokenizer_streaming(shards);
+            }
+            stream = std::make_unique<StreamingDataset>(shards, any_binary ? nullptr : &tokenizer, StreamOptions{},
+                                                        progress.stream);
+            tokenizer = stream->tokenizer();
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "num shards: " << shards.size() << std::endl;
+    } else if (!data_path.empty()) {
+        try {
+            dataset = std::make_unique<TokenDataset>(data_path);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        tokenizer = dataset->tokenizer();
+        std::cout << "num docs: " << dataset->size() << std::endl;
+    } else {
+        corpus = load_corpus("data/names.txt");
+        if (docs.empty()) {
+            std::cerr << "Error: Could not load data/names.txt" << std::endl;
+            return 1;
+        }
+        shuffle(docs);
+        std::cout << "num docs: " << docs.size() << std::endl;
+        tokenizer.fit(docs);
+    }
+
+    // Hold out a validation split (empty unless --val-fraction is given)
+    auto [train_docs, val_docs] = split_docs(docs, val_fraction);
+    if (!val_docs.empty()) {
+        std::cout << "train docs: " << train_docs.size() << ", val docs: " << val_docs.size() << std::endl;
+    }
+
+    // Optionally learn byte-level BPE merges on the training split (or take them from the checkpoint)
+    BPETokenizer bpe;
+    if (checkpoint && checkpoint->tokenizer_kind() == TokenizerKind::BPE) {
+        bpe = checkpoint->bpe_tokenizer();
+        bpe_vocab = bpe.vocab_size;
+    } else if (bpe_vocab > 0) {
+        try {
+            bpe.fit(train_docs, bpe_vocab);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        std::cout << "bpe merges: " << bpe.merges().size() << std::endl;
+    }
+    const int vocab_size = bpe_vocab > 0 ? bpe.vocab_size : tokenizer.vocab_size;
+    const int bos = bpe_vocab > 0 ? bpe.BOS : tokenizer.BOS;
+    std::cout << "vocab size: " << vocab_size << std::endl;
+    if (checkpoint && checkpoint->header().vocab_size != vocab_size) {
+        std::cerr << "Error: " << resume_path << " was trained with a different tokenizer" << std::endl;
+        return 1;
+    }
 
     // Model configuration (matching Python version)
     Config config;
-    config.vocab_size = tokenizer.vocab_size;
+    config.vocab_size = vocab_size;
     config.n_embd = 16;
     config.n_head = 4;
     config.n_layer = 1;
@@ -45,6 +204,15 @@ int main() {
     // Initialize model
     std::cout << "Initializing model..." << std::endl;
     GPT model(config);
+    if (checkpoint) {
+        try {
+            model = GPT::from_model_file(*checkpoint);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        config = model.config;
+    }
     auto params = model.state_dict.get_all_params();
     
     // Validate all parameters
@@ -57,18 +225,82 @@ int main() {
     // Initialize optimizer
     Adam optimizer(1e-2, 0.9, 0.95, 1e-8);
     optimizer.init(params.size());
+    if (checkpoint) {
+        try {
+            load_training_state(*checkpoint, optimizer, progress);
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        if (optimizer.m.size() != params.size()) {
+            std::cerr << "Error: optimizer state in " << resume_path << " does not match the model" << std::endl;
+            return 1;
+        }
+        std::cout << "resuming after step " << progress.step << std::endl;
+    }
+
+    // Background loader: tokenizes upcoming documents off the critical path.
+    // Text docs are already shuffled once, so walk them in order like the Python
+    // version; a pre-tokenized dataset is shuffled by the loader instead.
+    const DataLoaderOptions loader_options{
+        .batch_size = 1, .prefetch = 4, .shuffle = dataset != nullptr,
+        .pack_block_size = pack ? config.block_size : 0};
+    std::unique_ptr<DataLoader> loader;
+    if (dataset) {
+        loader = std::make_unique<DataLoader>(*dataset, loader_options, progress.data);
+    } else if (bpe_vocab > 0) {
+        loader = std::make_unique<DataLoader>(std::span<const std::string_view>(train_docs), bpe, loader_options,
+                                              progress.data);
+    } else if (!stream) {
+        loader = std::make_unique<DataLoader>(std::span<const std::string_view>(train_docs), tokenizer,
+                                              loader_options, progress.data);
+    }
+
+    std::unique_ptr<Telemetry> telemetry;
+    if (!telemetry_path.empty()) {
+        telemetry = std::make_unique<Telemetry>(telemetry_path, 10);
+    }
+
+    // Validation runs on a weight snapshot in a background thread, with the
+    // batch size and matmul blocking tuned for this CPU
+    std::unique_ptr<AsyncEvaluator> evaluator;
+    if (!val_docs.empty()) {
+        const TunedSettings tuned = tuned_settings(config);
+        evaluator = bpe_vocab > 0
+            ? std::make_unique<AsyncEvaluator>(model, val_docs, bpe, tuned.batch_size, tuned.matmul_tile)
+            : std::make_unique<AsyncEvaluator>(model, val_docs, tokenizer, tuned.batch_size, tuned.matmul_tile);
+    }
+    auto report = [&](const std::vector<EvalResult>& results) {
+        for (const auto& r : results) {
+            std::cout << "eval at step " << std::setw(4) << r.step << " | val loss " << std::fixed
+                      << std::setprecision(4) << r.loss << " | val ppl " << r.perplexity << std::endl;
+            if (telemetry) {
+                telemetry->record_json(r.to_json());
+            }
+        }
+    };
+
+    // Checkpoints: the step loop only pays for copying weights and optimizer state
+    std::unique_ptr<AsyncCheckpointer> checkpointer;
+    if (checkpoint_every > 0) {
+        checkpointer = std::make_unique<AsyncCheckpointer>(2, delta_base_every);
+    }
 
     // Training loop
     const int num_steps = 500;
     std::cout << "\nTraining..." << std::endl;
 
-    for (int step = 0; step < num_steps; ++step) {
+    for (int step = static_cast<int>(progress.step); step < num_steps; ++step) {
         // Create storage for this training step
+        TraceScope span("step", "train", "step", step + 1);
         ValueStorage storage;
+        PhaseTimer timer;
+        StepTelemetry record;
+        record.step = step + 1;
         
-        // Sample a document
-        const std::string& doc = docs[step % docs.size()];
-        const auto tokens = tokenizer.encode(doc);
+        // Take the next prefetched (or streamed) document
+        const auto tokens = stream ? stream->next() : loader->next().sequence(0);
+        record.data_ms = timer.lap_ms();
         const int n = std::min(config.block_size, static_cast<int>(tokens.size()) - 1);
 
         if (n <= 0) {
@@ -81,15 +313,25 @@ int main() {
         std::vector<Value*> losses;
         losses.reserve(n);
 
-        for (int pos_id = 0; pos_id < n; ++pos_id) {
-            const int token_id = tokens[pos_id];
-            const int target_id = tokens[pos_id + 1];
+        int pos_id = 0;
+        for (int t = 0; t < n; ++t) {
+            const int token_id = tokens[t];
+            const int target_id = tokens[t + 1];
+
+            // A BOS inside a packed window starts a new document: reset attention and positions
+            if (t > 0 && token_id == bos) {
+                for (int li = 0; li < config.n_layer; ++li) {
+                    keys[li].clear();
+                    values[li].clear();
+                }
+                pos_id = 0;
+            }
 
             // Bounds checking
             assert(token_id >= 0 && token_id < config.vocab_size && "Token ID out of range");
             assert(target_id >= 0 && target_id < config.vocab_size && "Target ID out of range");
 
-            auto logits = model.forward(token_id, pos_id, keys, values, storage);
+            auto logits = model.forward(token_id, pos_id++, keys, values, storage);
             
             // Validate logits
             assert(!logits.empty() && "Forward pass returned empty logits");
@@ -123,6 +365,7 @@ int main() {
         assert(n_val != nullptr && "Null n_val");
         loss = storage.div(loss, n_val);
         assert(loss != nullptr && "Null loss after averaging");
+        record.forward_ms = timer.lap_ms();
 
         // Backward pass
         try {
@@ -132,8 +375,47 @@ int main() {
             return 1;
         }
 
+        record.backward_ms = timer.lap_ms();
+
         // Optimizer step
         optimizer.step(params, num_steps);
+        record.optimizer_ms = timer.lap_ms();
+
+        if (checkpointer && (step + 1) % checkpoint_every == 0) {
+            try {
+                // Delta mode keeps every checkpoint: deltas refer back to their base file
+                const std::string path = delta_base_every > 0
+                    ? "checkpoint-" + std::to_string(step + 1) + ".bin" : "checkpoint.bin";
+                const TrainingProgress now{static_cast<uint64_t>(step + 1), loader ? loader->cursor() : DataCursor{},
+                                           stream ? stream->cursor() : StreamCursor{}};
+                if (bpe_vocab > 0) {
+                    checkpointer->save(path, model, bpe, &optimizer, &now);
+                } else {
+                    checkpointer->save(path, model, tokenizer, &optimizer, &now);
+                }
+            } catch (const std::exception& e) {
+                std::cerr << "Error writing checkpoint at step " << step << ": " << e.what() << std::endl;
+                return 1;
+            }
+            record.checkpoint_ms = timer.lap_ms();
+        }
+
+        // Hand a weight snapshot to the background evaluator; training continues meanwhile
+        if (evaluator) {
+            if ((step + 1) % eval_every == 0 || step + 1 == num_steps) {
+                evaluator->submit(step + 1, model.state_dict);
+            }
+            report(evaluator->poll());
+        }
+
+        if (telemetry) {
+            record.tokens = n;
+            record.loss = loss->data;
+            record.graph_nodes = storage.size();
+            record.peak_storage_bytes = storage.bytes();
+            telemetry->record(record);
+            continue;  // the summary line replaces the plain progress line
+        }
 
         // Print progress
         if ((step + 1) % 10 == 0 || step == 0) {
@@ -142,32 +424,40 @@ int main() {
         }
     }
 
+    if (evaluator) {
+        report(evaluator->wait());
+    }
+    if (checkpointer) {
+        try {
+            checkpointer->wait();
+        } catch (const std::exception& e) {
+            std::cerr << "Error writing checkpoint: " << e.what() << std::endl;
+        }
+        std::cout << "checkpoints written: " << checkpointer->completed() << " ("
+                  << checkpointer->bytes_written() / 1024 << " KiB)" << std::endl;
+    }
+
     // Save model weights
     std::cout << "\nSaving model weights..." << std::endl;
-    std::ofstream outfile("model_weights.bin", std::ios::binary);
-    if (outfile.is_open()) {
-        // Save config
-        outfile.write(reinterpret_cast<const char*>(&config.vocab_size), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.n_embd), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.n_head), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.n_layer), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.block_size), sizeof(int));
-
-        // Save tokenizer
-        int uchars_size = static_cast<int>(tokenizer.uchars.size());
-        outfile.write(reinterpret_cast<const char*>(&uchars_size), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(tokenizer.uchars.data()), uchars_size);
-        outfile.write(reinterpret_cast<const char*>(&tokenizer.BOS), sizeof(int));
-
-        // Save parameters
-        for (const auto* p : params) {
-            assert(p != nullptr && "Null parameter during save");
-            outfile.write(reinterpret_cast<const char*>(&p->data), sizeof(double));
-        }
-        outfile.close();
+    try {
+        if (bpe_vocab > 0) {
+            model.save_weights("model_weights.bin", bpe, export_dtype);
+        } else {
+            model.save_weights("model_weights.bin", tokenizer, export_dtype);
+        }
         std::cout << "Model saved to model_weights.bin" << std::endl;
-    } else {
-        std::cerr << "Error: Could not save model weights" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: Could not save model weights: " << e.what() << std::endl;
+    }
+
+    if (!trace_path.empty()) {
+        trace_stop();
+        try {
+            const size_t events = trace_write_json(trace_path);
+            std::cout << "Trace written to " << trace_path << " (" << events << " events)" << std::endl;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
     }
 
     std::cout << "\nTraining complete!" << std::endl;
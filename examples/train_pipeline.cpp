@@ -0,0 +1,101 @@
+/**
+ * Pipeline-parallel training example for microgpt-cpp
+ * Compares single-threaded training against a layer pipeline as n_layer grows.
+ * Based on Andrej Karpathy's microGPT: https://gist.github.com/karpathy/8627fe009c40f57531cb18360106ce95
+ */
+
+#include <microgpt/microgpt.h>
+#include <iostream>
+#include <iomanip>
+#include <span>
+
+using namespace microgpt;
+
+int main() {
+    // Load dataset
+    std::cout << "Loading dataset..." << std::endl;
+    auto docs = load_docs("data/names.txt");
+    if (docs.empty()) {
+        std::cerr << "Error: Could not load data/names.txt" << std::endl;
+        return 1;
+    }
+    shuffle(docs);
+
+    Tokenizer tokenizer;
+    tokenizer.fit(docs);
+
+    std::vector<std::vector<int>> encoded;
+    encoded.reserve(docs.size());
+    for (const auto& doc : docs) {
+        encoded.push_back(tokenizer.encode(doc));
+    }
+
+    const int num_steps = 5;
+    const int micro_batches_per_step = 8;
+    const int max_stages = 4;
+
+    // Kept small: the single-threaded graph of a whole step must fit the
+    // 1000000-node build_topo limit, while each pipeline stage only holds its own layers
+    std::cout << "\n n_layer | stages | tokens/s | bubble | speedup" << std::endl;
+    std::cout << "---------+--------+----------+--------+--------" << std::endl;
+
+    for (int n_layer : {1, 2, 4, 8}) {
+        Config config{
+            .vocab_size = tokenizer.vocab_size,
+            .n_embd = 8,
+            .n_head = 2,
+            .n_layer = n_layer,
+            .block_size = 8
+        };
+
+        double baseline_tps = 0.0;
+        for (int stages : {1, std::min(max_stages, n_layer)}) {
+            if (stages == 1 && baseline_tps > 0.0) {
+                continue;
+            }
+
+            // Same initial weights for every run of this depth
+            get_rng().seed(42);
+            GPT model(config);
+            Adam optimizer(1e-2, 0.9, 0.95, 1e-8);
+            optimizer.init(model.state_dict.get_all_params().size());
+            PipelineTrainer trainer(model, stages);
+
+            int tokens = 0;
+            double seconds = 0.0;
+            double bubble = 0.0;
+            try {
+                for (int step = 0; step < num_steps; ++step) {
+                    std::vector<std::span<const int>> micro_batches;
+                    for (int m = 0; m < micro_batches_per_step; ++m) {
+                        micro_batches.emplace_back(encoded[(step * micro_batches_per_step + m) % encoded.size()]);
+                    }
+                    trainer.train_step(micro_batches, optimizer, num_steps);
+                    tokens += trainer.stats().tokens;
+                    seconds += trainer.stats().wall_seconds;
+                    bubble += trainer.stats().bubble_fraction;
+                }
+            } catch (const std::exception& e) {
+                std::cout << std::setw(8) << n_layer << " | " << std::setw(6) << trainer.n_stages()
+                          << " | skipped: " << e.what() << std::endl;
+                continue;
+            }
+
+            const double tps = seconds > 0.0 ? tokens / seconds : 0.0;
+            if (trainer.n_stages() == 1) {
+                baseline_tps = tps;
+            }
+            std::cout << std::setw(8) << n_layer << " | " << std::setw(6) << trainer.n_stages()
+                      << " | " << std::setw(8) << std::fixed << std::setprecision(1) << tps
+                      << " | " << std::setw(5) << std::setprecision(1) << 100.0 * bubble / num_steps << "%"
+                      << " | ";
+            if (baseline_tps > 0.0) {
+                std::cout << std::setw(5) << std::setprecision(2) << tps / baseline_tps << "x" << std::endl;
+            } else {
+                std::cout << "   n/a" << std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,553 @@
+#pragma once
+
+/**
+ * Asynchronous block reader over dataset shards.
+ *
+ * Shards are read front to back in large blocks with up to queue_depth reads
+ * in flight, running on into the next shard while the last blocks of the
+ * current one are still being read. Blocks are handed out in file order; a
+ * block's buffer goes back into the read queue as soon as the consumer asks
+ * for the next one, so I/O overlaps with tokenization and training.
+ *
+ * Reads go through io_uring (raw system calls, no liburing) when the kernel
+ * allows it, else through a pool of threads calling pread. Either way the
+ * consumer only waits when the block it needs has not landed yet.
+ */
+
+#include "trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define MICROGPT_HAVE_IO_URING 1
+#else
+#define MICROGPT_HAVE_IO_URING 0
+#endif
+
+namespace microgpt {
+
+/**
+ * Asynchronous reader configuration
+ */
+struct AsyncReadOptions {
+    size_t block_size = 1 << 20;   // bytes per read
+    int queue_depth = 8;           // reads in flight (and buffers allocated)
+    bool use_io_uring = true;      // false forces the pread threads
+};
+
+#if MICROGPT_HAVE_IO_URING
+namespace detail {
+
+/**
+ * Minimal io_uring instance: one submission and one completion ring, used by
+ * a single thread
+ */
+class IoUring {
+public:
+    /**
+     * @return false if the kernel refuses io_uring (too old, disabled, seccomp)
+     */
+    bool init(unsigned entries) {
+        io_uring_params params{};
+        const long fd = ::syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) {
+            return false;
+        }
+        fd_ = static_cast<int>(fd);
+
+        sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+        }
+        sq_ptr_ = ::mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                         IORING_OFF_SQ_RING);
+        if (sq_ptr_ == MAP_FAILED) {
+            sq_ptr_ = nullptr;
+            close();
+            return false;
+        }
+        if (single) {
+            cq_ptr_ = sq_ptr_;
+        } else {
+            cq_ptr_ = ::mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                             IORING_OFF_CQ_RING);
+            if (cq_ptr_ == MAP_FAILED) {
+                cq_ptr_ = nullptr;
+                close();
+                return false;
+            }
+        }
+        sqes_len_ = params.sq_entries * sizeof(io_uring_sqe);
+        void* sqes = ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                            IORING_OFF_SQES);
+        if (sqes == MAP_FAILED) {
+            close();
+            return false;
+        }
+        sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+        auto* sq = static_cast<char*>(sq_ptr_);
+        auto* cq = static_cast<char*>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    ~IoUring() {
+        close();
+    }
+
+    /**
+     * Queue and submit one readv of iov at offset, tagged with user_data
+     */
+    void submit_readv(int fd, const iovec* iov, uint64_t offset, uint64_t user_data) {
+        const unsigned tail = *sq_tail_;  // only this thread writes the tail
+        const unsigned index = tail & sq_mask_;
+        io_uring_sqe& sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;  // READV predates READ, so older kernels work too
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(iov);
+        sqe.len = 1;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array_[index] = index;
+        std::atomic_ref<unsigned>(*sq_tail_).store(tail + 1, std::memory_order_release);
+        enter(1, 0, 0);
+    }
+
+    /**
+     * Call fn(user_data, res) for every completion; optionally block until one arrives
+     */
+    template <typename Fn>
+    void reap(bool wait, Fn fn) {
+        if (wait && !has_completions()) {
+            enter(0, 1, IORING_ENTER_GETEVENTS);
+        }
+        std::atomic_ref<unsigned> head_ref(*cq_head_);
+        unsigned head = head_ref.load(std::memory_order_relaxed);
+        const unsigned tail = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            fn(cqe.user_data, cqe.res);
+            ++head;
+        }
+        head_ref.store(head, std::memory_order_release);
+    }
+
+private:
+    int fd_ = -1;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    size_t sq_len_ = 0;
+    size_t cq_len_ = 0;
+    size_t sqes_len_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    bool has_completions() const {
+        return std::atomic_ref<unsigned>(*cq_head_).load(std::memory_order_relaxed) !=
+               std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+    }
+
+    void enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        while (::syscall(__NR_io_uring_enter, fd_, to_submit, min_complete, flags, nullptr, 0) < 0) {
+            if (errno != EINTR) {
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            }
+        }
+    }
+
+    void close() {
+        if (sqes_ != nullptr) {
+            ::munmap(sqes_, sqes_len_);
+            sqes_ = nullptr;
+        }
+        if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+            ::munmap(cq_ptr_, cq_len_);
+        }
+        if (sq_ptr_ != nullptr) {
+            ::munmap(sq_ptr_, sq_len_);
+        }
+        sq_ptr_ = cq_ptr_ = nullptr;
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+};
+
+}  // namespace detail
+#endif
+
+/**
+ * Sequential reader over a list of shards with reads issued ahead of the consumer
+ */
+class AsyncShardReader {
+public:
+    struct Block {
+        size_t shard = 0;              // index into the shard list
+        uint64_t offset = 0;           // file offset of data[0]
+        std::span<const char> data;
+        bool shard_end = false;        // last block of its shard
+    };
+
+    /**
+     * @param shards Files to read, in order
+     * @param options Block size, reads in flight and backend
+     * @param start_offset Where to start in the first shard
+     */
+    explicit AsyncShardReader(std::vector<std::string> shards, AsyncReadOptions options = {},
+                              uint64_t start_offset = 0)
+        : shards_(std::move(shards)), options_(options), plan_offset_(start_offset) {
+        options_.block_size = std::max<size_t>(options_.block_size, 4096);
+        options_.queue_depth = std::clamp(options_.queue_depth, 1, 256);
+        fds_.assign(shards_.size(), -1);
+        sizes_.assign(shards_.size(), 0);
+        slots_ = std::make_unique<Slot[]>(options_.queue_depth);
+        for (int i = 0; i < options_.queue_depth; ++i) {
+            slots_[i].buffer.resize(options_.block_size);
+        }
+
+#if MICROGPT_HAVE_IO_URING
+        if (options_.use_io_uring) {
+            ring_ = std::make_unique<detail::IoUring>();
+            if (!ring_->init(static_cast<unsigned>(options_.queue_depth))) {
+                ring_.reset();
+            }
+        }
+#endif
+        if (!ring_) {
+            const int n_threads = std::min(options_.queue_depth, 8);
+            for (int i = 0; i < n_threads; ++i) {
+                workers_.emplace_back([this] { worker_loop(); });
+            }
+        }
+
+        // A shard that cannot be opened must not leave workers waiting or reads in flight
+        try {
+            fill();
+        } catch (...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    ~AsyncShardReader() {
+        shutdown();
+    }
+
+    AsyncShardReader(const AsyncShardReader&) = delete;
+    AsyncShardReader& operator=(const AsyncShardReader&) = delete;
+
+    /**
+     * Next block in file order, waiting for its read if needed. The block stays
+     * valid until the following call.
+     * @return false once every shard has been read
+     * @throws std::runtime_error if a shard cannot be opened or read
+     */
+    bool next(Block& block) {
+        release();
+        if (next_consume_ == next_submit_) {
+            return false;
+        }
+        Slot& slot = slots_[next_consume_ % options_.queue_depth];
+        TraceScope span("io.wait", "io");
+        while (slot.state.load(std::memory_order_acquire) != kDone) {
+            if (ring_) {
+                reap(true);
+            } else {
+                slot.state.wait(kPending, std::memory_order_acquire);
+            }
+        }
+        return take(block);
+    }
+
+    /**
+     * Like next(), but never waits: false if the next block has not landed yet
+     * (or everything has been read; see done())
+     */
+    bool try_next(Block& block) {
+        release();
+        if (next_consume_ == next_submit_) {
+            return false;
+        }
+        if (ring_) {
+            reap(false);
+        }
+        if (slots_[next_consume_ % options_.queue_depth].state.load(std::memory_order_acquire) != kDone) {
+            return false;
+        }
+        return take(block);
+    }
+
+    /**
+     * Whether every block has been handed out
+     */
+    bool done() const {
+        return next_consume_ == next_submit_ && plan_shard_ >= shards_.size();
+    }
+
+    /**
+     * "io_uring" or "pread"
+     */
+    const char* backend() const {
+        return ring_ ? "io_uring" : "pread";
+    }
+
+private:
+    enum : int { kIdle = 0, kPending = 1, kDone = 2 };
+
+    struct Slot {
+        std::vector<char> buffer;
+        int fd = -1;
+        size_t shard = 0;
+        uint64_t offset = 0;
+        size_t length = 0;             // bytes requested
+        size_t filled = 0;             // bytes read so far
+        bool shard_end = false;
+        int error = 0;
+        std::atomic<int> state{kIdle};
+#if MICROGPT_HAVE_IO_URING
+        iovec iov{};
+#endif
+    };
+
+    std::vector<std::string> shards_;
+    AsyncReadOptions options_;
+    std::vector<int> fds_;
+    std::vector<uint64_t> sizes_;
+    std::unique_ptr<Slot[]> slots_;
+
+    size_t plan_shard_ = 0;            // next byte to request: shard and offset
+    uint64_t plan_offset_ = 0;
+    uint64_t next_submit_ = 0;         // sequence numbers; slot = sequence % queue_depth
+    uint64_t next_consume_ = 0;
+    bool holding_ = false;             // the consumer holds slot (next_consume_ - 1)
+
+#if MICROGPT_HAVE_IO_URING
+    std::unique_ptr<detail::IoUring> ring_;
+#else
+    std::unique_ptr<int> ring_;        // never set without io_uring support
+#endif
+    int in_flight_ = 0;
+
+    // pread fallback
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Slot*> queue_;
+    bool stop_ = false;
+
+    // Wait for reads still writing into the slots, stop the workers and close the shards
+    void shutdown() {
+        if (ring_) {
+            // The kernel writes into our buffers until each read completes
+            while (in_flight_ > 0) {
+                reap(true);
+            }
+        } else {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (auto& w : workers_) {
+                w.join();
+            }
+        }
+        for (int fd : fds_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    // Hand the consumer's previous block back and queue more reads
+    void release() {
+        if (holding_) {
+            holding_ = false;
+            Slot& slot = slots_[(next_consume_ - 1) % options_.queue_depth];
+            slot.state.store(kIdle, std::memory_order_relaxed);
+            if (slot.shard_end) {
+                ::close(fds_[slot.shard]);
+                fds_[slot.shard] = -1;
+            }
+        }
+        fill();
+    }
+
+    bool take(Block& block) {
+        Slot& slot = slots_[next_consume_ % options_.queue_depth];
+        ++next_consume_;
+        holding_ = true;
+        if (slot.error != 0) {
+            throw std::runtime_error("Could not read " + shards_[slot.shard] + ": " + std::strerror(slot.error));
+        }
+        block.shard = slot.shard;
+        block.offset = slot.offset;
+        block.data = std::span<const char>(slot.buffer.data(), slot.filled);
+        block.shard_end = slot.shard_end;
+        return true;
+    }
+
+    // Submit reads until every free buffer is in flight or all shards are planned
+    void fill() {
+        while (next_submit_ - next_consume_ + (holding_ ? 1 : 0) < static_cast<uint64_t>(options_.queue_depth)) {
+            if (!plan_next()) {
+                return;
+            }
+            Slot& slot = slots_[next_submit_ % options_.queue_depth];
+            slot.fd = fds_[plan_shard_];
+            slot.shard = plan_shard_;
+            slot.offset = plan_offset_;
+            slot.length = static_cast<size_t>(std::min<uint64_t>(options_.block_size, sizes_[plan_shard_] - plan_offset_));
+            slot.filled = 0;
+            slot.error = 0;
+            plan_offset_ += slot.length;
+            slot.shard_end = plan_offset_ == sizes_[plan_shard_];
+            if (slot.shard_end) {
+                ++plan_shard_;
+                plan_offset_ = 0;
+            }
+            slot.state.store(kPending, std::memory_order_relaxed);
+            ++next_submit_;
+            submit(slot);
+        }
+    }
+
+    // Open shards up to the next one with bytes left at the planned offset
+    bool plan_next() {
+        while (plan_shard_ < shards_.size()) {
+            if (fds_[plan_shard_] < 0) {
+                const std::string& path = shards_[plan_shard_];
+                const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd < 0) {
+                    throw std::runtime_error("Could not open shard " + path + ": " + std::strerror(errno));
+                }
+                struct stat st {};
+                if (::fstat(fd, &st) != 0) {
+                    const int err = errno;
+                    ::close(fd);
+                    throw std::runtime_error("Could not stat shard " + path + ": " + std::strerror(err));
+                }
+                ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+                fds_[plan_shard_] = fd;
+                sizes_[plan_shard_] = static_cast<uint64_t>(st.st_size);
+            }
+            if (plan_offset_ < sizes_[plan_shard_]) {
+                return true;
+            }
+            ::close(fds_[plan_shard_]);  // empty, or started past its end
+            fds_[plan_shard_] = -1;
+            ++plan_shard_;
+            plan_offset_ = 0;
+        }
+        return false;
+    }
+
+    void submit(Slot& slot) {
+#if MICROGPT_HAVE_IO_URING
+        if (ring_) {
+            slot.iov.iov_base = slot.buffer.data() + slot.filled;
+            slot.iov.iov_len = slot.length - slot.filled;
+            ring_->submit_readv(slot.fd, &slot.iov, slot.offset + slot.filled, reinterpret_cast<uint64_t>(&slot));
+            ++in_flight_;
+            return;
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(&slot);
+        }
+        cv_.notify_one();
+    }
+
+    // Collect io_uring completions, resubmitting the rest of short reads
+    void reap([[maybe_unused]] bool wait) {
+#if MICROGPT_HAVE_IO_URING
+        ring_->reap(wait, [this](uint64_t user_data, int res) {
+            --in_flight_;
+            Slot& slot = *reinterpret_cast<Slot*>(user_data);
+            if (res < 0) {
+                slot.error = -res;
+            } else {
+                slot.filled += static_cast<size_t>(res);
+                if (res > 0 && slot.filled < slot.length) {
+                    submit(slot);
+                    return;
+                }
+            }
+            slot.state.store(kDone, std::memory_order_release);
+        });
+#endif
+    }
+
+    void worker_loop() {
+        trace_thread_name("io_reader");
+        while (true) {
+            Slot* slot = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                if (stop_) {
+                    return;
+                }
+                slot = queue_.front();
+                queue_.pop_front();
+            }
+            TraceScope span("io.pread", "io");
+            while (slot->filled < slot->length) {
+                const ssize_t n = ::pread(slot->fd, slot->buffer.data() + slot->filled, slot->length - slot->filled,
+                                          static_cast<off_t>(slot->offset + slot->filled));
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n < 0) {
+                    slot->error = errno;
+                }
+                if (n <= 0) {
+                    break;  // error, or the file shrank
+                }
+                slot->filled += static_cast<size_t>(n);
+            }
+            slot->state.store(kDone, std::memory_order_release);
+            slot->state.notify_one();
+        }
+    }
+};
+
+}  // namespace microgpt
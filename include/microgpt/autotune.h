@@ -0,0 +1,366 @@
+#pragma once
+
+/**
+ * Per-host autotuning of throughput settings.
+ *
+ * The best worker thread count, inference batch size and matmul row blocking
+ * depend on the CPU and the model shape. The first time a Config is used on a
+ * host, tuned_settings() micro-benchmarks the candidates and stores the winners
+ * in a small cache file keyed by CPU model and config hash; later runs read
+ * them back. cached_tuned_settings() only reads the cache, for short runs that
+ * should neither pay for benchmarking nor write to the home directory. None of
+ * the settings change numerical results, only speed.
+ *
+ * Environment:
+ *   MICROGPT_AUTOTUNE=off          use the defaults without benchmarking
+ *   MICROGPT_AUTOTUNE_CACHE=FILE   cache location (default ~/.cache/microgpt/autotune.cache)
+ */
+
+#include "model.h"
+#include "nograd.h"
+#include "optimizer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+namespace microgpt {
+
+/**
+ * Tuned throughput settings for one (CPU, Config) pair
+ */
+struct TunedSettings {
+    int threads = 1;       // concurrent training workers (sweeps, pipeline stages)
+    int batch_size = 32;   // sequences per batched no-grad forward (evaluation, sampling)
+    int matmul_tile = 1;   // rows per block in matmul_nt
+};
+
+/**
+ * CPU model name from /proc/cpuinfo plus the hardware thread count
+ */
+inline std::string cpu_model_key() {
+    std::string model = "unknown";
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(cpuinfo, line)) {
+        if (line.rfind("model name", 0) == 0 || line.rfind("Model", 0) == 0) {
+            const auto colon = line.find(':');
+            if (colon != std::string::npos) {
+                model = line.substr(line.find_first_not_of(" \t", colon + 1));
+                break;
+            }
+        }
+    }
+    std::replace(model.begin(), model.end(), '\t', ' ');
+    return model + " x" + std::to_string(std::max(1u, std::thread::hardware_concurrency()));
+}
+
+/**
+ * 64-bit FNV-1a hash of the model shape
+ */
+inline uint64_t config_hash(const Config& config) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int field : {config.vocab_size, config.n_embd, config.n_head, config.n_layer, config.block_size}) {
+        for (int byte = 0; byte < 4; ++byte) {
+            h ^= static_cast<uint8_t>(static_cast<uint32_t>(field) >> (8 * byte));
+            h *= 0x100000001b3ULL;
+        }
+    }
+    return h;
+}
+
+/**
+ * Default cache file: $MICROGPT_AUTOTUNE_CACHE, else under $XDG_CACHE_HOME or ~/.cache
+ */
+inline std::string default_autotune_cache_path() {
+    if (const char* path = std::getenv("MICROGPT_AUTOTUNE_CACHE")) {
+        return path;
+    }
+    if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+        return std::string(xdg) + "/microgpt/autotune.cache";
+    }
+    if (const char* home = std::getenv("HOME")) {
+        return std::string(home) + "/.cache/microgpt/autotune.cache";
+    }
+    return "microgpt_autotune.cache";
+}
+
+/**
+ * Micro-benchmarks for the current CPU and a given Config
+ */
+class Autotuner {
+public:
+    /**
+     * @param config Model shape to tune for
+     * @param budget_ms Wall time spent measuring each candidate
+     */
+    explicit Autotuner(const Config& config, double budget_ms = 100.0) : config_(config), budget_ms_(budget_ms) {
+        // Benchmark weights must not disturb the global RNG that seeds training
+        const auto saved = get_rng();
+        model_ = std::make_unique<GPT>(config_);
+        get_rng() = saved;
+        weights_.layout(model_->state_dict);
+        weights_.copy_from(model_->state_dict);
+
+        // Synthetic full-length sequences with fixed random tokens
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<int> token(0, config_.vocab_size - 1);
+        sequences_.resize(64);
+        for (auto& seq : sequences_) {
+            seq.resize(config_.block_size + 1);
+            for (auto& t : seq) {
+                t = token(rng);
+            }
+        }
+    }
+
+    /**
+     * Benchmark all candidates, one setting at a time
+     */
+    TunedSettings run(std::ostream* log = nullptr) {
+        TunedSettings best;
+
+        // Matmul blocking, at a fixed batch large enough for the tile to matter
+        double best_rate = 0.0;
+        for (int tile : {1, 2, 4, 8}) {
+            const double rate = eval_tokens_per_second(32, tile);
+            report(log, "matmul_tile", tile, rate);
+            if (rate > best_rate * kMinGain) {
+                best_rate = rate;
+                best.matmul_tile = tile;
+            }
+        }
+
+        // Inference batch size with the chosen blocking
+        best_rate = 0.0;
+        for (int batch : {1, 4, 8, 16, 32, 64}) {
+            const double rate = eval_tokens_per_second(batch, best.matmul_tile);
+            report(log, "batch_size", batch, rate);
+            if (rate > best_rate * kMinGain) {
+                best_rate = rate;
+                best.batch_size = batch;
+            }
+        }
+
+        // Concurrent training workers, each running its own model
+        const int hw = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        std::vector<int> thread_candidates;
+        for (int t = 1; t < hw; t *= 2) {
+            thread_candidates.push_back(t);
+        }
+        thread_candidates.push_back(hw);
+        best_rate = 0.0;
+        for (int threads : thread_candidates) {
+            const double rate = train_tokens_per_second(threads);
+            report(log, "threads", threads, rate);
+            if (rate > best_rate * kMinGain) {
+                best_rate = rate;
+                best.threads = threads;
+            }
+        }
+        return best;
+    }
+
+private:
+    static constexpr double kMinGain = 1.05;  // a larger setting must win by 5% to be picked
+
+    Config config_;
+    double budget_ms_;
+    std::unique_ptr<GPT> model_;
+    FlatWeights weights_;
+    std::vector<std::vector<int>> sequences_;
+
+    static void report(std::ostream* log, const char* name, int value, double rate) {
+        if (log != nullptr) {
+            *log << "autotune: " << name << "=" << value << " -> " << static_cast<long long>(rate) << " tok/s"
+                 << std::endl;
+        }
+    }
+
+    double eval_tokens_per_second(int batch, int tile) {
+        NoGradModel model(config_, weights_, batch);
+        model.set_matmul_tile(tile);
+        std::vector<std::span<const int>> views(sequences_.begin(), sequences_.begin() + batch);
+
+        model.loss(views);  // warmup
+        size_t tokens = 0;
+        const auto start = std::chrono::steady_clock::now();
+        double elapsed = 0.0;
+        do {
+            tokens += model.loss(views).second;
+            elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed < budget_ms_);
+        return 1000.0 * tokens / elapsed;
+    }
+
+    double train_tokens_per_second(int threads) {
+        std::vector<std::unique_ptr<GPT>> models;
+        for (int t = 0; t < threads; ++t) {
+            models.push_back(std::make_unique<GPT>(*model_));
+        }
+
+        std::atomic<size_t> tokens{0};
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + std::chrono::duration<double, std::milli>(budget_ms_);
+        auto work = [&](int t) {
+            GPT& model = *models[t];
+            auto params = model.state_dict.get_all_params();
+            Adam optimizer;
+            optimizer.init(params.size());
+            size_t i = t;
+            do {
+                ValueStorage storage;
+                const auto& seq = sequences_[i++ % sequences_.size()];
+                model.train_step(seq, optimizer, storage, 1000);
+                tokens += seq.size() - 1;
+            } while (std::chrono::steady_clock::now() < deadline);
+        };
+
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; ++t) {
+            workers.emplace_back(work, t);
+        }
+        work(0);
+        for (auto& w : workers) {
+            w.join();
+        }
+        const double elapsed =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return tokens / elapsed;
+    }
+};
+
+/**
+ * Cached settings for key, if present in the cache file
+ */
+inline bool load_tuned_settings(const std::string& path, const std::string& key, TunedSettings& out) {
+    std::ifstream in(path);
+    std::string line;
+    bool found = false;
+    while (std::getline(in, line)) {
+        const auto tab = line.rfind('\t');
+        if (tab == std::string::npos || line.compare(0, tab, key) != 0 || tab != key.size()) {
+            continue;
+        }
+        TunedSettings s;
+        std::istringstream fields(line.substr(tab + 1));
+        if (fields >> s.threads >> s.batch_size >> s.matmul_tile && s.threads > 0 && s.batch_size > 0 &&
+            s.matmul_tile > 0) {
+            out = s;
+            found = true;  // keep scanning: the last entry wins
+        }
+    }
+    return found;
+}
+
+/**
+ * Store settings for key, replacing any previous entry. The file is rewritten
+ * through a temporary and renamed, so concurrent readers never see a torn file.
+ */
+inline void save_tuned_settings(const std::string& path, const std::string& key, const TunedSettings& s) {
+    std::vector<std::string> lines;
+    {
+        std::ifstream in(path);
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.rfind(key + '\t', 0) != 0) {
+                lines.push_back(line);
+            }
+        }
+    }
+    lines.push_back(key + '\t' + std::to_string(s.threads) + ' ' + std::to_string(s.batch_size) + ' ' +
+                    std::to_string(s.matmul_tile));
+
+    const std::filesystem::path target(path);
+    if (target.has_parent_path()) {
+        std::filesystem::create_directories(target.parent_path());
+    }
+    // Unique across processes sharing the cache, and across threads of one process
+    const std::string tmp = path + ".tmp." + std::to_string(::getpid()) + '.' +
+                            std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    {
+        std::ofstream out(tmp);
+        if (!out.is_open()) {
+            throw std::runtime_error("Could not open autotune cache for writing: " + tmp);
+        }
+        for (const auto& line : lines) {
+            out << line << '\n';
+        }
+    }
+    std::filesystem::rename(tmp, target);
+}
+
+namespace detail {
+
+inline bool autotune_disabled() {
+    const char* mode = std::getenv("MICROGPT_AUTOTUNE");
+    return mode != nullptr && (std::string(mode) == "off" || std::string(mode) == "0");
+}
+
+// Cache key: CPU model and config hash
+inline std::string autotune_key(const Config& config) {
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(config_hash(config)));
+    return cpu_model_key() + '|' + hash;
+}
+
+}  // namespace detail
+
+/**
+ * Settings for config on this host if a previous tuned_settings() cached them,
+ * otherwise the defaults; never benchmarks and never writes the cache
+ */
+inline TunedSettings cached_tuned_settings(const Config& config) {
+    TunedSettings settings;
+    if (!detail::autotune_disabled()) {
+        load_tuned_settings(default_autotune_cache_path(), detail::autotune_key(config), settings);
+    }
+    return settings;
+}
+
+/**
+ * Settings for config on this host: read from the cache, or benchmarked once
+ * and cached. Cache I/O failures fall back to tuning without persisting.
+ */
+inline TunedSettings tuned_settings(const Config& config, std::ostream& log = std::cout) {
+    if (detail::autotune_disabled()) {
+        return TunedSettings{};
+    }
+
+    const std::string path = default_autotune_cache_path();
+    const std::string key = detail::autotune_key(config);
+
+    TunedSettings settings;
+    if (load_tuned_settings(path, key, settings)) {
+        return settings;
+    }
+
+    log << "autotune: benchmarking settings for this CPU and config (once)..." << std::endl;
+    settings = Autotuner(config).run(&log);
+    log << "autotune: threads=" << settings.threads << " batch_size=" << settings.batch_size
+        << " matmul_tile=" << settings.matmul_tile << std::endl;
+    try {
+        save_tuned_settings(path, key, settings);
+    } catch (const std::exception& e) {
+        log << "autotune: not cached (" << e.what() << ")" << std::endl;
+    }
+    return settings;
+}
+
+}  // namespace microgpt
@@ -0,0 +1,203 @@
+#pragma once
+
+/**
+ * Minimal microbenchmark harness: warmup, timed repetitions, median / p95 and
+ * cycles per element, reported as a table or as JSON.
+ *
+ * Each repetition runs an untimed setup (e.g. rebuilding a graph for backward)
+ * followed by the timed body. Cycles come from the time-stamp counter on
+ * x86-64, which ticks at a constant reference rate rather than the current
+ * core clock; elsewhere they are not reported.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#define MICROGPT_HAVE_CYCLE_COUNTER 1
+#else
+#define MICROGPT_HAVE_CYCLE_COUNTER 0
+#endif
+
+namespace microgpt {
+
+/**
+ * Time-stamp counter, or 0 where none is available
+ */
+inline uint64_t cycle_count() {
+#if MICROGPT_HAVE_CYCLE_COUNTER
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct BenchOptions {
+    int warmup = 3;          // untimed repetitions before measuring
+    int reps = 20;           // timed repetitions
+};
+
+/**
+ * Statistics of one benchmark over its timed repetitions
+ */
+struct BenchResult {
+    std::string name;        // e.g. "linear"
+    std::string params;      // e.g. "n_embd=16 n_layer=1"
+    int reps = 0;
+    double elements = 0.0;   // work per repetition (ops, multiply-adds, bytes...)
+    std::string unit;        // what an element is
+    double median_ns = 0.0;
+    double p95_ns = 0.0;
+    double min_ns = 0.0;
+    double mean_ns = 0.0;
+    double cycles_per_element = 0.0;  // median cycles / elements; 0 without a cycle counter
+
+    double elements_per_second() const {
+        return median_ns > 0.0 ? elements * 1e9 / median_ns : 0.0;
+    }
+
+    /**
+     * One JSON object
+     */
+    std::string to_json() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3)
+            << "{\"name\":\"" << name << "\",\"params\":\"" << params << "\""
+            << ",\"reps\":" << reps
+            << ",\"elements\":" << elements
+            << ",\"unit\":\"" << unit << "\""
+            << ",\"median_ns\":" << median_ns
+            << ",\"p95_ns\":" << p95_ns
+            << ",\"min_ns\":" << min_ns
+            << ",\"mean_ns\":" << mean_ns
+            << ",\"elements_per_sec\":" << elements_per_second()
+            << ",\"cycles_per_element\":";
+        if (MICROGPT_HAVE_CYCLE_COUNTER) {
+            out << cycles_per_element;
+        } else {
+            out << "null";
+        }
+        out << "}";
+        return out.str();
+    }
+};
+
+/**
+ * Runs benchmarks and collects their results
+ */
+class Bench {
+public:
+    explicit Bench(BenchOptions options = {}) : options_(options) {}
+
+    /**
+     * Time body; setup runs untimed before every warmup and timed repetition
+     * @param elements Work done by one call of body, for throughput and cycles per element
+     */
+    template <typename Body, typename Setup>
+    const BenchResult& run(const std::string& name, const std::string& params, double elements,
+                           const std::string& unit, Body&& body, Setup&& setup) {
+        for (int i = 0; i < options_.warmup; ++i) {
+            setup();
+            body();
+        }
+        std::vector<double> ns;
+        std::vector<double> cycles;
+        ns.reserve(options_.reps);
+        cycles.reserve(options_.reps);
+        for (int i = 0; i < std::max(1, options_.reps); ++i) {
+            setup();
+            const uint64_t c0 = cycle_count();
+            const auto t0 = std::chrono::steady_clock::now();
+            body();
+            const auto t1 = std::chrono::steady_clock::now();
+            const uint64_t c1 = cycle_count();
+            ns.push_back(std::chrono::duration<double, std::nano>(t1 - t0).count());
+            cycles.push_back(static_cast<double>(c1 - c0));
+        }
+
+        BenchResult r;
+        r.name = name;
+        r.params = params;
+        r.reps = static_cast<int>(ns.size());
+        r.elements = elements;
+        r.unit = unit;
+        r.mean_ns = 0.0;
+        for (double t : ns) {
+            r.mean_ns += t / ns.size();
+        }
+        r.median_ns = percentile(ns, 0.5);
+        r.p95_ns = percentile(ns, 0.95);
+        r.min_ns = *std::min_element(ns.begin(), ns.end());
+        r.cycles_per_element = elements > 0.0 ? percentile(cycles, 0.5) / elements : 0.0;
+        results_.push_back(r);
+        return results_.back();
+    }
+
+    template <typename Body>
+    const BenchResult& run(const std::string& name, const std::string& params, double elements,
+                           const std::string& unit, Body&& body) {
+        return run(name, params, elements, unit, std::forward<Body>(body), [] {});
+    }
+
+    const std::vector<BenchResult>& results() const { return results_; }
+
+    /**
+     * Aligned human-readable table of all results
+     */
+    void print_table(std::ostream& out) const {
+        size_t name_width = 10;
+        size_t params_width = 7;
+        for (const auto& r : results_) {
+            name_width = std::max(name_width, r.name.size() + 2);
+            params_width = std::max(params_width, r.params.size() + 2);
+        }
+        const auto nw = static_cast<int>(name_width);
+        const auto pw = static_cast<int>(params_width);
+        out << std::left << std::setw(nw) << "benchmark" << std::setw(pw) << "params" << std::right
+            << std::setw(12) << "median us" << std::setw(12) << "p95 us" << std::setw(14) << "elem/s"
+            << std::setw(10) << "cyc/elem" << "  unit" << std::endl;
+        for (const auto& r : results_) {
+            out << std::left << std::setw(nw) << r.name << std::setw(pw) << r.params << std::right << std::fixed
+                << std::setprecision(2) << std::setw(12) << r.median_ns / 1e3 << std::setw(12) << r.p95_ns / 1e3
+                << std::scientific << std::setprecision(3) << std::setw(14) << r.elements_per_second()
+                << std::fixed << std::setprecision(2) << std::setw(10) << r.cycles_per_element << "  " << r.unit
+                << std::defaultfloat << std::endl;
+        }
+    }
+
+    /**
+     * All results as one JSON document: {"context": {...}, "results": [...]}
+     * @param context Preformatted JSON object describing the run (CPU, options)
+     */
+    void write_json(std::ostream& out, const std::string& context) const {
+        out << "{\"context\":" << context << ",\"results\":[\n";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            out << "  " << results_[i].to_json() << (i + 1 < results_.size() ? ",\n" : "\n");
+        }
+        out << "]}\n";
+    }
+
+    const BenchOptions& options() const { return options_; }
+
+private:
+    // Nearest-rank percentile
+    static double percentile(std::vector<double> samples, double q) {
+        std::sort(samples.begin(), samples.end());
+        const auto rank = static_cast<size_t>(std::ceil(q * samples.size()));
+        return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+    }
+
+    BenchOptions options_;
+    std::vector<BenchResult> results_;
+};
+
+}  // namespace microgpt
@@ -0,0 +1,359 @@
+#pragma once
+
+/**
+ * Byte-level byte-pair-encoding tokenizer.
+ *
+ * Ids 0-255 are raw bytes, each learned merge adds one id, and BOS is the last
+ * id. Text is split into words (a run of non-space bytes with the spaces that
+ * precede it) and merges never cross word boundaries.
+ *
+ * Training keeps every distinct word once, as a doubly linked list of symbols
+ * weighted by the word's frequency. Pair counts live in a hash map mirrored by
+ * a max-heap with lazy invalidation; each merge only touches the occurrences
+ * of the merged pair and updates the counts of their neighbours.
+ *
+ * Encoding applies merges in rank order within each word. The encodings of the
+ * most frequent training words are precomputed into a read-only cache, so
+ * encode is safe to call from several threads.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace microgpt {
+
+class BPETokenizer {
+public:
+    int BOS = 256;          // Beginning of Sequence token (the last id)
+    int vocab_size = 257;
+
+    BPETokenizer() {
+        rebuild();
+    }
+
+    /**
+     * Learn merges from docs (any range of strings or string_views)
+     * @param target_vocab_size Vocabulary size including the 256 bytes and BOS
+     * @param cache_words Most frequent words whose encodings are cached
+     */
+    template <typename Docs>
+    void fit(const Docs& docs, int target_vocab_size, size_t cache_words = 4096) {
+        if (target_vocab_size < 257) {
+            throw std::invalid_argument("BPE vocabulary needs at least 257 tokens (bytes + BOS)");
+        }
+
+        // Distinct words with their frequencies
+        std::unordered_map<std::string_view, int64_t> counts;
+        for (const auto& doc : docs) {
+            for_each_word(std::string_view(doc), [&](std::string_view w) { ++counts[w]; });
+        }
+        std::vector<std::pair<std::string_view, int64_t>> words(counts.begin(), counts.end());
+        std::sort(words.begin(), words.end());  // deterministic symbol layout
+
+        // All words as linked lists of symbols in one flat array
+        std::vector<int> sym, prev, next, word_of;
+        for (size_t w = 0; w < words.size(); ++w) {
+            const std::string_view text = words[w].first;
+            const int base = static_cast<int>(sym.size());
+            for (size_t i = 0; i < text.size(); ++i) {
+                sym.push_back(static_cast<unsigned char>(text[i]));
+                prev.push_back(i == 0 ? -1 : base + static_cast<int>(i) - 1);
+                next.push_back(i + 1 == text.size() ? -1 : base + static_cast<int>(i) + 1);
+                word_of.push_back(static_cast<int>(w));
+            }
+        }
+
+        // Pair counts and the positions (left node) where each pair may occur
+        std::unordered_map<uint64_t, int64_t> pair_count;
+        std::unordered_map<uint64_t, std::vector<int>> where;
+        for (size_t p = 0; p < sym.size(); ++p) {
+            if (next[p] >= 0) {
+                const uint64_t key = pair_key(sym[p], sym[next[p]]);
+                pair_count[key] += words[word_of[p]].second;
+                where[key].push_back(static_cast<int>(p));
+            }
+        }
+
+        // Max-heap on (count, smallest pair); stale entries are skipped when popped
+        using Entry = std::pair<int64_t, uint64_t>;
+        auto cmp = [](const Entry& a, const Entry& b) {
+            return a.first != b.first ? a.first < b.first : a.second > b.second;
+        };
+        std::priority_queue<Entry, std::vector<Entry>, decltype(cmp)> heap(cmp);
+        for (const auto& [key, count] : pair_count) {
+            heap.push({count, key});
+        }
+
+        auto add = [&](int a, int b, int64_t delta, int pos) {
+            const uint64_t key = pair_key(a, b);
+            const int64_t count = (pair_count[key] += delta);
+            if (delta > 0) {
+                where[key].push_back(pos);
+            }
+            if (count > 0) {
+                heap.push({count, key});
+            }
+        };
+
+        merges_.clear();
+        const int n_merges = target_vocab_size - 257;
+        while (static_cast<int>(merges_.size()) < n_merges && !heap.empty()) {
+            const auto [count, key] = heap.top();
+            heap.pop();
+            const auto it = pair_count.find(key);
+            if (it == pair_count.end() || it->second != count || count <= 0) {
+                continue;  // stale heap entry
+            }
+
+            const int a = static_cast<int>(key >> 32);
+            const int b = static_cast<int>(key & 0xffffffffu);
+            const int merged = 256 + static_cast<int>(merges_.size());
+            merges_.push_back({a, b});
+
+            // Left to right, so overlapping occurrences (e.g. "aaa") merge like encoding does
+            std::vector<int> positions = std::move(where[key]);
+            where.erase(key);
+            std::sort(positions.begin(), positions.end());
+            positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+            for (int p : positions) {
+                const int q = next[p];
+                if (sym[p] != a || q < 0 || sym[q] != b) {
+                    continue;  // already consumed by an earlier merge
+                }
+                const int64_t freq = words[word_of[p]].second;
+                const int left = prev[p];
+                const int right = next[q];
+
+                // Old neighbour pairs disappear, new ones appear
+                if (left >= 0) {
+                    add(sym[left], a, -freq, left);
+                }
+                if (right >= 0) {
+                    add(b, sym[right], -freq, q);
+                }
+                pair_count[key] -= freq;
+
+                sym[p] = merged;
+                sym[q] = -1;
+                next[p] = right;
+                if (right >= 0) {
+                    prev[right] = p;
+                }
+
+                if (left >= 0) {
+                    add(sym[left], merged, freq, left);
+                }
+                if (right >= 0) {
+                    add(merged, sym[right], freq, p);
+                }
+            }
+            pair_count.erase(key);
+        }
+        rebuild();
+
+        // Cache the encodings of the most frequent words
+        std::sort(words.begin(), words.end(), [](const auto& x, const auto& y) {
+            return x.second != y.second ? x.second > y.second : x.first < y.first;
+        });
+        words.resize(std::min(words.size(), cache_words));
+        warm_cache(words);
+    }
+
+    std::vector<int> encode(std::string_view text) const {
+        std::vector<int> tokens;
+        tokens.reserve(text.size() + 2);
+        encode_into(text, tokens);
+        return tokens;
+    }
+
+    /**
+     * Append BOS, the text's tokens and a closing BOS to an existing buffer
+     */
+    void encode_into(std::string_view text, std::vector<int>& tokens) const {
+        tokens.push_back(BOS);
+        thread_local std::vector<int> scratch;
+        for_each_word(text, [&](std::string_view word) {
+            const auto cached = cache_.find(word);
+            if (cached != cache_.end()) {
+                tokens.insert(tokens.end(), cached->second.begin(), cached->second.end());
+            } else {
+                encode_word(word, scratch);
+                tokens.insert(tokens.end(), scratch.begin(), scratch.end());
+            }
+        });
+        tokens.push_back(BOS);
+    }
+
+    std::string decode(std::span<const int> tokens) const {
+        std::string text;
+        for (int token : tokens) {
+            if (token >= 0 && token < BOS) {
+                text += pieces_[token];
+            }
+        }
+        return text;
+    }
+
+    const std::vector<std::pair<int, int>>& merges() const { return merges_; }
+
+    /**
+     * Bytes a token id stands for (empty for BOS)
+     */
+    const std::string& piece(int id) const { return pieces_.at(id); }
+
+    /**
+     * Write the merge list: "BPE1", uint32 merge count, then (uint32 a, uint32 b) per merge
+     */
+    void save(std::ostream& out) const {
+        out.write(kMagic, 4);
+        const auto n = static_cast<uint32_t>(merges_.size());
+        out.write(reinterpret_cast<const char*>(&n), sizeof(n));
+        for (const auto& [a, b] : merges_) {
+            const uint32_t pair[2] = {static_cast<uint32_t>(a), static_cast<uint32_t>(b)};
+            out.write(reinterpret_cast<const char*>(pair), sizeof(pair));
+        }
+    }
+
+    /**
+     * Read a merge list written by save(); the word cache starts empty (see warm_cache)
+     */
+    void load(std::istream& in) {
+        char magic[4] = {};
+        uint32_t n = 0;
+        in.read(magic, 4);
+        in.read(reinterpret_cast<char*>(&n), sizeof(n));
+        if (!in || std::memcmp(magic, kMagic, 4) != 0) {
+            throw std::runtime_error("Invalid BPE tokenizer data");
+        }
+        if (n > (1u << 20)) {
+            throw std::runtime_error("BPE merge count out of range");
+        }
+        merges_.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t pair[2] = {};
+            in.read(reinterpret_cast<char*>(pair), sizeof(pair));
+            if (!in || pair[0] >= 256 + i || pair[1] >= 256 + i) {
+                throw std::runtime_error("Invalid BPE merge in tokenizer data");
+            }
+            merges_[i] = {static_cast<int>(pair[0]), static_cast<int>(pair[1])};
+        }
+        rebuild();
+    }
+
+    /**
+     * Precompute the encodings of the given words (e.g. frequent words of a corpus).
+     * Not thread-safe; call before encoding from several threads.
+     */
+    template <typename Words>
+    void warm_cache(const Words& words) {
+        std::vector<int> scratch;
+        for (const auto& entry : words) {
+            const std::string_view word = word_of_entry(entry);
+            encode_word(word, scratch);
+            cache_.try_emplace(std::string(word), scratch);
+        }
+    }
+
+private:
+    static constexpr char kMagic[4] = {'B', 'P', 'E', '1'};
+
+    std::vector<std::pair<int, int>> merges_;            // merge i creates id 256 + i
+    std::unordered_map<uint64_t, int> ranks_;            // pair -> merge index
+    std::vector<std::string> pieces_;                    // id -> bytes
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+    std::unordered_map<std::string, std::vector<int>, StringHash, std::equal_to<>> cache_;
+
+    static uint64_t pair_key(int a, int b) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) | static_cast<uint32_t>(b);
+    }
+
+    template <typename Entry>
+    static std::string_view word_of_entry(const Entry& entry) {
+        if constexpr (requires { entry.first; }) {
+            return std::string_view(entry.first);
+        } else {
+            return std::string_view(entry);
+        }
+    }
+
+    // Words: each run of non-space bytes together with the spaces before it
+    template <typename Fn>
+    static void for_each_word(std::string_view text, Fn fn) {
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t i = start;
+            while (i < text.size() && text[i] == ' ') {
+                ++i;
+            }
+            while (i < text.size() && text[i] != ' ') {
+                ++i;
+            }
+            fn(text.substr(start, i - start));
+            start = i;
+        }
+    }
+
+    void rebuild() {
+        ranks_.clear();
+        cache_.clear();
+        pieces_.assign(256, std::string());
+        for (int b = 0; b < 256; ++b) {
+            pieces_[b] = std::string(1, static_cast<char>(b));
+        }
+        for (size_t i = 0; i < merges_.size(); ++i) {
+            ranks_[pair_key(merges_[i].first, merges_[i].second)] = static_cast<int>(i);
+            pieces_.push_back(pieces_[merges_[i].first] + pieces_[merges_[i].second]);
+        }
+        BOS = 256 + static_cast<int>(merges_.size());
+        vocab_size = BOS + 1;
+        pieces_.emplace_back();  // BOS decodes to nothing
+    }
+
+    // Repeatedly merge the adjacent pair with the lowest rank
+    void encode_word(std::string_view word, std::vector<int>& out) const {
+        out.clear();
+        for (char c : word) {
+            out.push_back(static_cast<unsigned char>(c));
+        }
+        while (out.size() > 1) {
+            int best_rank = std::numeric_limits<int>::max();
+            for (size_t i = 0; i + 1 < out.size(); ++i) {
+                const auto it = ranks_.find(pair_key(out[i], out[i + 1]));
+                if (it != ranks_.end() && it->second < best_rank) {
+                    best_rank = it->second;
+                }
+            }
+            if (best_rank == std::numeric_limits<int>::max()) {
+                break;
+            }
+            const auto [a, b] = merges_[best_rank];
+            size_t w = 0;
+            for (size_t r = 0; r < out.size(); ++r) {
+                if (r + 1 < out.size() && out[r] == a && out[r + 1] == b) {
+                    out[w++] = 256 + best_rank;
+                    ++r;
+                } else {
+                    out[w++] = out[r];
+                }
+            }
+            out.resize(w);
+        }
+    }
+};
+
+}  // namespace microgpt
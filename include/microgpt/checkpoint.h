@@ -0,0 +1,547 @@
+#pragma once
+
+/**
+ * Asynchronous checkpointing that does not stall training.
+ *
+ * save() copies the parameters and optimizer state into a free snapshot
+ * buffer and returns; a background thread writes the snapshot as a model file
+ * (model_file.h) with large sequential writes, fsyncs it and renames it into
+ * place. At most max_in_flight snapshots are queued or being written; save()
+ * waits for a buffer only when all of them are busy, which bounds memory and
+ * applies backpressure when the disk falls behind.
+ *
+ * A training checkpoint additionally holds the Adam moments and step count,
+ * the shared RNG and the data cursor, so load_training_state can continue a
+ * run exactly where the checkpoint was taken.
+ *
+ * In delta mode most checkpoints are delta files: the checkpoint is serialized
+ * in memory, cut into fixed-size blocks, and only the blocks whose hash
+ * differs from the last full (base) checkpoint are written, next to the name
+ * and hash of that base. Every base_every-th checkpoint is a new base.
+ * reconstruct_checkpoint rebuilds the full model file from base plus delta.
+ */
+
+#include "data_loader.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "model.h"
+#include "model_file.h"
+#include "nograd.h"
+#include "optimizer.h"
+#include "stream_dataset.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Optimizer state stored next to the weights in a checkpoint
+ */
+inline constexpr const char* kAdamMomentTensor = "optimizer/m";
+inline constexpr const char* kAdamVarianceTensor = "optimizer/v";
+inline constexpr const char* kAdamScalarsTensor = "optimizer/adam";  // lr, beta1, beta2, eps, step_count
+inline constexpr const char* kTrainingProgressTensor = "train/progress";
+inline constexpr const char* kRngStateTensor = "train/rng";          // get_rng() in stream form
+
+/**
+ * Where a training run stands: completed steps and the data position after
+ * the last consumed batch (DataLoader or StreamingDataset, whichever is used)
+ */
+struct TrainingProgress {
+    uint64_t step = 0;
+    DataCursor data;
+    StreamCursor stream;
+
+    std::vector<uint64_t> pack() const {
+        return {step, data.epoch, data.index, stream.epoch, stream.shard, stream.offset, stream.consumed, data.token};
+    }
+};
+
+/**
+ * Restore Adam state saved by AsyncCheckpointer
+ * @return false if the file holds no optimizer state
+ */
+inline bool load_optimizer_state(const ModelFile& file, Adam& optimizer) {
+    const ModelTensorEntry* m = file.find(kAdamMomentTensor);
+    const ModelTensorEntry* v = file.find(kAdamVarianceTensor);
+    const ModelTensorEntry* scalars = file.find(kAdamScalarsTensor);
+    if (m == nullptr || v == nullptr || scalars == nullptr) {
+        return false;
+    }
+    const auto s = file.data<double>(*scalars);
+    if (s.size() != 5 || m->elements() != v->elements()) {
+        throw std::runtime_error("Invalid optimizer state in model file");
+    }
+    const auto m_values = file.data<double>(*m);
+    const auto v_values = file.data<double>(*v);
+    optimizer.m.assign(m_values.begin(), m_values.end());
+    optimizer.v.assign(v_values.begin(), v_values.end());
+    optimizer.learning_rate = s[0];
+    optimizer.beta1 = s[1];
+    optimizer.beta2 = s[2];
+    optimizer.eps = s[3];
+    optimizer.step_count = static_cast<int>(s[4]);
+    return true;
+}
+
+/**
+ * Read the training progress of a checkpoint without touching any other state
+ * @return false if the file holds no training progress
+ */
+inline bool load_training_progress(const ModelFile& file, TrainingProgress& progress) {
+    const ModelTensorEntry* entry = file.find(kTrainingProgressTensor);
+    if (entry == nullptr) {
+        return false;
+    }
+    const auto p = file.data<uint64_t>(*entry);
+    // Checkpoints from before packed cursors had no in-document token offset
+    if (p.size() != 7 && p.size() != 8) {
+        throw std::runtime_error("Invalid training progress in model file");
+    }
+    progress.step = p[0];
+    progress.data = {p[1], p[2], p.size() > 7 ? p[7] : 0};
+    progress.stream = {p[3], p[4], p[5], p[6]};
+    return true;
+}
+
+/**
+ * Restore everything a training checkpoint holds besides the weights: Adam
+ * state, progress and the shared RNG (restore it after constructing the
+ * model, whose initialization draws from it)
+ * @return false if the file is not a training checkpoint
+ */
+inline bool load_training_state(const ModelFile& file, Adam& optimizer, TrainingProgress& progress) {
+    const ModelTensorEntry* rng = file.find(kRngStateTensor);
+    if (rng == nullptr || !load_training_progress(file, progress) || !load_optimizer_state(file, optimizer)) {
+        return false;
+    }
+    const auto bytes = file.data<uint8_t>(*rng);
+    std::istringstream in(std::string(bytes.begin(), bytes.end()));
+    in >> get_rng();
+    if (!in) {
+        throw std::runtime_error("Invalid RNG state in model file");
+    }
+    return true;
+}
+
+inline constexpr char kDeltaCheckpointMagic[8] = {'M', 'G', 'P', 'T', 'D', 'L', 'T', '\0'};
+inline constexpr uint32_t kDeltaCheckpointVersion = 1;
+inline constexpr uint32_t kDeltaBlockBytes = 4096;
+
+/**
+ * Delta file layout: this header, the base path, the indices of the changed
+ * blocks (uint64, 8-byte aligned), then the blocks (64-byte aligned, each
+ * block_bytes long; the file's last block is zero-padded)
+ */
+struct DeltaCheckpointHeader {
+    char magic[8];               // "MGPTDLT\0"
+    uint32_t version;
+    uint32_t endian;             // 0x01020304 as written by the producing host
+    uint32_t block_bytes;
+    uint32_t base_path_bytes;    // base path following the header
+    uint64_t base_hash;          // hash64 of the whole base file
+    uint64_t file_bytes;         // size of the reconstructed (and base) file
+    uint64_t n_blocks;           // changed blocks stored
+    uint64_t index_offset;
+    uint64_t data_offset;
+    uint8_t reserved[64];
+};
+static_assert(sizeof(DeltaCheckpointHeader) == 128, "DeltaCheckpointHeader must stay 128 bytes");
+
+/**
+ * Whether path starts with the delta checkpoint magic
+ */
+inline bool is_delta_checkpoint(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    char magic[sizeof(kDeltaCheckpointMagic)] = {};
+    in.read(magic, sizeof(magic));
+    return in.gcount() == sizeof(magic) && std::memcmp(magic, kDeltaCheckpointMagic, sizeof(magic)) == 0;
+}
+
+/**
+ * hash64 of every block_bytes block of a file image (the last one may be short)
+ */
+inline std::vector<uint64_t> block_hashes(std::span<const std::byte> image, size_t block_bytes) {
+    std::vector<uint64_t> hashes;
+    hashes.reserve((image.size() + block_bytes - 1) / block_bytes);
+    for (size_t pos = 0; pos < image.size(); pos += block_bytes) {
+        hashes.push_back(hash64(image.subspan(pos, std::min(block_bytes, image.size() - pos))));
+    }
+    return hashes;
+}
+
+/**
+ * Write the blocks of image whose hashes differ from base_blocks as a delta on base_path
+ * @return Size of the delta file
+ */
+inline uint64_t write_delta_checkpoint(const std::string& path, const std::string& base_path, uint64_t base_hash,
+                                       std::span<const uint64_t> base_blocks, std::span<const std::byte> image,
+                                       size_t block_bytes = kDeltaBlockBytes) {
+    const std::vector<uint64_t> hashes = block_hashes(image, block_bytes);
+    if (hashes.size() != base_blocks.size()) {
+        throw std::invalid_argument("Delta checkpoint needs a base of the same size");
+    }
+    std::vector<uint64_t> changed;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if (hashes[i] != base_blocks[i]) {
+            changed.push_back(i);
+        }
+    }
+
+    DeltaCheckpointHeader header{};
+    std::memcpy(header.magic, kDeltaCheckpointMagic, sizeof(header.magic));
+    header.version = kDeltaCheckpointVersion;
+    header.endian = kEndianMarker;
+    header.block_bytes = static_cast<uint32_t>(block_bytes);
+    header.base_path_bytes = static_cast<uint32_t>(base_path.size());
+    header.base_hash = base_hash;
+    header.file_bytes = image.size();
+    header.n_blocks = changed.size();
+    header.index_offset = (sizeof(header) + base_path.size() + 7) / 8 * 8;
+    header.data_offset = (header.index_offset + changed.size() * sizeof(uint64_t) + kModelFileAlignment - 1) /
+                         kModelFileAlignment * kModelFileAlignment;
+    const uint64_t total = header.data_offset + changed.size() * block_bytes;
+
+    detail::write_file_atomically(path, [&](detail::FileWriter& out) {
+        out.write(&header, sizeof(header));
+        out.write(base_path.data(), base_path.size());
+        out.pad_to(header.index_offset);
+        out.write(changed.data(), changed.size() * sizeof(uint64_t));
+        out.pad_to(header.data_offset);
+        for (uint64_t block : changed) {
+            const size_t start = block * block_bytes;
+            out.write(image.data() + start, std::min(block_bytes, image.size() - start));
+        }
+        out.pad_to(total);
+    });
+    return total;
+}
+
+/**
+ * Rebuild the full model file of a delta checkpoint into out_path (which may
+ * be delta_path itself). A relative base path is also looked up next to the delta.
+ * @throws std::runtime_error if the base is missing or is not the file the delta was taken against
+ */
+inline void reconstruct_checkpoint(const std::string& delta_path, const std::string& out_path) {
+    const MappedFile delta(delta_path);
+    DeltaCheckpointHeader header{};
+    if (delta.size() < sizeof(header)) {
+        throw std::runtime_error("Not a delta checkpoint (file too small): " + delta_path);
+    }
+    std::memcpy(&header, delta.data(), sizeof(header));
+    if (std::memcmp(header.magic, kDeltaCheckpointMagic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a delta checkpoint (bad magic): " + delta_path);
+    }
+    if (header.version != kDeltaCheckpointVersion || header.endian != kEndianMarker) {
+        throw std::runtime_error("Unsupported delta checkpoint: " + delta_path);
+    }
+    // Sizes are compared against the room left, so crafted values cannot wrap around
+    if (header.block_bytes == 0 || sizeof(header) + header.base_path_bytes > header.index_offset ||
+        header.index_offset % alignof(uint64_t) != 0 || header.index_offset > header.data_offset ||
+        header.n_blocks > (header.data_offset - header.index_offset) / sizeof(uint64_t) ||
+        header.data_offset > delta.size() || header.n_blocks > (delta.size() - header.data_offset) / header.block_bytes) {
+        throw std::runtime_error("Delta checkpoint is truncated or corrupt: " + delta_path);
+    }
+
+    std::string base_path(reinterpret_cast<const char*>(delta.data() + sizeof(header)), header.base_path_bytes);
+    const size_t slash = delta_path.find_last_of('/');
+    if (!base_path.empty() && base_path[0] != '/' && slash != std::string::npos && !std::ifstream(base_path)) {
+        base_path = delta_path.substr(0, slash + 1) + base_path.substr(base_path.find_last_of('/') + 1);
+    }
+    const MappedFile base(base_path);
+    if (base.size() != header.file_bytes || hash64(std::as_bytes(base.bytes())) != header.base_hash) {
+        throw std::runtime_error(base_path + " is not the base checkpoint of " + delta_path);
+    }
+
+    const auto* index = reinterpret_cast<const uint64_t*>(delta.data() + header.index_offset);
+    const size_t block_bytes = header.block_bytes;
+    detail::write_file_atomically(out_path, [&](detail::FileWriter& out) {
+        uint64_t pos = 0;
+        for (uint64_t i = 0; i < header.n_blocks; ++i) {
+            if (index[i] > header.file_bytes / block_bytes) {
+                throw std::runtime_error("Delta checkpoint block index out of range: " + delta_path);
+            }
+            const uint64_t start = index[i] * block_bytes;
+            if (start < pos || start >= header.file_bytes) {
+                throw std::runtime_error("Delta checkpoint block index out of order: " + delta_path);
+            }
+            out.write(base.data() + pos, start - pos);
+            const size_t n = std::min<uint64_t>(block_bytes, header.file_bytes - start);
+            out.write(delta.data() + header.data_offset + i * block_bytes, n);
+            pos = start + n;
+        }
+        out.write(base.data() + pos, header.file_bytes - pos);
+    });
+}
+
+/**
+ * Background checkpoint writer with a bounded number of snapshot buffers
+ */
+class AsyncCheckpointer {
+public:
+    /**
+     * @param max_in_flight Snapshots that may be queued or being written at once
+     * @param base_every > 0: delta mode, with a full base every base_every
+     *                   checkpoints; each checkpoint then needs its own path
+     */
+    explicit AsyncCheckpointer(int max_in_flight = 1, int base_every = 0) : base_every_(base_every) {
+        for (int i = 0; i < std::max(1, max_in_flight); ++i) {
+            free_.push_back(std::make_unique<Snapshot>());
+        }
+        worker_ = std::thread([this] { run(); });
+    }
+
+    /**
+     * Finishes every queued checkpoint before returning
+     */
+    ~AsyncCheckpointer() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    AsyncCheckpointer(const AsyncCheckpointer&) = delete;
+    AsyncCheckpointer& operator=(const AsyncCheckpointer&) = delete;
+
+    /**
+     * Snapshot the model (and optimizer) for writing to path, then return.
+     * Blocks only while every snapshot buffer is still queued or being written.
+     * With progress, the checkpoint also records it and the shared RNG.
+     * @throws the error of an earlier failed write
+     */
+    template <typename Tok>
+    void save(const std::string& path, const GPT& model, const Tok& tokenizer, const Adam* optimizer = nullptr,
+              const TrainingProgress* progress = nullptr) {
+        TraceScope span("checkpoint.snapshot", "checkpoint");
+        std::unique_ptr<Snapshot> snapshot;
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [&] { return !free_.empty() || error_; });
+            if (error_) {
+                std::rethrow_exception(std::exchange(error_, nullptr));
+            }
+            snapshot = std::move(free_.back());
+            free_.pop_back();
+        }
+
+        snapshot->path = path;
+        snapshot->info.vocab_size = model.config.vocab_size;
+        snapshot->info.n_embd = model.config.n_embd;
+        snapshot->info.n_head = model.config.n_head;
+        snapshot->info.n_layer = model.config.n_layer;
+        snapshot->info.block_size = model.config.block_size;
+        snapshot->info.tokenizer_kind =
+            std::is_same_v<Tok, BPETokenizer> ? TokenizerKind::BPE : TokenizerKind::Chars;
+        snapshot->info.bos = tokenizer.BOS;
+        snapshot->info.tokenizer = tokenizer_section(tokenizer);
+
+        // The copies below are the whole training-side cost of a checkpoint
+        if (snapshot->weights.entries().size() != model.state_dict.weights.size()) {
+            snapshot->weights.layout(model.state_dict);
+        }
+        snapshot->weights.copy_from(model.state_dict);
+        snapshot->has_optimizer = optimizer != nullptr;
+        if (optimizer != nullptr) {
+            snapshot->m.assign(optimizer->m.begin(), optimizer->m.end());
+            snapshot->v.assign(optimizer->v.begin(), optimizer->v.end());
+            snapshot->adam = {optimizer->learning_rate, optimizer->beta1, optimizer->beta2, optimizer->eps,
+                              static_cast<double>(optimizer->step_count)};
+        }
+        snapshot->has_progress = progress != nullptr;
+        if (progress != nullptr) {
+            snapshot->progress = progress->pack();
+            std::ostringstream rng;
+            rng << get_rng();
+            snapshot->rng = rng.str();
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            queue_.push_back(std::move(snapshot));
+        }
+        cv_.notify_all();
+    }
+
+    /**
+     * Block until every queued checkpoint is on disk
+     * @throws the error of a failed write
+     */
+    void wait() {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [&] { return (queue_.empty() && !busy_) || error_; });
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+    }
+
+    /**
+     * Checkpoints written so far
+     */
+    uint64_t completed() const {
+        std::lock_guard lock(mutex_);
+        return completed_;
+    }
+
+    /**
+     * Bytes written to disk by all completed checkpoints
+     */
+    uint64_t bytes_written() const {
+        std::lock_guard lock(mutex_);
+        return bytes_written_;
+    }
+
+    /**
+     * Wall time of the most recent write (off the training thread)
+     */
+    double last_write_ms() const {
+        std::lock_guard lock(mutex_);
+        return last_write_ms_;
+    }
+
+private:
+    struct Snapshot {
+        std::string path;
+        ModelFileInfo info;
+        FlatWeights weights;
+        bool has_optimizer = false;
+        std::vector<double> m;
+        std::vector<double> v;
+        std::vector<double> adam;
+        bool has_progress = false;
+        std::vector<uint64_t> progress;
+        std::string rng;
+    };
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<Snapshot>> free_;
+    std::deque<std::unique_ptr<Snapshot>> queue_;
+    bool busy_ = false;
+    bool stop_ = false;
+    uint64_t completed_ = 0;
+    uint64_t bytes_written_ = 0;
+    double last_write_ms_ = 0.0;
+    std::exception_ptr error_;
+
+    // Delta mode; only touched by the worker thread
+    const int base_every_;
+    int since_base_ = 0;
+    std::string base_path_;
+    uint64_t base_hash_ = 0;
+    std::vector<uint64_t> base_blocks_;
+    uint64_t base_bytes_ = 0;
+    std::vector<std::byte> image_;
+
+    std::thread worker_;
+
+    uint64_t write(const Snapshot& s) {
+        std::vector<ModelTensorSource> tensors;
+        const std::span<const double> data = s.weights.data();
+        for (const auto& [name, e] : s.weights.entries()) {
+            const auto values = data.subspan(e.offset, static_cast<size_t>(e.rows) * e.cols);
+            tensors.push_back(ModelTensorSource{name, DType::F64, {static_cast<uint64_t>(e.rows),
+                                                static_cast<uint64_t>(e.cols)}, std::as_bytes(values)});
+        }
+        if (s.has_optimizer) {
+            auto vector_tensor = [](const char* name, const std::vector<double>& values) {
+                return ModelTensorSource{name, DType::F64, {values.size()},
+                                         std::as_bytes(std::span<const double>(values))};
+            };
+            tensors.push_back(vector_tensor(kAdamMomentTensor, s.m));
+            tensors.push_back(vector_tensor(kAdamVarianceTensor, s.v));
+            tensors.push_back(vector_tensor(kAdamScalarsTensor, s.adam));
+        }
+        if (s.has_progress) {
+            tensors.push_back(ModelTensorSource{kTrainingProgressTensor, DType::U64, {s.progress.size()},
+                                                std::as_bytes(std::span<const uint64_t>(s.progress))});
+            tensors.push_back(ModelTensorSource{kRngStateTensor, DType::U8, {s.rng.size()},
+                                                std::as_bytes(std::span<const char>(s.rng))});
+        }
+        if (base_every_ <= 0) {
+            return write_model_file(s.path, s.info, tensors);
+        }
+
+        serialize_model_file(s.info, tensors, image_);
+        // A delta rebuilds a file of exactly the base's size, so any size change needs a new base
+        const bool new_base = since_base_ % base_every_ == 0 || s.path == base_path_ || image_.size() != base_bytes_;
+        ++since_base_;
+        if (!new_base) {
+            return write_delta_checkpoint(s.path, base_path_, base_hash_, base_blocks_, image_);
+        }
+        detail::write_file_atomically(s.path, [&](detail::FileWriter& out) {
+            out.write(image_.data(), image_.size());
+        });
+        since_base_ = 1;
+        base_path_ = s.path;
+        base_hash_ = hash64(image_);
+        base_blocks_ = block_hashes(image_, kDeltaBlockBytes);
+        base_bytes_ = image_.size();
+        return image_.size();
+    }
+
+    void run() {
+        trace_thread_name("checkpointer");
+        while (true) {
+            std::unique_ptr<Snapshot> snapshot;
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [&] { return !queue_.empty() || stop_; });
+                if (queue_.empty()) {
+                    return;  // stopping, and nothing left to write
+                }
+                snapshot = std::move(queue_.front());
+                queue_.pop_front();
+                busy_ = true;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            std::exception_ptr error;
+            uint64_t bytes = 0;
+            try {
+                TraceScope span("checkpoint.write", "checkpoint");
+                bytes = write(*snapshot);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            {
+                std::lock_guard lock(mutex_);
+                free_.push_back(std::move(snapshot));
+                busy_ = false;
+                if (error) {
+                    error_ = error;
+                } else {
+                    ++completed_;
+                    bytes_written_ += bytes;
+                    last_write_ms_ = ms;
+                }
+            }
+            cv_.notify_all();
+        }
+    }
+};
+
+}  // namespace microgpt
@@ -0,0 +1,117 @@
+#pragma once
+
+/**
+ * Parallel corpus loading into a single buffer.
+ *
+ * The file is memory-mapped and split into one chunk per thread at newline
+ * boundaries. Each thread scans its chunk with memchr (vectorized in the C
+ * library), trims the lines and writes string_views straight into a shared
+ * index, so loading scales with cores and allocates O(1) times regardless of
+ * the number of documents.
+ */
+
+#include "mapped_file.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Documents as views into one owning, read-only buffer. Moving a Corpus keeps
+ * the views valid; they die with the Corpus.
+ */
+struct Corpus {
+    MappedFile file;
+    std::vector<std::string_view> docs;
+
+    size_t size() const { return docs.size(); }
+    bool empty() const { return docs.empty(); }
+};
+
+namespace detail {
+
+inline std::string_view trim_line(const char* begin, const char* end) {
+    auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+    while (begin < end && is_space(*begin)) {
+        ++begin;
+    }
+    while (end > begin && is_space(end[-1])) {
+        --end;
+    }
+    return {begin, static_cast<size_t>(end - begin)};
+}
+
+// Visit the trimmed non-blank lines of [begin, end)
+template <typename Fn>
+inline void for_each_line(const char* begin, const char* end, Fn fn) {
+    while (begin < end) {
+        const char* nl = static_cast<const char*>(std::memchr(begin, '\n', static_cast<size_t>(end - begin)));
+        const char* line_end = nl != nullptr ? nl : end;
+        const std::string_view line = trim_line(begin, line_end);
+        if (!line.empty()) {
+            fn(line);
+        }
+        begin = line_end + 1;
+    }
+}
+
+}  // namespace detail
+
+/**
+ * Load a file with one document per line, trimmed, blank lines skipped (same
+ * documents as load_docs)
+ * @param filename File to read
+ * @param n_threads Worker threads (0 = hardware concurrency; small files use one)
+ * @return Empty corpus if the file cannot be opened
+ */
+inline Corpus load_corpus(const std::string& filename, int n_threads = 0) {
+    Corpus corpus;
+    try {
+        corpus.file = MappedFile(filename);
+    } catch (const std::runtime_error&) {
+        return corpus;
+    }
+    const char* data = reinterpret_cast<const char*>(corpus.file.data());
+    const size_t size = corpus.file.size();
+    if (size == 0) {
+        return corpus;
+    }
+    corpus.file.advise(MADV_SEQUENTIAL);
+
+    // One chunk per thread, its boundaries each moved forward to just past a newline
+    n_threads = detail::parallel_threads(SIZE_MAX, size, n_threads);
+    std::vector<const char*> bounds(n_threads + 1);
+    bounds[0] = data;
+    bounds[n_threads] = data + size;
+    for (int i = 1; i < n_threads; ++i) {
+        const char* guess = std::max(bounds[i - 1], data + size * i / n_threads);
+        const char* nl = static_cast<const char*>(std::memchr(guess, '\n', static_cast<size_t>(data + size - guess)));
+        bounds[i] = nl != nullptr ? nl + 1 : data + size;
+    }
+
+    auto run = [&](auto&& fn) { detail::parallel_for(static_cast<size_t>(n_threads), size, n_threads, fn); };
+
+    // Pass 1: count documents per chunk; pass 2: each chunk writes its own slice of the index
+    std::vector<size_t> counts(n_threads + 1, 0);
+    run([&](size_t i) {
+        size_t n = 0;
+        detail::for_each_line(bounds[i], bounds[i + 1], [&](std::string_view) { ++n; });
+        counts[i + 1] = n;
+    });
+    for (int i = 0; i < n_threads; ++i) {
+        counts[i + 1] += counts[i];
+    }
+    corpus.docs.resize(counts[n_threads]);
+    run([&](size_t i) {
+        std::string_view* out = corpus.docs.data() + counts[i];
+        detail::for_each_line(bounds[i], bounds[i + 1], [&](std::string_view line) { *out++ = line; });
+    });
+    return corpus;
+}
+
+}  // namespace microgpt
@@ -0,0 +1,381 @@
+#pragma once
+
+/**
+ * Background prefetching data loader.
+ *
+ * A producer thread shuffles the documents, tokenizes them and packs upcoming
+ * batches into a ring of preallocated buffers. The trainer takes filled batches
+ * through a lock-free single-producer/single-consumer handoff, so tokenization
+ * never runs on the training step's critical path.
+ */
+
+#include "token_dataset.h"
+#include "trace.h"
+#include "utils.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Position in the document stream: the epoch and the index of the next
+ * document within that epoch's permutation. Each epoch's permutation depends
+ * only on (seed, epoch), so a cursor fully determines what comes next.
+ *
+ * In packing mode a window can end inside a document. index is then that
+ * document and token counts the tokens of its encoding (BOS ... BOS) already
+ * emitted, so the rest of it is carried into the next window.
+ */
+struct DataCursor {
+    uint64_t epoch = 0;
+    uint64_t index = 0;
+    uint64_t token = 0;
+};
+
+/**
+ * Data loader configuration
+ */
+struct DataLoaderOptions {
+    int batch_size = 1;     // sequences per batch
+    int prefetch = 4;       // batches kept ready in the ring
+    bool shuffle = true;    // reshuffle the documents every epoch
+    uint64_t seed = 42;     // seed of the per-epoch permutation
+    int pack_block_size = 0;  // > 0: pack documents into full windows of this many positions
+};
+
+/**
+ * A batch of token sequences packed back to back into one buffer
+ */
+struct Batch {
+    std::vector<int> tokens;      // all sequences, concatenated
+    std::vector<size_t> offsets;  // sequence i is tokens[offsets[i], offsets[i + 1])
+    DataCursor cursor;            // stream position right after this batch
+
+    size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    std::span<const int> sequence(size_t i) const {
+        return std::span<const int>(tokens).subspan(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+};
+
+/**
+ * Every document tokenized once into one shared, read-only buffer
+ */
+struct TokenizedDocs {
+    std::vector<int> tokens;      // all sequences, concatenated
+    std::vector<size_t> offsets;  // sequence i is tokens[offsets[i], offsets[i + 1])
+
+    template <typename Docs, typename Tok>
+    static TokenizedDocs encode(const Docs& docs, const Tok& tokenizer) {
+        TokenizedDocs out;
+        size_t total = 0;
+        for (const auto& doc : docs) {
+            total += doc.size() + 2;
+        }
+        out.tokens.reserve(total);
+        out.offsets.reserve(docs.size() + 1);
+        out.offsets.push_back(0);
+        for (const auto& doc : docs) {
+            tokenizer.encode_into(doc, out.tokens);
+            out.offsets.push_back(out.tokens.size());
+        }
+        return out;
+    }
+
+    size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    std::span<const int> doc(size_t i) const {
+        return std::span<const int>(tokens).subspan(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+};
+
+/**
+ * Prefetching loader over an in-memory document list or a memory-mapped
+ * pre-tokenized dataset.
+ *
+ * The documents, tokenizer or dataset are referenced, not copied, and must
+ * outlive the loader. next() hands out the oldest ready batch and returns the previous
+ * one to the producer, so a batch stays valid until the following next() call.
+ *
+ * In packing mode the documents form one stream "BOS d1 BOS d2 BOS ..." that is
+ * cut into windows of pack_block_size + 1 tokens; consecutive windows share one
+ * token, so nothing is truncated or dropped. Train on them with
+ * GPT::train_step_packed, which resets attention at every BOS. A cursor also
+ * records how far into its document the stream stands, so resuming from it
+ * continues with exactly the tokens that would have come next.
+ */
+class DataLoader {
+public:
+    /**
+     * @param tokenizer Tokenizer or BPETokenizer (anything with encode_into(string_view, vector<int>&))
+     */
+    template <typename Tok>
+    DataLoader(const std::vector<std::string>& docs, const Tok& tokenizer,
+               DataLoaderOptions options = {}, DataCursor start = {})
+        : owned_docs_(docs.begin(), docs.end()), docs_(owned_docs_), encode_(encoder(tokenizer)),
+          num_docs_(docs.size()), options_(options), producer_cursor_(start), consumer_cursor_(start) {
+        start_producer(longest_text_doc());
+    }
+
+    /**
+     * Loader over documents viewed in place, e.g. a Corpus from load_corpus
+     */
+    template <typename Tok>
+    DataLoader(std::span<const std::string_view> docs, const Tok& tokenizer,
+               DataLoaderOptions options = {}, DataCursor start = {})
+        : docs_(docs), encode_(encoder(tokenizer)), num_docs_(docs.size()), options_(options),
+          producer_cursor_(start), consumer_cursor_(start) {
+        start_producer(longest_text_doc());
+    }
+
+    /**
+     * Loader over a pre-tokenized dataset: documents are copied straight out of
+     * the mapping, with no tokenization at all
+     */
+    DataLoader(const TokenDataset& dataset, DataLoaderOptions options = {}, DataCursor start = {})
+        : dataset_(&dataset), num_docs_(dataset.size()), options_(options),
+          producer_cursor_(start), consumer_cursor_(start) {
+        start_producer(dataset.longest_doc());
+    }
+
+    ~DataLoader() {
+        stop_.store(true, std::memory_order_relaxed);
+        tail_.fetch_add(1, std::memory_order_release);  // wakes a producer waiting for a free slot
+        tail_.notify_one();
+        producer_.join();
+    }
+
+    DataLoader(const DataLoader&) = delete;
+    DataLoader& operator=(const DataLoader&) = delete;
+
+    /**
+     * Next batch; blocks only if the producer has fallen behind
+     * @throws the producer's error, after the batches it filled before failing
+     */
+    const Batch& next() {
+        TraceScope span("data.wait", "data");
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (holding_) {
+            tail_.store(++tail, std::memory_order_release);
+            tail_.notify_one();
+        }
+        head_.wait(tail, std::memory_order_acquire);
+        holding_ = false;
+
+        // Batches filled before a producer failure are still handed out
+        if (tail == error_at_.load(std::memory_order_acquire)) {
+            std::rethrow_exception(error_);
+        }
+        holding_ = true;
+
+        const Batch& batch = slots_[tail % slots_.size()];
+        consumer_cursor_ = batch.cursor;
+        return batch;
+    }
+
+    /**
+     * Stream position after the most recently returned batch
+     */
+    DataCursor cursor() const {
+        return consumer_cursor_;
+    }
+
+private:
+    std::vector<std::string_view> owned_docs_;        // views of a std::string source
+    std::span<const std::string_view> docs_;          // text source, with encode_
+    std::function<void(std::string_view, std::vector<int>&)> encode_;
+    const TokenDataset* dataset_ = nullptr;           // or pre-tokenized source
+    size_t num_docs_ = 0;
+    DataLoaderOptions options_;
+
+    std::vector<Batch> slots_;
+    std::atomic<uint64_t> head_{0};  // batches produced
+    std::atomic<uint64_t> tail_{0};  // batches released by the consumer
+    std::atomic<bool> stop_{false};
+    std::exception_ptr error_;       // written before error_at_, read only once tail reaches it
+    std::atomic<uint64_t> error_at_{UINT64_MAX};  // head value of the failure sentinel
+    bool holding_ = false;
+
+    std::vector<uint32_t> order_;    // producer-only
+    std::vector<int> stream_;        // producer-only: packed tokens not yet emitted
+    DataCursor last_doc_;            // producer-only: cursor of the last encoded document
+    size_t last_doc_tokens_ = 0;     // and the length of its encoding
+    uint64_t order_epoch_ = UINT64_MAX;
+    DataCursor producer_cursor_;
+    DataCursor consumer_cursor_;
+    std::thread producer_;
+
+    template <typename Tok>
+    static std::function<void(std::string_view, std::vector<int>&)> encoder(const Tok& tokenizer) {
+        return [&tokenizer](std::string_view text, std::vector<int>& out) { tokenizer.encode_into(text, out); };
+    }
+
+    size_t longest_text_doc() const {
+        size_t longest = 0;
+        for (const auto& doc : docs_) {
+            longest = std::max(longest, doc.size() + 2);
+        }
+        return longest;
+    }
+
+    // longest: tokens in the longest document, including both BOS
+    void start_producer(size_t longest) {
+        if (num_docs_ == 0) {
+            throw std::invalid_argument("DataLoader needs at least one document");
+        }
+        if (options_.batch_size <= 0 || options_.prefetch <= 0) {
+            throw std::invalid_argument("DataLoader batch_size and prefetch must be positive");
+        }
+        if (producer_cursor_.index >= num_docs_) {
+            throw std::invalid_argument("DataLoader cursor index out of range");
+        }
+        if (producer_cursor_.token > 0 && options_.pack_block_size <= 0) {
+            throw std::invalid_argument("DataLoader cursor inside a document needs packing mode");
+        }
+
+        // Preallocate every slot for the worst case so the producer never allocates
+        const size_t sequence_capacity = options_.pack_block_size > 0
+            ? static_cast<size_t>(options_.pack_block_size) + 1 : longest;
+        slots_.resize(options_.prefetch);
+        for (auto& slot : slots_) {
+            slot.tokens.reserve(options_.batch_size * sequence_capacity);
+            slot.offsets.reserve(options_.batch_size + 1);
+        }
+        stream_.reserve(sequence_capacity + longest);
+        order_.resize(num_docs_);
+
+        producer_ = std::thread([this] { produce(); });
+    }
+
+    DataCursor advance(DataCursor c, size_t n) const {
+        c.index += n;
+        c.epoch += c.index / num_docs_;
+        c.index %= num_docs_;
+        return c;
+    }
+
+    // Permutation of the documents for one epoch, a pure function of (seed, epoch)
+    void prepare_epoch(uint64_t epoch) {
+        std::iota(order_.begin(), order_.end(), 0u);
+        if (options_.shuffle) {
+            std::mt19937_64 rng(options_.seed ^ (0x9E3779B97F4A7C15ULL * (epoch + 1)));
+            std::shuffle(order_.begin(), order_.end(), rng);
+        }
+        order_epoch_ = epoch;
+    }
+
+    // Tokenize (or copy) the next document of the stream, appending to out
+    void encode_next(std::vector<int>& out) {
+        if (producer_cursor_.epoch != order_epoch_) {
+            prepare_epoch(producer_cursor_.epoch);
+        }
+        const uint32_t doc = order_[producer_cursor_.index];
+        const size_t old_size = out.size();
+        if (dataset_ != nullptr) {
+            dataset_->append_doc(doc, out);
+        } else {
+            encode_(docs_[doc], out);
+        }
+        last_doc_ = producer_cursor_;
+        last_doc_tokens_ = out.size() - old_size;
+        producer_cursor_ = advance(producer_cursor_, 1);
+    }
+
+    // Append full windows of pack_block_size + 1 tokens cut from the document stream
+    void fill_packed_window(Batch& batch) {
+        const size_t window = static_cast<size_t>(options_.pack_block_size) + 1;
+        while (stream_.size() < window) {
+            const size_t old_size = stream_.size();
+            encode_next(stream_);
+            if (old_size > 0) {
+                // The stream already ends with the BOS that opens this document
+                stream_.erase(stream_.begin() + old_size);
+            }
+        }
+        batch.tokens.insert(batch.tokens.end(), stream_.begin(), stream_.begin() + window);
+        // Keep the last token: it is the next window's first input
+        stream_.erase(stream_.begin(), stream_.begin() + (window - 1));
+    }
+
+    // Refill stream_ with the unemitted tail of the document a packed cursor stands in
+    void restore_packed_stream() {
+        const uint64_t emitted = producer_cursor_.token;
+        producer_cursor_.token = 0;
+        encode_next(stream_);
+        if (emitted >= stream_.size()) {
+            throw std::runtime_error("DataLoader cursor points past the end of its document");
+        }
+        stream_.erase(stream_.begin(), stream_.begin() + static_cast<std::ptrdiff_t>(emitted));
+    }
+
+    // Packed windows end inside the last encoded document, whose tail stream_ holds
+    DataCursor packed_cursor() const {
+        return {last_doc_.epoch, last_doc_.index, last_doc_tokens_ - stream_.size()};
+    }
+
+    void fill(Batch& batch) {
+        batch.tokens.clear();
+        batch.offsets.clear();
+        batch.offsets.push_back(0);
+        for (int i = 0; i < options_.batch_size; ++i) {
+            if (options_.pack_block_size > 0) {
+                fill_packed_window(batch);
+            } else {
+                encode_next(batch.tokens);
+            }
+            batch.offsets.push_back(batch.tokens.size());
+        }
+        batch.cursor = options_.pack_block_size > 0 ? packed_cursor() : producer_cursor_;
+    }
+
+    void produce() {
+        trace_thread_name("data_loader");
+        try {
+            if (producer_cursor_.token > 0) {
+                restore_packed_stream();
+            }
+            uint64_t head = 0;
+            while (true) {
+                // Wait for a free slot
+                uint64_t tail = tail_.load(std::memory_order_acquire);
+                while (head - tail >= slots_.size() && !stop_.load(std::memory_order_relaxed)) {
+                    tail_.wait(tail, std::memory_order_acquire);
+                    tail = tail_.load(std::memory_order_acquire);
+                }
+                if (stop_.load(std::memory_order_relaxed)) {
+                    return;
+                }
+
+                {
+                    TraceScope span("data.fill", "data");
+                    fill(slots_[head % slots_.size()]);
+                }
+                head_.store(++head, std::memory_order_release);
+                head_.notify_one();
+            }
+        } catch (...) {
+            // The sentinel takes the next head value, after every batch already produced
+            error_ = std::current_exception();
+            error_at_.store(head_.load(std::memory_order_relaxed), std::memory_order_release);
+            head_.fetch_add(1, std::memory_order_release);
+            head_.notify_one();
+        }
+    }
+};
+
+}  // namespace microgpt
@@ -0,0 +1,226 @@
+#pragma once
+
+/**
+ * Asynchronous validation that does not stall training.
+ *
+ * The trainer copies the current weights into the back half of a double-buffered
+ * flat parameter buffer and returns immediately; a background thread swaps the
+ * buffers and evaluates the held-out set with the batched no-grad forward pass
+ * while training continues on the live weights.
+ */
+
+#include "data_loader.h"
+#include "nograd.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Validation metrics for one weight snapshot
+ */
+struct EvalResult {
+    int step = 0;           // training step the snapshot was taken at
+    double loss = 0.0;      // mean next-token cross-entropy
+    double perplexity = 0.0;
+    size_t tokens = 0;      // positions evaluated
+    double seconds = 0.0;   // evaluation wall time (off the training thread)
+
+    /**
+     * One JSON object, for Telemetry::record_json
+     */
+    std::string to_json() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(4)
+            << "{\"type\":\"eval\",\"step\":" << step
+            << ",\"val_loss\":" << loss
+            << ",\"val_perplexity\":" << perplexity
+            << ",\"tokens\":" << tokens
+            << ",\"eval_ms\":" << seconds * 1000.0 << "}";
+        return out.str();
+    }
+};
+
+/**
+ * Mean next-token loss of a model over a tokenized document set, in batches
+ * of model.max_batch() sequences
+ */
+inline EvalResult evaluate_docs(NoGradModel& model, const TokenizedDocs& docs) {
+    const auto start = std::chrono::steady_clock::now();
+    const size_t batch_size = model.max_batch();
+    std::vector<std::span<const int>> batch;
+    batch.reserve(batch_size);
+
+    double total = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < docs.size(); i += batch_size) {
+        batch.clear();
+        for (size_t j = i; j < std::min(docs.size(), i + batch_size); ++j) {
+            batch.push_back(docs.doc(j));
+        }
+        const auto [sum, n] = model.loss(batch);
+        total += sum;
+        count += n;
+    }
+
+    EvalResult result;
+    result.tokens = count;
+    result.loss = count > 0 ? total / count : 0.0;
+    result.perplexity = std::exp(result.loss);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+/**
+ * Background evaluator over a fixed validation set.
+ *
+ * submit() costs one pass copying the parameters. If an evaluation is still
+ * running, a newer submission replaces the one waiting, so the evaluator never
+ * builds a backlog. Results are collected with poll() from the training thread.
+ */
+class AsyncEvaluator {
+public:
+    /**
+     * @param model Model being trained; only its config and parameter shapes are used
+     * @param val_docs Held-out documents (strings or string_views), tokenized once here
+     * @param tokenizer Tokenizer (or BPETokenizer) used for training
+     * @param batch_size Sequences per batched forward pass
+     * @param matmul_tile Row blocking of the batched matrix products (see matmul_nt)
+     */
+    template <typename Docs, typename Tok>
+    AsyncEvaluator(const GPT& model, const Docs& val_docs, const Tok& tokenizer,
+                   int batch_size = 32, int matmul_tile = 1)
+        : config_(model.config), batch_size_(batch_size), val_(TokenizedDocs::encode(val_docs, tokenizer)) {
+        if (val_docs.empty()) {
+            throw std::invalid_argument("AsyncEvaluator needs a non-empty validation set");
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            buffers_[i].layout(model.state_dict);
+            models_[i] = std::make_unique<NoGradModel>(config_, buffers_[i], batch_size_);
+            models_[i]->set_matmul_tile(matmul_tile);
+        }
+
+        worker_ = std::thread([this] { run(); });
+    }
+
+    ~AsyncEvaluator() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    AsyncEvaluator(const AsyncEvaluator&) = delete;
+    AsyncEvaluator& operator=(const AsyncEvaluator&) = delete;
+
+    /**
+     * Snapshot the weights for evaluation at the given step and return at once
+     */
+    void submit(int step, const StateDict& state_dict) {
+        {
+            std::lock_guard lock(mutex_);
+            if (error_) {
+                std::rethrow_exception(error_);
+            }
+            buffers_[1 - front_].copy_from(state_dict);
+            pending_step_ = step;
+            pending_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    /**
+     * Results finished since the last call, oldest first
+     */
+    std::vector<EvalResult> poll() {
+        std::lock_guard lock(mutex_);
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        std::vector<EvalResult> done;
+        done.swap(results_);
+        return done;
+    }
+
+    /**
+     * Block until no evaluation is running or waiting, then return the results
+     */
+    std::vector<EvalResult> wait() {
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [&] { return (!pending_ && !busy_) || error_; });
+        }
+        return poll();
+    }
+
+private:
+    Config config_;
+    int batch_size_;
+    TokenizedDocs val_;
+
+    FlatWeights buffers_[2];
+    std::unique_ptr<NoGradModel> models_[2];  // one per buffer, each bound to its buffer
+    int front_ = 0;                           // buffer the worker reads
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool pending_ = false;
+    bool busy_ = false;
+    bool stop_ = false;
+    int pending_step_ = 0;
+    std::vector<EvalResult> results_;
+    std::exception_ptr error_;
+    std::thread worker_;
+
+    void run() {
+        trace_thread_name("evaluator");
+        while (true) {
+            int step = 0;
+            int buffer = 0;
+            {
+                std::unique_lock lock(mutex_);
+                cv_.wait(lock, [&] { return pending_ || stop_; });
+                if (stop_) {
+                    return;
+                }
+                // The freshest snapshot becomes the front buffer; the trainer writes the other one
+                front_ = 1 - front_;
+                buffer = front_;
+                step = pending_step_;
+                pending_ = false;
+                busy_ = true;
+            }
+
+            try {
+                TraceScope span("evaluate", "eval", "step", step);
+                EvalResult result = evaluate_docs(*models_[buffer], val_);
+                result.step = step;
+                std::lock_guard lock(mutex_);
+                results_.push_back(result);
+                busy_ = false;
+            } catch (...) {
+                std::lock_guard lock(mutex_);
+                error_ = std::current_exception();
+                busy_ = false;
+            }
+            cv_.notify_all();
+        }
+    }
+};
+
+}  // namespace microgpt
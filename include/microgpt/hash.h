@@ -0,0 +1,105 @@
+#pragma once
+
+/**
+ * Fast non-cryptographic 64-bit hashing of byte buffers.
+ *
+ * hash64 implements the XXH64 algorithm (same output as the reference xxHash
+ * library): four independent lanes consume 32-byte stripes, so large buffers
+ * hash at several bytes per cycle. It detects accidental corruption and
+ * changed data, not tampering.
+ */
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+namespace microgpt {
+
+namespace detail {
+
+inline constexpr uint64_t kXXPrime1 = 0x9E3779B185EBCA87ULL;
+inline constexpr uint64_t kXXPrime2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr uint64_t kXXPrime3 = 0x165667B19E3779F9ULL;
+inline constexpr uint64_t kXXPrime4 = 0x85EBCA77C2B2AE63ULL;
+inline constexpr uint64_t kXXPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t read_u64(const std::byte* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t read_u32(const std::byte* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t xx_round(uint64_t acc, uint64_t input) {
+    acc += input * kXXPrime2;
+    acc = std::rotl(acc, 31);
+    return acc * kXXPrime1;
+}
+
+inline uint64_t xx_merge(uint64_t acc, uint64_t lane) {
+    acc ^= xx_round(0, lane);
+    return acc * kXXPrime1 + kXXPrime4;
+}
+
+}  // namespace detail
+
+/**
+ * XXH64 of a byte buffer
+ */
+inline uint64_t hash64(std::span<const std::byte> data, uint64_t seed = 0) {
+    using namespace detail;
+    const std::byte* p = data.data();
+    const std::byte* const end = p + data.size();
+    uint64_t h;
+
+    if (data.size() >= 32) {
+        uint64_t v1 = seed + kXXPrime1 + kXXPrime2;
+        uint64_t v2 = seed + kXXPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kXXPrime1;
+        for (; end - p >= 32; p += 32) {
+            v1 = xx_round(v1, read_u64(p));
+            v2 = xx_round(v2, read_u64(p + 8));
+            v3 = xx_round(v3, read_u64(p + 16));
+            v4 = xx_round(v4, read_u64(p + 24));
+        }
+        h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        h = xx_merge(h, v1);
+        h = xx_merge(h, v2);
+        h = xx_merge(h, v3);
+        h = xx_merge(h, v4);
+    } else {
+        h = seed + kXXPrime5;
+    }
+    h += data.size();
+
+    for (; end - p >= 8; p += 8) {
+        h ^= xx_round(0, read_u64(p));
+        h = std::rotl(h, 27) * kXXPrime1 + kXXPrime4;
+    }
+    if (end - p >= 4) {
+        h ^= static_cast<uint64_t>(read_u32(p)) * kXXPrime1;
+        h = std::rotl(h, 23) * kXXPrime2 + kXXPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= static_cast<uint64_t>(std::to_integer<uint8_t>(*p)) * kXXPrime5;
+        h = std::rotl(h, 11) * kXXPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kXXPrime2;
+    h ^= h >> 29;
+    h *= kXXPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+}  // namespace microgpt
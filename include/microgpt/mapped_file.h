@@ -0,0 +1,103 @@
+#pragma once
+
+/**
+ * Read-only memory-mapped file (POSIX mmap).
+ *
+ * Mapping a file costs no reads up front; pages are faulted in on first touch
+ * and shared through the page cache between processes reading the same file.
+ */
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace microgpt {
+
+// Written into binary file headers; reads back differently on a host of other endianness
+inline constexpr uint32_t kEndianMarker = 0x01020304;
+
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    /**
+     * Map the whole file read-only
+     * @throws std::runtime_error if the file cannot be opened or mapped
+     */
+    explicit MappedFile(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("Could not open " + path + ": " + std::strerror(errno));
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            const int err = errno;
+            ::close(fd);
+            throw std::runtime_error("Could not stat " + path + ": " + std::strerror(err));
+        }
+        size_ = static_cast<size_t>(st.st_size);
+        if (size_ > 0) {
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) {
+                const int err = errno;
+                ::close(fd);
+                throw std::runtime_error("Could not mmap " + path + ": " + std::strerror(err));
+            }
+            data_ = static_cast<const uint8_t*>(data);
+        }
+        ::close(fd);  // the mapping keeps the file alive
+    }
+
+    ~MappedFile() {
+        if (data_ != nullptr) {
+            ::munmap(const_cast<uint8_t*>(data_), size_);
+        }
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            this->~MappedFile();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+    std::span<const uint8_t> bytes() const {
+        return {data_, size_};
+    }
+
+    /**
+     * Hint the kernel about the access pattern (MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED)
+     */
+    void advise(int advice) const {
+        if (data_ != nullptr) {
+            ::madvise(const_cast<uint8_t*>(data_), size_, advice);
+        }
+    }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+}  // namespace microgpt
@@ -10,7 +10,22 @@
  */
 
 #include "value.h"
+#include "trace.h"
 #include "layers.h"
 #include "utils.h"
+#include "bpe.h"
 #include "optimizer.h"
+#include "model_file.h"
 #include "model.h"
+#include "pipeline.h"
+#include "mapped_file.h"
+#include "token_dataset.h"
+#include "data_loader.h"
+#include "async_reader.h"
+#include "stream_dataset.h"
+#include "telemetry.h"
+#include "nograd.h"
+#include "evaluator.h"
+#include "checkpoint.h"
+#include "sweep.h"
+#include "autotune.h"
@@ -5,11 +5,17 @@
  * Original Python implementation: https://gist.github.com/karpathy/8627fe009c40f57531cb18360106ce95
  */
 
+#include "bpe.h"
+#include "model_file.h"
+#include "parallel.h"
 #include "utils.h"
 #include "value.h"
 #include "optimizer.h"
+#include "telemetry.h"
+#include <algorithm>
 #include <map>
 #include <random>
+#include <span>
 #include <string>
 #include <vector>
 #include <fstream>
@@ -114,36 +120,19 @@ public:
     }
 
     /**
-     * Save model weights and config to binary file
+     * Save model weights, config and tokenizer in the versioned model format
+     * (model_file.h)
+     * @param dtype Stored precision of the weights: F64 (exact), F16, BF16 or I8
      */
-    void save_weights(const std::string& filename, const Tokenizer& tokenizer) const {
-        std::ofstream outfile(filename, std::ios::binary);
-        if (!outfile.is_open()) {
-            throw std::runtime_error("Could not open file for writing: " + filename);
-        }
-
-        // Write config
-        outfile.write(reinterpret_cast<const char*>(&config.vocab_size), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.n_embd), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.n_head), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.n_layer), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(&config.block_size), sizeof(int));
-
-        // Write tokenizer
-        int uchars_size = static_cast<int>(tokenizer.uchars.size());
-        outfile.write(reinterpret_cast<const char*>(&uchars_size), sizeof(int));
-        outfile.write(reinterpret_cast<const char*>(tokenizer.uchars.data()), uchars_size);
-        outfile.write(reinterpret_cast<const char*>(&tokenizer.BOS), sizeof(int));
-
-        // Write parameters
-        auto params = state_dict.get_all_params();
-        for (const auto* p : params) {
-            outfile.write(reinterpret_cast<const char*>(&p->data), sizeof(double));
-        }
+    void save_weights(const std::string& filename, const Tokenizer& tokenizer, DType dtype = DType::F64) const {
+        save_model_file(filename, TokenizerKind::Chars, tokenizer.BOS, tokenizer_section(tokenizer), dtype);
+    }
 
-        if (!outfile) {
-            throw std::runtime_error("Error writing to file: " + filename);
-        }
+    /**
+     * Same, with a byte-level BPE tokenizer
+     */
+    void save_weights(const std::string& filename, const BPETokenizer& tokenizer, DType dtype = DType::F64) const {
+        save_model_file(filename, TokenizerKind::BPE, tokenizer.BOS, tokenizer_section(tokenizer), dtype);
     }
 
     /**
@@ -151,31 +140,20 @@ public:
      * Returns the loaded model and tokenizer
      */
     static std::pair<GPT, Tokenizer> load_weights(const std::string& filename) {
+        if (is_model_file(filename)) {
+            const ModelFile file(filename);
+            if (file.tokenizer_kind() == TokenizerKind::BPE) {
+                throw std::runtime_error("Model uses a BPE tokenizer; load it with load_weights_bpe");
+            }
+            return {from_model_file(file), file.tokenizer()};
+        }
+
+        // Legacy layout: five ints, tokenizer characters, BOS, then doubles in key order
         std::ifstream infile(filename, std::ios::binary);
         if (!infile.is_open()) {
             throw std::runtime_error("Could not open file for reading: " + filename);
         }
-
-        // Read config
-        Config config{};
-        infile.read(reinterpret_cast<char*>(&config.vocab_size), sizeof(int));
-        infile.read(reinterpret_cast<char*>(&config.n_embd), sizeof(int));
-        infile.read(reinterpret_cast<char*>(&config.n_head), sizeof(int));
-        infile.read(reinterpret_cast<char*>(&config.n_layer), sizeof(int));
-        infile.read(reinterpret_cast<char*>(&config.block_size), sizeof(int));
-        
-        if (!infile) {
-            throw std::runtime_error("Failed to read config from file");
-        }
-
-        // Validate config
-        if (config.vocab_size <= 0 || config.n_embd <= 0 || config.n_head <= 0 ||
-            config.n_layer <= 0 || config.block_size <= 0) {
-            throw std::runtime_error("Invalid config in file");
-        }
-        if (config.n_embd % config.n_head != 0) {
-            throw std::runtime_error("n_embd must be divisible by n_head");
-        }
+        const Config config = read_config(infile);
 
         // Read tokenizer
         Tokenizer tokenizer;
@@ -184,6 +162,9 @@ public:
         if (!infile) {
             throw std::runtime_error("Failed to read tokenizer size from file");
         }
+        if (uchars_size == kBPETokenizerMarker) {
+            throw std::runtime_error("Model uses a BPE tokenizer; load it with load_weights_bpe");
+        }
         if (uchars_size <= 0 || uchars_size > 10000) {
             throw std::runtime_error("Invalid tokenizer size in file");
         }
@@ -205,47 +186,164 @@ public:
         if (config.vocab_size != uchars_size + 1) {
             throw std::runtime_error("Incompatible vocab_size between config and tokenizer");
         }
+        tokenizer.build_tables();
 
-        // Initialize model
-        GPT model(config);
-        auto params = model.state_dict.get_all_params();
+        return {read_params(infile, config), tokenizer};
+    }
 
-        // Load parameters
-        for (auto* p : params) {
-            infile.read(reinterpret_cast<char*>(&p->data), sizeof(double));
-            if (!std::isfinite(p->data)) {
-                throw std::runtime_error("Loaded parameter with NaN or infinity");
-            }
+    /**
+     * Load a model saved with a BPE tokenizer
+     */
+    static std::pair<GPT, BPETokenizer> load_weights_bpe(const std::string& filename) {
+        if (is_model_file(filename)) {
+            const ModelFile file(filename);
+            return {from_model_file(file), file.bpe_tokenizer()};
         }
 
-        if (!infile) {
-            throw std::runtime_error("Failed to read all parameters from file");
+        // Legacy layout with kBPETokenizerMarker in the tokenizer slot
+        std::ifstream infile(filename, std::ios::binary);
+        if (!infile.is_open()) {
+            throw std::runtime_error("Could not open file for reading: " + filename);
         }
+        const Config config = read_config(infile);
 
-        return {model, tokenizer};
+        int marker = 0;
+        infile.read(reinterpret_cast<char*>(&marker), sizeof(int));
+        if (!infile || marker != kBPETokenizerMarker) {
+            throw std::runtime_error("Model does not use a BPE tokenizer; load it with load_weights");
+        }
+        BPETokenizer tokenizer;
+        tokenizer.load(infile);
+        int bos = 0;
+        infile.read(reinterpret_cast<char*>(&bos), sizeof(int));
+        if (!infile || bos != tokenizer.BOS || config.vocab_size != tokenizer.vocab_size) {
+            throw std::runtime_error("Incompatible vocab_size between config and BPE tokenizer");
+        }
+
+        return {read_params(infile, config), tokenizer};
+    }
+
+    /**
+     * Whether a weights file was saved with a BPE tokenizer
+     */
+    static bool uses_bpe_tokenizer(const std::string& filename) {
+        if (is_model_file(filename)) {
+            return ModelFile(filename).tokenizer_kind() == TokenizerKind::BPE;
+        }
+        std::ifstream infile(filename, std::ios::binary);
+        int header[6] = {};
+        infile.read(reinterpret_cast<char*>(header), sizeof(header));
+        return infile && header[5] == kBPETokenizerMarker;
+    }
+
+    /**
+     * Model with the config and tensors of a model file (copied out of the
+     * mapping); training-state tensors are ignored
+     */
+    static GPT from_model_file(const ModelFile& file) {
+        const ModelFileHeader& h = file.header();
+        const Config config{h.vocab_size, h.n_embd, h.n_head, h.n_layer, h.block_size};
+        validate_config(config);
+        GPT model(config);
+        const auto n_weights = std::count_if(file.tensors().begin(), file.tensors().end(),
+                                             [](const auto& e) { return !is_state_tensor(e.tensor_name()); });
+        if (static_cast<size_t>(n_weights) != model.state_dict.weights.size()) {
+            throw std::runtime_error("Model file tensors do not match the config");
+        }
+        // Checksum and decode tensors in parallel; each task fills its own matrix
+        std::vector<std::pair<const ModelTensorEntry*, std::vector<std::vector<Value>>*>> tasks;
+        for (auto& [name, matrix] : model.state_dict.weights) {
+            const ModelTensorEntry* entry = file.find(name);
+            if (entry == nullptr) {
+                throw std::runtime_error("Model file has no tensor " + name);
+            }
+            const uint64_t rows = matrix.size();
+            const uint64_t cols = rows > 0 ? matrix[0].size() : 0;
+            if (entry->rank != 2 || entry->shape[0] != rows || entry->shape[1] != cols) {
+                throw std::runtime_error("Tensor " + name + " has the wrong shape for the config");
+            }
+            tasks.emplace_back(entry, &matrix);
+        }
+        detail::parallel_for(tasks.size(), file.file().size(), 0, [&](size_t t) {
+            const auto [entry, matrix] = tasks[t];
+            std::vector<double> values(entry->elements());
+            file.read_f64(*entry, values);
+            size_t i = 0;
+            for (auto& row : *matrix) {
+                for (auto& val : row) {
+                    val.data = values[i++];
+                    if (!std::isfinite(val.data)) {
+                        throw std::runtime_error("Loaded parameter with NaN or infinity");
+                    }
+                }
+            }
+        });
+        return model;
     }
 
     /**
      * Single training step on a sequence
      * Returns the loss value
+     * If telemetry is given, its tokens, forward/backward/optimizer times,
+     * graph node count and storage footprint are filled in
+     */
+    double train_step(std::span<const int> tokens, Adam& optimizer, ValueStorage& storage, int total_steps,
+                      StepTelemetry* telemetry = nullptr) {
+        TraceScope span("train_step", "train");
+        PhaseTimer timer;
+        Value* loss = sequence_loss(tokens, -1, storage);
+        return optimize(loss, tokens, optimizer, storage, total_steps, timer, telemetry);
+    }
+
+    /**
+     * Single training step on a packed window of several BOS-delimited documents
+     * (see DataLoaderOptions::pack_block_size). At every BOS after the first position the KV cache is
+     * cleared and positions restart at 0, so documents never attend to each other.
+     * Returns the loss value
      */
-    double train_step(const std::vector<int>& tokens, Adam& optimizer, ValueStorage& storage, int total_steps) {
+    double train_step_packed(std::span<const int> window, int bos, Adam& optimizer, ValueStorage& storage,
+                             int total_steps, StepTelemetry* telemetry = nullptr) {
+        TraceScope span("train_step", "train");
+        PhaseTimer timer;
+        Value* loss = sequence_loss(window, bos, storage);
+        return optimize(loss, window, optimizer, storage, total_steps, timer, telemetry);
+    }
+
+    /**
+     * Mean next-token cross-entropy over a sequence, as a graph node
+     * @param tokens Input tokens followed by the final target
+     * @param bos Document separator that resets attention and positions, or -1 for none
+     * @param storage Value storage for intermediate computations
+     * @return loss node, or nullptr if the sequence has no targets
+     */
+    Value* sequence_loss(std::span<const int> tokens, int bos, ValueStorage& storage) {
         const int n = std::min(config.block_size, static_cast<int>(tokens.size()) - 1);
         if (n <= 0) {
-            return 0.0;  // Skip empty sequences
+            return nullptr;  // Skip empty sequences
         }
 
-        // Forward pass
+        // Forward pass; what forward() builds is attributed to its own regions
+        ProfileRegion region(storage, Region::loss);
         std::vector<std::vector<std::vector<Value*>>> keys(config.n_layer);
         std::vector<std::vector<std::vector<Value*>>> values(config.n_layer);
         std::vector<Value*> losses;
         losses.reserve(n);
 
-        for (int pos_id = 0; pos_id < n; ++pos_id) {
-            const int token_id = tokens[pos_id];
-            const int target_id = tokens[pos_id + 1];
+        int pos_id = 0;
+        for (int t = 0; t < n; ++t) {
+            const int token_id = tokens[t];
+            const int target_id = tokens[t + 1];
 
-            auto logits = forward(token_id, pos_id, keys, values, storage);
+            // Document boundary inside a packed window
+            if (t > 0 && token_id == bos) {
+                for (int li = 0; li < config.n_layer; ++li) {
+                    keys[li].clear();
+                    values[li].clear();
+                }
+                pos_id = 0;
+            }
+
+            auto logits = forward(token_id, pos_id++, keys, values, storage);
             auto probs = softmax(logits, storage);
 
             Value* log_prob = storage.log(probs[target_id]);
@@ -259,16 +357,7 @@ public:
             loss = storage.add(loss, l);
         }
         Value* n_val = storage.constant(static_cast<double>(n));
-        loss = storage.div(loss, n_val);
-
-        // Backward pass
-        loss->backward();
-
-        // Optimizer step
-        auto params = state_dict.get_all_params();
-        optimizer.step(params, total_steps);
-
-        return loss->data;
+        return storage.div(loss, n_val);
     }
 
     /**
@@ -285,6 +374,25 @@ public:
                                  std::vector<std::vector<std::vector<Value*>>>& keys,
                                  std::vector<std::vector<std::vector<Value*>>>& values,
                                  ValueStorage& storage) {
+        // Check storage isn't growing too large (potential memory leak)
+        storage.check_size_limit();
+
+        TraceScope span("forward", "gpt", "pos", pos_id);
+        auto x = embed(token_id, pos_id, storage);
+        for (int li = 0; li < config.n_layer; ++li) {
+            x = layer_forward(li, x, keys[li], values[li], storage);
+        }
+        return project_logits(x, storage);
+    }
+
+    /**
+     * Token + position embedding followed by the initial RMSNorm
+     * @param token_id Current token ID
+     * @param pos_id Position ID
+     * @param storage Value storage for intermediate computations
+     * @return hidden state of size n_embd
+     */
+    std::vector<Value*> embed(int token_id, int pos_id, ValueStorage& storage) {
         // Bounds checking
         if (token_id < 0 || token_id >= config.vocab_size) {
             throw std::out_of_range("token_id out of range");
@@ -292,156 +400,176 @@ public:
         if (pos_id < 0 || pos_id >= config.block_size) {
             throw std::out_of_range("pos_id out of range");
         }
-        
-        // Check storage isn't growing too large (potential memory leak)
-        storage.check_size_limit(100000);
-        
-        const int head_dim = config.n_embd / config.n_head;
-        
-        // Validate head_dim
-        if (head_dim <= 0 || config.n_embd % config.n_head != 0) {
-            throw std::invalid_argument("n_embd must be divisible by n_head");
-        }
 
-        // Token and position embeddings
-        auto& tok_emb = state_dict.weights["wte"][token_id];
-        auto& pos_emb = state_dict.weights["wpe"][pos_id];
+        // Token and position embeddings (.at() keeps concurrent readers race-free)
+        auto& tok_emb = state_dict.weights.at("wte")[token_id];
+        auto& pos_emb = state_dict.weights.at("wpe")[pos_id];
 
         // Joint embedding - use factory methods
+        ProfileRegion region(storage, Region::embedding);
         std::vector<Value*> x;
         x.reserve(config.n_embd);
         for (int i = 0; i < config.n_embd; ++i) {
             x.push_back(storage.add(&tok_emb[i], &pos_emb[i]));
         }
-        x = rmsnorm(x, storage);
+        return rmsnorm(x, storage);
+    }
 
-        // Transformer layers
-        for (int li = 0; li < config.n_layer; ++li) {
-            const std::string prefix = "layer" + std::to_string(li) + ".";
-
-            // 1) Multi-head attention
-            auto x_residual = x;  // Copy pointers, not values
-            x = rmsnorm(x, storage);
-
-            auto q = linear(x, state_dict.weights[prefix + "attn_wq"], storage);
-            auto k = linear(x, state_dict.weights[prefix + "attn_wk"], storage);
-            auto v = linear(x, state_dict.weights[prefix + "attn_wv"], storage);
-
-            keys[li].push_back(k);
-            values[li].push_back(v);
-
-            std::vector<Value*> x_attn;
-            x_attn.reserve(config.n_embd);
-            
-            for (int h = 0; h < config.n_head; ++h) {
-                const int hs = h * head_dim;
-                
-                // Bounds check for head slicing
-                if (hs + head_dim > static_cast<int>(q.size())) {
-                    throw std::out_of_range("Head slicing out of bounds");
-                }
+    /**
+     * One transformer block (attention + MLP) for a single position
+     * @param li Layer index
+     * @param x_in Hidden state entering the block
+     * @param keys KV cache for keys of this layer (one entry per past position)
+     * @param values KV cache for values of this layer
+     * @param storage Value storage for intermediate computations
+     * @return hidden state leaving the block
+     */
+    std::vector<Value*> layer_forward(int li, const std::vector<Value*>& x_in,
+                                      std::vector<std::vector<Value*>>& keys,
+                                      std::vector<std::vector<Value*>>& values,
+                                      ValueStorage& storage) {
+        const int head_dim = config.n_embd / config.n_head;
 
-                // Extract head-specific q, k, v (copy pointers only)
-                std::vector<Value*> q_h(q.begin() + hs, q.begin() + hs + head_dim);
-
-                std::vector<std::vector<Value*>> k_h;
-                std::vector<std::vector<Value*>> v_h;
-                k_h.reserve(keys[li].size());
-                v_h.reserve(values[li].size());
-                
-                for (const auto& ki : keys[li]) {
-                    if (hs + head_dim > static_cast<int>(ki.size())) {
-                        throw std::out_of_range("Key head slicing out of bounds");
-                    }
-                    k_h.emplace_back(ki.begin() + hs, ki.begin() + hs + head_dim);
-                }
-                for (const auto& vi : values[li]) {
-                    if (hs + head_dim > static_cast<int>(vi.size())) {
-                        throw std::out_of_range("Value head slicing out of bounds");
-                    }
-                    v_h.emplace_back(vi.begin() + hs, vi.begin() + hs + head_dim);
-                }
+        // Validate head_dim
+        if (head_dim <= 0 || config.n_embd % config.n_head != 0) {
+            throw std::invalid_argument("n_embd must be divisible by n_head");
+        }
 
-                // Compute attention scores
-                std::vector<Value*> attn_logits;
-                attn_logits.reserve(k_h.size());
-                const double scale = std::sqrt(static_cast<double>(head_dim));
-                
-                // Check scale is valid
-                if (!std::isfinite(scale) || scale <= 0.0) {
-                    throw std::runtime_error("Invalid attention scale");
-                }
-                
-                for (size_t t = 0; t < k_h.size(); ++t) {
-                    Value* score = storage.constant(0.0);
-                    for (int j = 0; j < head_dim; ++j) {
-                        assert(q_h[j] != nullptr && "Null pointer in q_h");
-                        assert(k_h[t][j] != nullptr && "Null pointer in k_h");
-                        Value* prod = storage.mul(q_h[j], k_h[t][j]);
-                        score = storage.add(score, prod);
-                    }
-                    
-                    // Use factory method for division
-                    Value* scale_val = storage.constant(scale);
-                    attn_logits.push_back(storage.div(score, scale_val));
-                }
+        const std::string prefix = "layer" + std::to_string(li) + ".";
 
-                // Softmax attention weights
-                auto attn_weights = softmax(attn_logits, storage);
+        // 1) Multi-head attention
+        TraceScope span("attention", "gpt", "layer", li);
+        ProfileRegion region(storage, Region::attention);
+        auto x_residual = x_in;  // Copy pointers, not values
+        auto x = rmsnorm(x_in, storage);
 
-                // Weighted sum of values
-                for (int j = 0; j < head_dim; ++j) {
-                    Value* head_out = storage.constant(0.0);
-                    for (size_t t = 0; t < v_h.size(); ++t) {
-                        assert(attn_weights[t] != nullptr && "Null pointer in attn_weights");
-                        assert(v_h[t][j] != nullptr && "Null pointer in v_h");
-                        Value* prod = storage.mul(attn_weights[t], v_h[t][j]);
-                        head_out = storage.add(head_out, prod);
-                    }
-                    x_attn.push_back(head_out);
-                }
+        auto q = linear(x, state_dict.weights.at(prefix + "attn_wq"), storage);
+        auto k = linear(x, state_dict.weights.at(prefix + "attn_wk"), storage);
+        auto v = linear(x, state_dict.weights.at(prefix + "attn_wv"), storage);
+
+        keys.push_back(k);
+        values.push_back(v);
+
+        std::vector<Value*> x_attn;
+        x_attn.reserve(config.n_embd);
+
+        for (int h = 0; h < config.n_head; ++h) {
+            const int hs = h * head_dim;
+
+            // Bounds check for head slicing
+            if (hs + head_dim > static_cast<int>(q.size())) {
+                throw std::out_of_range("Head slicing out of bounds");
             }
 
-            x = linear(x_attn, state_dict.weights[prefix + "attn_wo"], storage);
-            
-            // Validate dimensions match for residual
-            if (x.size() != x_residual.size()) {
-                throw std::runtime_error("Dimension mismatch in attention residual connection");
+            // Extract head-specific q, k, v (copy pointers only)
+            std::vector<Value*> q_h(q.begin() + hs, q.begin() + hs + head_dim);
+
+            std::vector<std::vector<Value*>> k_h;
+            std::vector<std::vector<Value*>> v_h;
+            k_h.reserve(keys.size());
+            v_h.reserve(values.size());
+
+            for (const auto& ki : keys) {
+                if (hs + head_dim > static_cast<int>(ki.size())) {
+                    throw std::out_of_range("Key head slicing out of bounds");
+                }
+                k_h.emplace_back(ki.begin() + hs, ki.begin() + hs + head_dim);
             }
-            
-            for (size_t i = 0; i < x.size(); ++i) {
-                x[i] = storage.add(x[i], x_residual[i]);
+            for (const auto& vi : values) {
+                if (hs + head_dim > static_cast<int>(vi.size())) {
+                    throw std::out_of_range("Value head slicing out of bounds");
+                }
+                v_h.emplace_back(vi.begin() + hs, vi.begin() + hs + head_dim);
             }
 
-            // 2) MLP block
-            x_residual = x;
-            x = rmsnorm(x, storage);
-            x = linear(x, state_dict.weights[prefix + "mlp_fc1"], storage);
-            for (auto*& xi : x) {
-                assert(xi != nullptr && "Null pointer in MLP activation");
-                Value* relu_val = storage.relu(xi);
-                xi = storage.pow(relu_val, 2.0);  // ReLU^2 activation
+            // Compute attention scores
+            std::vector<Value*> attn_logits;
+            attn_logits.reserve(k_h.size());
+            const double scale = std::sqrt(static_cast<double>(head_dim));
+
+            // Check scale is valid
+            if (!std::isfinite(scale) || scale <= 0.0) {
+                throw std::runtime_error("Invalid attention scale");
             }
-            x = linear(x, state_dict.weights[prefix + "mlp_fc2"], storage);
-            
-            // Validate dimensions match for residual
-            if (x.size() != x_residual.size()) {
-                throw std::runtime_error("Dimension mismatch in MLP residual connection");
+
+            for (size_t t = 0; t < k_h.size(); ++t) {
+                Value* score = storage.constant(0.0);
+                for (int j = 0; j < head_dim; ++j) {
+                    assert(q_h[j] != nullptr && "Null pointer in q_h");
+                    assert(k_h[t][j] != nullptr && "Null pointer in k_h");
+                    Value* prod = storage.mul(q_h[j], k_h[t][j]);
+                    score = storage.add(score, prod);
+                }
+
+                // Use factory method for division
+                Value* scale_val = storage.constant(scale);
+                attn_logits.push_back(storage.div(score, scale_val));
             }
-            
-            for (size_t i = 0; i < x.size(); ++i) {
-                x[i] = storage.add(x[i], x_residual[i]);
+
+            // Softmax attention weights
+            auto attn_weights = softmax(attn_logits, storage);
+
+            // Weighted sum of values
+            for (int j = 0; j < head_dim; ++j) {
+                Value* head_out = storage.constant(0.0);
+                for (size_t t = 0; t < v_h.size(); ++t) {
+                    assert(attn_weights[t] != nullptr && "Null pointer in attn_weights");
+                    assert(v_h[t][j] != nullptr && "Null pointer in v_h");
+                    Value* prod = storage.mul(attn_weights[t], v_h[t][j]);
+                    head_out = storage.add(head_out, prod);
+                }
+                x_attn.push_back(head_out);
             }
         }
 
-        // Final projection to logits
-        auto logits = linear(x, state_dict.weights["lm_head"], storage);
-        
+        x = linear(x_attn, state_dict.weights.at(prefix + "attn_wo"), storage);
+
+        // Validate dimensions match for residual
+        if (x.size() != x_residual.size()) {
+            throw std::runtime_error("Dimension mismatch in attention residual connection");
+        }
+
+        for (size_t i = 0; i < x.size(); ++i) {
+            x[i] = storage.add(x[i], x_residual[i]);
+        }
+
+        // 2) MLP block
+        span.next("mlp");
+        storage.set_region(Region::mlp);
+        x_residual = x;
+        x = rmsnorm(x, storage);
+        x = linear(x, state_dict.weights.at(prefix + "mlp_fc1"), storage);
+        for (auto*& xi : x) {
+            assert(xi != nullptr && "Null pointer in MLP activation");
+            Value* relu_val = storage.relu(xi);
+            xi = storage.pow(relu_val, 2.0);  // ReLU^2 activation
+        }
+        x = linear(x, state_dict.weights.at(prefix + "mlp_fc2"), storage);
+
+        // Validate dimensions match for residual
+        if (x.size() != x_residual.size()) {
+            throw std::runtime_error("Dimension mismatch in MLP residual connection");
+        }
+
+        for (size_t i = 0; i < x.size(); ++i) {
+            x[i] = storage.add(x[i], x_residual[i]);
+        }
+        return x;
+    }
+
+    /**
+     * Final projection from hidden state to vocabulary logits
+     */
+    std::vector<Value*> project_logits(const std::vector<Value*>& x, ValueStorage& storage) {
+        TraceScope span("lm_head", "gpt");
+        ProfileRegion region(storage, Region::lm_head);
+        auto logits = linear(x, state_dict.weights.at("lm_head"), storage);
+
         // Validate output dimensions
         if (static_cast<int>(logits.size()) != config.vocab_size) {
             throw std::runtime_error("Output logits size doesn't match vocab_size");
         }
-        
+
         return logits;
     }
 
@@ -453,6 +581,7 @@ public:
      * @return Generated token IDs
      */
     std::vector<int> generate(int start_token, int max_length, double temperature = 1.0) {
+        TraceScope span("generate", "gpt");
         ValueStorage storage;  // Local storage for generation
         std::vector<std::vector<std::vector<Value*>>> keys(config.n_layer);
         std::vector<std::vector<std::vector<Value*>>> values(config.n_layer);
@@ -489,6 +618,116 @@ public:
 
         return tokens;
     }
+
+private:
+    static constexpr int kBPETokenizerMarker = -1;  // tokenizer slot value of legacy BPE model files
+
+    void save_model_file(const std::string& filename, TokenizerKind kind, int bos, std::string tokenizer,
+                         DType dtype) const {
+        ModelFileInfo info;
+        info.vocab_size = config.vocab_size;
+        info.n_embd = config.n_embd;
+        info.n_head = config.n_head;
+        info.n_layer = config.n_layer;
+        info.block_size = config.block_size;
+        info.tokenizer_kind = kind;
+        info.bos = bos;
+        info.tokenizer = std::move(tokenizer);
+
+        // One row-major tensor per state dict entry, encoded as dtype
+        std::vector<std::vector<std::byte>> buffers;
+        std::vector<ModelTensorSource> tensors;
+        buffers.reserve(state_dict.weights.size());
+        std::vector<double> values;
+        for (const auto& [name, matrix] : state_dict.weights) {
+            values.clear();
+            for (const auto& row : matrix) {
+                for (const auto& val : row) {
+                    values.push_back(val.data);
+                }
+            }
+            const uint64_t rows = matrix.size();
+            const uint64_t cols = rows > 0 ? matrix[0].size() : 0;
+            const std::vector<std::byte>& bytes = buffers.emplace_back(encode_tensor(values, rows, dtype));
+            tensors.push_back(ModelTensorSource{name, dtype, {rows, cols}, bytes});
+        }
+        write_model_file(filename, info, tensors);
+    }
+
+    static Config read_config(std::ifstream& infile) {
+        Config config{};
+        infile.read(reinterpret_cast<char*>(&config.vocab_size), sizeof(int));
+        infile.read(reinterpret_cast<char*>(&config.n_embd), sizeof(int));
+        infile.read(reinterpret_cast<char*>(&config.n_head), sizeof(int));
+        infile.read(reinterpret_cast<char*>(&config.n_layer), sizeof(int));
+        infile.read(reinterpret_cast<char*>(&config.block_size), sizeof(int));
+        
+        if (!infile) {
+            throw std::runtime_error("Failed to read config from file");
+        }
+        validate_config(config);
+        return config;
+    }
+
+    static void validate_config(const Config& config) {
+        if (config.vocab_size <= 0 || config.n_embd <= 0 || config.n_head <= 0 ||
+            config.n_layer <= 0 || config.block_size <= 0) {
+            throw std::runtime_error("Invalid config in file");
+        }
+        if (config.n_embd % config.n_head != 0) {
+            throw std::runtime_error("n_embd must be divisible by n_head");
+        }
+    }
+
+    static GPT read_params(std::ifstream& infile, const Config& config) {
+        // Initialize model
+        GPT model(config);
+        auto params = model.state_dict.get_all_params();
+
+        // Load parameters in one read (the legacy format has no checksums)
+        std::vector<double> values(params.size());
+        infile.read(reinterpret_cast<char*>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(double)));
+        if (!infile) {
+            throw std::runtime_error("Failed to read all parameters from file");
+        }
+        for (size_t i = 0; i < params.size(); ++i) {
+            if (!std::isfinite(values[i])) {
+                throw std::runtime_error("Loaded parameter with NaN or infinity");
+            }
+            params[i]->data = values[i];
+        }
+        return model;
+    }
+
+    // Backward pass and optimizer step shared by the training entry points;
+    // timer was started right before the forward pass
+    double optimize(Value* loss, std::span<const int> tokens, Adam& optimizer, ValueStorage& storage,
+                    int total_steps, PhaseTimer& timer, StepTelemetry* telemetry) {
+        if (loss == nullptr) {
+            return 0.0;
+        }
+        const double forward_ms = timer.lap_ms();
+
+        // Backward pass
+        loss->backward();
+        const double backward_ms = timer.lap_ms();
+
+        // Optimizer step
+        auto params = state_dict.get_all_params();
+        optimizer.step(params, total_steps);
+
+        if (telemetry != nullptr) {
+            telemetry->tokens = std::min(config.block_size, static_cast<int>(tokens.size()) - 1);
+            telemetry->loss = loss->data;
+            telemetry->forward_ms = forward_ms;
+            telemetry->backward_ms = backward_ms;
+            telemetry->optimizer_ms = timer.lap_ms();
+            telemetry->graph_nodes = storage.size();
+            telemetry->peak_storage_bytes = storage.bytes();
+        }
+
+        return loss->data;
+    }
 };
 
 }  // namespace microgpt
@@ -0,0 +1,944 @@
+#pragma once
+
+/**
+ * Versioned binary model format, laid out for direct mmap.
+ *
+ * File layout (native structs, little-endian on every supported host):
+ *   ModelFileHeader  (128 bytes): magic, version, endianness, config, tokenizer kind,
+ *                    metadata checksum
+ *   tokenizer        [tokenizer_bytes]: characters, or a BPETokenizer merge list
+ *   directory        [n_tensors x ModelTensorEntry], 64-byte aligned
+ *   tensor data      each tensor 64-byte aligned, row-major
+ *
+ * Weights are stored as f64 or, for smaller files, as f16, bf16, or int8 or
+ * int4 with one f32 scale per row (DType, recorded per tensor). Readers convert those
+ * to double once at load time (ModelFile::read_f64).
+ *
+ * Every tensor starts on a 64-byte boundary of a page-aligned mapping, so a
+ * reader can hand pointers into the mapping straight to compute kernels
+ * without copying (see map_weights in nograd.h). The legacy raw dump written
+ * before this format is told apart by its missing magic.
+ *
+ * Since version 2 every directory entry carries the XXH64 hash of its stored
+ * bytes. Loaders verify it, tensors in parallel, so a flipped bit in an
+ * artifact fails the load instead of silently changing the model; version 1
+ * files (no checksums) still load unverified. Since version 3 the header also
+ * carries a hash of the header, tokenizer and directory, checked on open, so
+ * a flipped bit in the config or a tokenizer character is caught as well.
+ */
+
+#include "bpe.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "utils.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace microgpt {
+
+inline constexpr char kModelFileMagic[8] = {'M', 'G', 'P', 'T', 'M', 'D', 'L', '\0'};
+inline constexpr uint32_t kModelFileVersion = 3;
+inline constexpr uint32_t kFirstChecksummedVersion = 2;
+inline constexpr uint32_t kFirstMetadataChecksumVersion = 3;
+inline constexpr uint32_t kModelFileAlignment = 64;
+
+/**
+ * Element type of a stored tensor
+ */
+enum class DType : uint32_t {
+    F64 = 0,
+    U8 = 1,      // raw bytes, e.g. serialized RNG state
+    U64 = 2,     // counters and cursors
+    F16 = 3,     // IEEE half precision
+    BF16 = 4,    // bfloat16: f32 with the low 16 mantissa bits dropped
+    I8 = 5,      // symmetric int8 per row, followed by one f32 scale per row
+    I4 = 6,      // symmetric int4, two per byte (low nibble first), then one f32 scale per row
+};
+
+inline size_t dtype_size(DType dtype) {
+    switch (dtype) {
+        case DType::F64: return 8;
+        case DType::U8: return 1;
+        case DType::U64: return 8;
+        case DType::F16: return 2;
+        case DType::BF16: return 2;
+        case DType::I8: return 1;
+        case DType::I4: return 1;   // packed two per byte; see encoded_size
+    }
+    throw std::runtime_error("Unknown tensor dtype " + std::to_string(static_cast<uint32_t>(dtype)));
+}
+
+inline const char* dtype_name(DType dtype) {
+    switch (dtype) {
+        case DType::F64: return "f64";
+        case DType::U8: return "u8";
+        case DType::U64: return "u64";
+        case DType::F16: return "f16";
+        case DType::BF16: return "bf16";
+        case DType::I8: return "i8";
+        case DType::I4: return "i4";
+    }
+    return "unknown";
+}
+
+/**
+ * Weight dtype from its name ("f64", "f16", "bf16", "i8" or "i4")
+ */
+inline DType parse_weight_dtype(std::string_view name) {
+    for (DType dtype : {DType::F64, DType::F16, DType::BF16, DType::I8, DType::I4}) {
+        if (name == dtype_name(dtype)) {
+            return dtype;
+        }
+    }
+    throw std::invalid_argument("Unknown weight dtype '" + std::string(name) + "' (f64, f16, bf16, i8 or i4)");
+}
+
+/**
+ * Largest quantized magnitude of an integer dtype (0 for the others)
+ */
+inline int quantized_max(DType dtype) {
+    return dtype == DType::I8 ? 127 : dtype == DType::I4 ? 7 : 0;
+}
+
+namespace detail {
+
+/**
+ * a * b and a + b, or UINT64_MAX if the result does not fit; sizes read from a
+ * file are computed with these, and no valid size reaches UINT64_MAX
+ */
+inline uint64_t saturating_mul(uint64_t a, uint64_t b) {
+    return b != 0 && a > UINT64_MAX / b ? UINT64_MAX : a * b;
+}
+
+inline uint64_t saturating_add(uint64_t a, uint64_t b) {
+    return a > UINT64_MAX - b ? UINT64_MAX : a + b;
+}
+
+}  // namespace detail
+
+/**
+ * Stored size of a [rows x cols] tensor; integer rows carry a trailing f32 scale each.
+ * UINT64_MAX if it does not fit in 64 bits.
+ */
+inline uint64_t encoded_size(DType dtype, uint64_t rows, uint64_t cols) {
+    if (quantized_max(dtype) > 0) {
+        const uint64_t row_bytes = dtype == DType::I4 ? (cols + 1) / 2 : cols;
+        const uint64_t q_bytes = detail::saturating_add(detail::saturating_mul(rows, row_bytes), 3) / 4 * 4;
+        return detail::saturating_add(q_bytes, detail::saturating_mul(rows, sizeof(float)));
+    }
+    return detail::saturating_mul(detail::saturating_mul(rows, cols), dtype_size(dtype));
+}
+
+/**
+ * IEEE half precision conversion, rounding to nearest even
+ */
+inline uint16_t f32_to_f16(float f) {
+    const uint32_t x = std::bit_cast<uint32_t>(f);
+    const uint32_t sign = (x >> 16) & 0x8000u;
+    const uint32_t exp = (x >> 23) & 0xffu;
+    uint32_t mant = x & 0x7fffffu;
+    if (exp == 0xffu) {
+        return static_cast<uint16_t>(sign | 0x7c00u | (mant != 0 ? 0x200u : 0u));  // inf, NaN
+    }
+    const int e = static_cast<int>(exp) - 127 + 15;
+    if (e >= 31) {
+        return static_cast<uint16_t>(sign | 0x7c00u);  // overflow to infinity
+    }
+    uint32_t half;
+    uint32_t rem;
+    uint32_t halfway;
+    if (e <= 0) {
+        if (e < -10) {
+            return static_cast<uint16_t>(sign);  // below half the smallest subnormal
+        }
+        mant |= 0x800000u;
+        const int shift = 14 - e;
+        half = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        half = (static_cast<uint32_t>(e) << 10) | (mant >> 13);
+        rem = mant & 0x1fffu;
+        halfway = 0x1000u;
+    }
+    if (rem > halfway || (rem == halfway && (half & 1u) != 0)) {
+        ++half;  // a carry into the exponent is still the correctly rounded value
+    }
+    return static_cast<uint16_t>(sign | half);
+}
+
+inline float f16_to_f32(uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+    const uint32_t exp = (h >> 10) & 0x1fu;
+    const uint32_t mant = h & 0x3ffu;
+    if (exp == 0) {
+        const float v = std::ldexp(static_cast<float>(mant), -24);  // zero or subnormal
+        return sign != 0 ? -v : v;
+    }
+    if (exp == 31) {
+        return std::bit_cast<float>(sign | 0x7f800000u | (mant << 13));
+    }
+    return std::bit_cast<float>(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+/**
+ * bfloat16 conversion, rounding to nearest even
+ */
+inline uint16_t f32_to_bf16(float f) {
+    const uint32_t x = std::bit_cast<uint32_t>(f);
+    if ((x & 0x7fffffffu) > 0x7f800000u) {
+        return static_cast<uint16_t>((x >> 16) | 0x40u);  // keep NaN a NaN
+    }
+    return static_cast<uint16_t>((x + 0x7fffu + ((x >> 16) & 1u)) >> 16);
+}
+
+inline float bf16_to_f32(uint16_t b) {
+    return std::bit_cast<float>(static_cast<uint32_t>(b) << 16);
+}
+
+/**
+ * Encode a row-major [rows x values.size() / rows] tensor of doubles as dtype.
+ * Integer dtypes quantize row r as round(w / scale[r]) clamped to
+ * [-quantized_max, quantized_max]; the scales default to max|w| / quantized_max
+ * and can be given instead, e.g. clipped by calibration.
+ */
+inline std::vector<std::byte> encode_tensor(std::span<const double> values, uint64_t rows, DType dtype,
+                                            std::span<const float> row_scales = {}) {
+    const uint64_t cols = rows > 0 ? values.size() / rows : 0;
+    std::vector<std::byte> out(encoded_size(dtype, rows, cols));
+    switch (dtype) {
+        case DType::F64:
+            std::memcpy(out.data(), values.data(), out.size());
+            break;
+        case DType::F16:
+        case DType::BF16:
+            for (size_t i = 0; i < values.size(); ++i) {
+                const float f = static_cast<float>(values[i]);
+                const uint16_t h = dtype == DType::F16 ? f32_to_f16(f) : f32_to_bf16(f);
+                std::memcpy(out.data() + 2 * i, &h, sizeof(h));
+            }
+            break;
+        case DType::I8:
+        case DType::I4: {
+            if (!row_scales.empty() && row_scales.size() != rows) {
+                throw std::invalid_argument("Need one quantization scale per row");
+            }
+            const double qmax = quantized_max(dtype);
+            const uint64_t row_bytes = dtype == DType::I4 ? (cols + 1) / 2 : cols;
+            auto* q = reinterpret_cast<uint8_t*>(out.data());
+            std::byte* scales = out.data() + (rows * row_bytes + 3) / 4 * 4;
+            for (uint64_t r = 0; r < rows; ++r) {
+                const double* row = values.data() + r * cols;
+                float scale = 0.0f;
+                if (row_scales.empty()) {
+                    double max_abs = 0.0;
+                    for (uint64_t c = 0; c < cols; ++c) {
+                        max_abs = std::max(max_abs, std::abs(row[c]));
+                    }
+                    scale = static_cast<float>(max_abs / qmax);
+                } else {
+                    scale = row_scales[r];
+                }
+                uint8_t* qrow = q + r * row_bytes;
+                for (uint64_t c = 0; c < cols; ++c) {
+                    const double v = scale > 0.0f ? std::clamp(std::round(row[c] / scale), -qmax, qmax) : 0.0;
+                    const auto bits = static_cast<uint8_t>(static_cast<int8_t>(v));
+                    if (dtype == DType::I8) {
+                        qrow[c] = bits;
+                    } else {
+                        qrow[c / 2] |= static_cast<uint8_t>((bits & 0x0fu) << (4 * (c % 2)));
+                    }
+                }
+                std::memcpy(scales + r * sizeof(float), &scale, sizeof(float));
+            }
+            break;
+        }
+        default:
+            throw std::invalid_argument(std::string("Cannot encode weights as ") + dtype_name(dtype));
+    }
+    return out;
+}
+
+/**
+ * Decode a [rows x cols] tensor stored as dtype into doubles
+ */
+inline void decode_tensor(std::span<const std::byte> bytes, DType dtype, uint64_t rows, uint64_t cols,
+                          std::span<double> out) {
+    if (bytes.size() != encoded_size(dtype, rows, cols) || out.size() != rows * cols) {
+        throw std::invalid_argument("Tensor size does not match its shape");
+    }
+    switch (dtype) {
+        case DType::F64:
+            std::memcpy(out.data(), bytes.data(), bytes.size());
+            break;
+        case DType::F16:
+        case DType::BF16:
+            for (size_t i = 0; i < out.size(); ++i) {
+                uint16_t h = 0;
+                std::memcpy(&h, bytes.data() + 2 * i, sizeof(h));
+                out[i] = dtype == DType::F16 ? f16_to_f32(h) : bf16_to_f32(h);
+            }
+            break;
+        case DType::I8:
+        case DType::I4: {
+            const uint64_t row_bytes = dtype == DType::I4 ? (cols + 1) / 2 : cols;
+            const auto* q = reinterpret_cast<const uint8_t*>(bytes.data());
+            const std::byte* scales = bytes.data() + (rows * row_bytes + 3) / 4 * 4;
+            for (uint64_t r = 0; r < rows; ++r) {
+                float scale = 0.0f;
+                std::memcpy(&scale, scales + r * sizeof(float), sizeof(float));
+                const uint8_t* qrow = q + r * row_bytes;
+                for (uint64_t c = 0; c < cols; ++c) {
+                    int v;
+                    if (dtype == DType::I8) {
+                        v = static_cast<int8_t>(qrow[c]);
+                    } else {
+                        v = (qrow[c / 2] >> (4 * (c % 2))) & 0x0f;
+                        v = v >= 8 ? v - 16 : v;  // sign-extend the nibble
+                    }
+                    out[r * cols + c] = v * static_cast<double>(scale);
+                }
+            }
+            break;
+        }
+        default:
+            throw std::invalid_argument(std::string("Cannot decode ") + dtype_name(dtype) + " as weights");
+    }
+}
+
+/**
+ * DType of a C++ element type
+ */
+template <typename T>
+inline constexpr DType dtype_of() {
+    if constexpr (std::is_same_v<T, double>) {
+        return DType::F64;
+    } else if constexpr (std::is_same_v<T, uint8_t>) {
+        return DType::U8;
+    } else {
+        static_assert(std::is_same_v<T, uint64_t>, "Model tensors are f64, u8 or u64");
+        return DType::U64;
+    }
+}
+
+/**
+ * Tokenizer stored in the tokenizer section
+ */
+enum class TokenizerKind : uint32_t {
+    Chars = 0,   // Tokenizer::uchars
+    BPE = 1,     // BPETokenizer::save
+};
+
+struct ModelFileHeader {
+    char magic[8];               // "MGPTMDL\0"
+    uint32_t version;
+    uint32_t endian;             // 0x01020304 as written by the producing host
+    int32_t vocab_size;
+    int32_t n_embd;
+    int32_t n_head;
+    int32_t n_layer;
+    int32_t block_size;
+    uint32_t tokenizer_kind;     // TokenizerKind
+    int32_t bos;
+    uint32_t n_tensors;
+    uint64_t tokenizer_offset;
+    uint64_t tokenizer_bytes;
+    uint64_t directory_offset;
+    uint64_t data_offset;        // first tensor
+    uint64_t file_bytes;         // total size, to detect truncation
+    uint64_t metadata_checksum;  // hash64 of header (this field zeroed), tokenizer and directory (version 3+)
+    uint8_t reserved[32];
+};
+static_assert(sizeof(ModelFileHeader) == 128, "ModelFileHeader must stay 128 bytes");
+
+struct ModelTensorEntry {
+    char name[64];               // NUL-terminated
+    uint32_t dtype;              // DType
+    uint32_t rank;
+    uint64_t shape[4];           // unused dimensions are 0
+    uint64_t offset;             // byte offset in the file, 64-byte aligned
+    uint64_t bytes;
+    uint64_t checksum;           // hash64 of the stored bytes (version 2+)
+
+    std::string_view tensor_name() const {
+        return {name, strnlen(name, sizeof(name))};
+    }
+
+    // UINT64_MAX if the shape's product does not fit in 64 bits
+    uint64_t elements() const {
+        uint64_t n = 1;
+        for (uint32_t d = 0; d < rank && d < 4; ++d) {
+            n = detail::saturating_mul(n, shape[d]);
+        }
+        return n;
+    }
+
+    /**
+     * Leading dimension (1 for scalars and vectors), and elements per row
+     */
+    uint64_t rows() const {
+        return rank >= 2 ? shape[0] : 1;
+    }
+
+    uint64_t cols() const {
+        return rows() > 0 ? elements() / rows() : 0;
+    }
+};
+static_assert(sizeof(ModelTensorEntry) == 128, "ModelTensorEntry must stay 128 bytes");
+
+namespace detail {
+
+/**
+ * Hash of everything but the tensor data, which the directory's checksums cover
+ */
+inline uint64_t model_metadata_checksum(ModelFileHeader header, std::span<const std::byte> tokenizer,
+                                        std::span<const ModelTensorEntry> directory) {
+    header.metadata_checksum = 0;
+    uint64_t h = hash64(std::as_bytes(std::span(&header, 1)));
+    h = hash64(tokenizer, h);
+    return hash64(std::as_bytes(directory), h);
+}
+
+}  // namespace detail
+
+/**
+ * One tensor to write: raw element bytes owned by the caller
+ */
+struct ModelTensorSource {
+    std::string name;
+    DType dtype = DType::F64;
+    std::vector<uint64_t> shape;
+    std::span<const std::byte> bytes;
+};
+
+/**
+ * Everything in a model file besides the tensors
+ */
+struct ModelFileInfo {
+    int32_t vocab_size = 0;
+    int32_t n_embd = 0;
+    int32_t n_head = 0;
+    int32_t n_layer = 0;
+    int32_t block_size = 0;
+    TokenizerKind tokenizer_kind = TokenizerKind::Chars;
+    int32_t bos = 0;
+    std::string tokenizer;       // serialized tokenizer section
+};
+
+/**
+ * Serialized tokenizer sections
+ */
+inline std::string tokenizer_section(const Tokenizer& tokenizer) {
+    return std::string(tokenizer.uchars.begin(), tokenizer.uchars.end());
+}
+
+inline std::string tokenizer_section(const BPETokenizer& tokenizer) {
+    std::ostringstream out(std::ios::binary);
+    tokenizer.save(out);
+    return out.str();
+}
+
+namespace detail {
+
+/**
+ * Sequential file writer that stages small writes into a large buffer and
+ * passes large ones straight to write(2)
+ */
+class FileWriter {
+public:
+    explicit FileWriter(const std::string& path) : path_(path), buffer_(kBufferBytes) {
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) {
+            throw std::runtime_error("Could not open file for writing: " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    ~FileWriter() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    void write(const void* data, size_t n) {
+        const char* p = static_cast<const char*>(data);
+        if (used_ + n > buffer_.size()) {
+            flush();
+        }
+        if (n >= buffer_.size()) {
+            write_all(p, n);
+        } else {
+            std::memcpy(buffer_.data() + used_, p, n);
+            used_ += n;
+        }
+        position_ += n;
+    }
+
+    /**
+     * Zero-fill up to an absolute file offset
+     */
+    void pad_to(uint64_t offset) {
+        static const char zeros[kModelFileAlignment] = {};
+        while (position_ < offset) {
+            write(zeros, static_cast<size_t>(std::min<uint64_t>(offset - position_, sizeof(zeros))));
+        }
+    }
+
+    /**
+     * Flush and fsync, then close
+     */
+    void sync() {
+        flush();
+        if (::fsync(fd_) != 0) {
+            throw std::runtime_error("Could not fsync " + path_ + ": " + std::strerror(errno));
+        }
+        const int fd = fd_;
+        fd_ = -1;
+        if (::close(fd) != 0) {
+            throw std::runtime_error("Could not close " + path_ + ": " + std::strerror(errno));
+        }
+    }
+
+private:
+    static constexpr size_t kBufferBytes = 4 << 20;
+    std::string path_;
+    int fd_ = -1;
+    std::vector<char> buffer_;
+    size_t used_ = 0;
+    uint64_t position_ = 0;
+
+    void flush() {
+        write_all(buffer_.data(), used_);
+        used_ = 0;
+    }
+
+    void write_all(const char* p, size_t n) {
+        while (n > 0) {
+            const ssize_t written = ::write(fd_, p, n);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                throw std::runtime_error("Error writing to file: " + path_ + ": " + std::strerror(errno));
+            }
+            p += written;
+            n -= static_cast<size_t>(written);
+        }
+    }
+};
+
+/**
+ * Atomically rename from over to, then fsync the directory so the rename survives a crash
+ */
+inline void replace_file(const std::string& from, const std::string& to) {
+    if (::rename(from.c_str(), to.c_str()) != 0) {
+        const int err = errno;
+        ::unlink(from.c_str());
+        throw std::runtime_error("Could not rename " + from + " to " + to + ": " + std::strerror(err));
+    }
+    const size_t slash = to.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : to.substr(0, slash));
+    const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+}  // namespace detail
+
+/**
+ * Tensors whose name contains '/' hold training state (e.g. "optimizer/m"),
+ * not model weights; weight loaders skip them
+ */
+inline bool is_state_tensor(std::string_view name) {
+    return name.find('/') != std::string_view::npos;
+}
+
+/**
+ * Whether path starts with the model file magic (false for legacy files)
+ */
+inline bool is_model_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    char magic[sizeof(kModelFileMagic)] = {};
+    in.read(magic, sizeof(magic));
+    return in.gcount() == sizeof(magic) && std::memcmp(magic, kModelFileMagic, sizeof(magic)) == 0;
+}
+
+namespace detail {
+
+/**
+ * Header and directory of a model file; every offset is known before any data is written
+ */
+struct ModelFileLayout {
+    ModelFileHeader header{};
+    std::vector<ModelTensorEntry> directory;
+};
+
+inline ModelFileLayout layout_model_file(const ModelFileInfo& info, std::span<const ModelTensorSource> tensors) {
+    auto align = [](uint64_t pos) {
+        return (pos + kModelFileAlignment - 1) / kModelFileAlignment * kModelFileAlignment;
+    };
+
+    ModelFileLayout layout;
+    ModelFileHeader& header = layout.header;
+    std::memcpy(header.magic, kModelFileMagic, sizeof(header.magic));
+    header.version = kModelFileVersion;
+    header.endian = kEndianMarker;
+    header.vocab_size = info.vocab_size;
+    header.n_embd = info.n_embd;
+    header.n_head = info.n_head;
+    header.n_layer = info.n_layer;
+    header.block_size = info.block_size;
+    header.tokenizer_kind = static_cast<uint32_t>(info.tokenizer_kind);
+    header.bos = info.bos;
+    header.n_tensors = static_cast<uint32_t>(tensors.size());
+    header.tokenizer_offset = sizeof(ModelFileHeader);
+    header.tokenizer_bytes = info.tokenizer.size();
+    header.directory_offset = align(header.tokenizer_offset + header.tokenizer_bytes);
+
+    layout.directory.resize(tensors.size());
+    uint64_t pos = align(header.directory_offset + layout.directory.size() * sizeof(ModelTensorEntry));
+    header.data_offset = pos;
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        const ModelTensorSource& t = tensors[i];
+        ModelTensorEntry& e = layout.directory[i];
+        if (t.name.empty() || t.name.size() >= sizeof(e.name)) {
+            throw std::invalid_argument("Tensor name must be 1-63 bytes: " + t.name);
+        }
+        if (t.shape.size() > 4) {
+            throw std::invalid_argument("Tensor rank above 4: " + t.name);
+        }
+        std::memcpy(e.name, t.name.data(), t.name.size());
+        e.dtype = static_cast<uint32_t>(t.dtype);
+        e.rank = static_cast<uint32_t>(t.shape.size());
+        std::copy(t.shape.begin(), t.shape.end(), e.shape);
+        e.bytes = t.bytes.size();
+        if (e.bytes != encoded_size(t.dtype, e.rows(), e.cols())) {
+            throw std::invalid_argument("Tensor byte size does not match its shape: " + t.name);
+        }
+        e.checksum = hash64(t.bytes);
+        e.offset = pos;
+        pos = align(pos + e.bytes);
+    }
+    header.file_bytes = pos;
+    header.metadata_checksum = detail::model_metadata_checksum(header, std::as_bytes(std::span(info.tokenizer)),
+                                                               layout.directory);
+    return layout;
+}
+
+/**
+ * Emit a laid-out model file through a FileWriter or BufferWriter
+ */
+template <typename Writer>
+void emit_model_file(Writer& out, const ModelFileLayout& layout, const ModelFileInfo& info,
+                     std::span<const ModelTensorSource> tensors) {
+    out.write(&layout.header, sizeof(layout.header));
+    out.write(info.tokenizer.data(), info.tokenizer.size());
+    out.pad_to(layout.header.directory_offset);
+    out.write(layout.directory.data(), layout.directory.size() * sizeof(ModelTensorEntry));
+    for (size_t i = 0; i < tensors.size(); ++i) {
+        out.pad_to(layout.directory[i].offset);
+        out.write(tensors[i].bytes.data(), tensors[i].bytes.size());
+    }
+    out.pad_to(layout.header.file_bytes);
+}
+
+/**
+ * In-memory counterpart of FileWriter; reuses the capacity of its buffer
+ */
+class BufferWriter {
+public:
+    explicit BufferWriter(std::vector<std::byte>& out) : out_(out) {
+        out_.clear();
+    }
+
+    void write(const void* data, size_t n) {
+        const auto* p = static_cast<const std::byte*>(data);
+        out_.insert(out_.end(), p, p + n);
+    }
+
+    void pad_to(uint64_t offset) {
+        if (out_.size() < offset) {
+            out_.resize(offset);
+        }
+    }
+
+private:
+    std::vector<std::byte>& out_;
+};
+
+/**
+ * Write bytes to path through a temporary file, fsync and rename into place
+ */
+template <typename Fill>
+void write_file_atomically(const std::string& path, Fill fill) {
+    // Written next to the target, made durable, then renamed over it: readers
+    // see either the previous file or the complete new one
+    const std::string tmp = path + ".tmp";
+    FileWriter out(tmp);
+    try {
+        fill(out);
+        out.sync();
+    } catch (...) {
+        ::unlink(tmp.c_str());
+        throw;
+    }
+    replace_file(tmp, path);
+}
+
+}  // namespace detail
+
+/**
+ * Write a model file: staged through a temporary file, fsynced and renamed
+ * over path, so a crash never leaves a partial file behind
+ * @return Size of the written file
+ * @throws std::runtime_error on I/O failure, std::invalid_argument on bad tensors
+ */
+inline uint64_t write_model_file(const std::string& path, const ModelFileInfo& info,
+                                 std::span<const ModelTensorSource> tensors) {
+    const detail::ModelFileLayout layout = detail::layout_model_file(info, tensors);
+    detail::write_file_atomically(path, [&](detail::FileWriter& out) {
+        detail::emit_model_file(out, layout, info, tensors);
+    });
+    return layout.header.file_bytes;
+}
+
+/**
+ * The exact bytes write_model_file would write, built in out
+ */
+inline void serialize_model_file(const ModelFileInfo& info, std::span<const ModelTensorSource> tensors,
+                                 std::vector<std::byte>& out) {
+    const detail::ModelFileLayout layout = detail::layout_model_file(info, tensors);
+    out.reserve(layout.header.file_bytes);
+    detail::BufferWriter writer(out);
+    detail::emit_model_file(writer, layout, info, tensors);
+}
+
+/**
+ * Memory-mapped, validated view of a model file. Tensor data is read in place;
+ * views stay valid for the lifetime of the ModelFile.
+ */
+class ModelFile {
+public:
+    explicit ModelFile(const std::string& path) : file_(path) {
+        if (file_.size() < sizeof(ModelFileHeader)) {
+            throw std::runtime_error("Not a model file (file too small): " + path);
+        }
+        std::memcpy(&header_, file_.data(), sizeof(header_));
+        if (std::memcmp(header_.magic, kModelFileMagic, sizeof(header_.magic)) != 0) {
+            throw std::runtime_error("Not a model file (bad magic): " + path);
+        }
+        if (header_.version == 0 || header_.version > kModelFileVersion) {
+            throw std::runtime_error("Unsupported model file version " + std::to_string(header_.version));
+        }
+        if (header_.endian != kEndianMarker) {
+            throw std::runtime_error("Model file was written on a host of different endianness: " + path);
+        }
+        // Sizes are compared against the room left, so crafted values cannot wrap around
+        if (header_.file_bytes != file_.size() || header_.tokenizer_offset < sizeof(ModelFileHeader) ||
+            header_.tokenizer_offset > header_.directory_offset ||
+            header_.tokenizer_bytes > header_.directory_offset - header_.tokenizer_offset ||
+            header_.directory_offset % kModelFileAlignment != 0 || header_.directory_offset > header_.data_offset ||
+            header_.n_tensors > (header_.data_offset - header_.directory_offset) / sizeof(ModelTensorEntry) ||
+            header_.data_offset > file_.size()) {
+            throw std::runtime_error("Model file is truncated or corrupt: " + path);
+        }
+
+        directory_.resize(header_.n_tensors);
+        std::memcpy(directory_.data(), file_.data() + header_.directory_offset,
+                    directory_.size() * sizeof(ModelTensorEntry));
+        check_metadata();
+        for (const auto& e : directory_) {
+            if (e.rank > 4 || e.offset % kModelFileAlignment != 0 || e.offset < header_.data_offset ||
+                e.offset > file_.size() || e.bytes > file_.size() - e.offset ||
+                e.bytes != encoded_size(DType(e.dtype), e.rows(), e.cols())) {
+                throw std::runtime_error("Invalid tensor entry '" + std::string(e.tensor_name()) + "' in " + path);
+            }
+        }
+    }
+
+    const ModelFileHeader& header() const { return header_; }
+    const std::vector<ModelTensorEntry>& tensors() const { return directory_; }
+    TokenizerKind tokenizer_kind() const { return TokenizerKind(header_.tokenizer_kind); }
+
+    /**
+     * Directory entry of a tensor, or nullptr
+     */
+    const ModelTensorEntry* find(std::string_view name) const {
+        for (const auto& e : directory_) {
+            if (e.tensor_name() == name) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Zero-copy view of a tensor's elements, after checking its checksum; T
+     * must match its dtype
+     */
+    template <typename T>
+    std::span<const T> data(const ModelTensorEntry& entry) const {
+        if (DType(entry.dtype) != dtype_of<T>()) {
+            throw std::invalid_argument("Tensor '" + std::string(entry.tensor_name()) + "' is " +
+                                        dtype_name(DType(entry.dtype)));
+        }
+        check(entry);
+        return {reinterpret_cast<const T*>(file_.data() + entry.offset), entry.elements()};
+    }
+
+    /**
+     * Raw stored bytes of a tensor
+     */
+    std::span<const std::byte> bytes(const ModelTensorEntry& entry) const {
+        return std::as_bytes(file_.bytes().subspan(entry.offset, entry.bytes));
+    }
+
+    /**
+     * Whether the directory records tensor checksums (false for version 1 files)
+     */
+    bool has_checksums() const {
+        return header_.version >= kFirstChecksummedVersion;
+    }
+
+    /**
+     * Whether the header, tokenizer and directory match the header's checksum
+     * (true before version 3)
+     */
+    bool metadata_intact() const {
+        return header_.version < kFirstMetadataChecksumVersion ||
+               detail::model_metadata_checksum(header_, std::as_bytes(tokenizer_bytes()), directory_) ==
+                   header_.metadata_checksum;
+    }
+
+    /**
+     * @throws std::runtime_error if the header, tokenizer or directory do not match their checksum
+     */
+    void check_metadata() const {
+        if (!metadata_intact()) {
+            throw std::runtime_error("Checksum mismatch in model file header, tokenizer or directory "
+                                     "(model file is corrupt)");
+        }
+    }
+
+    /**
+     * Whether a tensor's stored bytes match its checksum (true without checksums)
+     */
+    bool intact(const ModelTensorEntry& entry) const {
+        return !has_checksums() || hash64(bytes(entry)) == entry.checksum;
+    }
+
+    /**
+     * @throws std::runtime_error if a tensor's stored bytes do not match its checksum
+     */
+    void check(const ModelTensorEntry& entry) const {
+        if (!intact(entry)) {
+            throw std::runtime_error("Checksum mismatch in tensor '" + std::string(entry.tensor_name()) +
+                                     "' (model file is corrupt)");
+        }
+    }
+
+    /**
+     * Check the metadata, then every tensor, in parallel
+     * @param n_threads Worker threads (0 = hardware concurrency; small files use one)
+     * @return Names of the tensors whose checksum does not match (empty if intact)
+     * @throws std::runtime_error if the header, tokenizer or directory are corrupt
+     */
+    std::vector<std::string> verify(int n_threads = 0) const {
+        check_metadata();
+        std::vector<char> ok(directory_.size(), 1);
+        detail::parallel_for(directory_.size(), file_.size(), n_threads,
+                             [&](size_t i) { ok[i] = intact(directory_[i]); });
+        std::vector<std::string> corrupt;
+        for (size_t i = 0; i < directory_.size(); ++i) {
+            if (!ok[i]) {
+                corrupt.emplace_back(directory_[i].tensor_name());
+            }
+        }
+        return corrupt;
+    }
+
+    /**
+     * Elements of a weight tensor converted to double, whatever its stored
+     * dtype, after checking its checksum
+     */
+    void read_f64(const ModelTensorEntry& entry, std::span<double> out) const {
+        check(entry);
+        decode_tensor(bytes(entry), DType(entry.dtype), entry.rows(), entry.cols(), out);
+    }
+
+    std::span<const uint8_t> tokenizer_bytes() const {
+        return file_.bytes().subspan(header_.tokenizer_offset, header_.tokenizer_bytes);
+    }
+
+    /**
+     * The character tokenizer stored in the file
+     */
+    Tokenizer tokenizer() const {
+        if (tokenizer_kind() != TokenizerKind::Chars) {
+            throw std::runtime_error("Model uses a BPE tokenizer");
+        }
+        Tokenizer tok;
+        const auto bytes = tokenizer_bytes();
+        tok.uchars.assign(bytes.begin(), bytes.end());
+        tok.BOS = header_.bos;
+        tok.vocab_size = header_.vocab_size;
+        if (tok.BOS != static_cast<int>(tok.uchars.size()) || tok.vocab_size != tok.BOS + 1) {
+            throw std::runtime_error("Inconsistent tokenizer in model file");
+        }
+        tok.build_tables();
+        return tok;
+    }
+
+    /**
+     * The BPE tokenizer stored in the file
+     */
+    BPETokenizer bpe_tokenizer() const {
+        if (tokenizer_kind() != TokenizerKind::BPE) {
+            throw std::runtime_error("Model does not use a BPE tokenizer");
+        }
+        const auto bytes = tokenizer_bytes();
+        std::istringstream in(std::string(bytes.begin(), bytes.end()), std::ios::binary);
+        BPETokenizer tok;
+        tok.load(in);
+        if (tok.BOS != header_.bos || tok.vocab_size != header_.vocab_size) {
+            throw std::runtime_error("Inconsistent BPE tokenizer in model file");
+        }
+        return tok;
+    }
+
+    const MappedFile& file() const { return file_; }
+
+private:
+    MappedFile file_;
+    ModelFileHeader header_{};
+    std::vector<ModelTensorEntry> directory_;
+};
+
+}  // namespace microgpt
@@ -0,0 +1,582 @@
+#pragma once
+
+/**
+ * Gradient-free inference on plain doubles.
+ *
+ * FlatWeights holds every parameter in one contiguous buffer (same order as
+ * StateDict::get_all_params), which makes weight snapshots a single pass over
+ * the parameters. NoGradModel runs a batched forward pass over such a buffer
+ * without building a computation graph: sequences advance in lock-step, so every
+ * linear layer is one matrix-matrix product over the whole batch.
+ */
+
+#include "model.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Read-only view of one row-major weight matrix [rows x cols]
+ */
+struct TensorView {
+    const double* data = nullptr;
+    int rows = 0;
+    int cols = 0;
+
+    const double* row(int r) const {
+        return data + static_cast<size_t>(r) * cols;
+    }
+};
+
+/**
+ * All model parameters in one contiguous buffer, tensor by tensor in
+ * StateDict key order, each tensor row-major. A FlatWeights can also be a
+ * read-only view of tensors in a mapped model file (see map_weights).
+ */
+class FlatWeights {
+public:
+    struct Entry {
+        size_t offset;
+        int rows;
+        int cols;
+    };
+
+    FlatWeights() = default;
+
+    explicit FlatWeights(const StateDict& state_dict) {
+        layout(state_dict);
+        copy_from(state_dict);
+    }
+
+    /**
+     * Size the buffer and record tensor offsets for the shapes in state_dict
+     */
+    void layout(const StateDict& state_dict) {
+        entries_.clear();
+        size_t offset = 0;
+        for (const auto& [name, matrix] : state_dict.weights) {
+            const int rows = static_cast<int>(matrix.size());
+            const int cols = rows > 0 ? static_cast<int>(matrix[0].size()) : 0;
+            entries_[name] = Entry{offset, rows, cols};
+            offset += static_cast<size_t>(rows) * cols;
+        }
+        data_.assign(offset, 0.0);
+    }
+
+    /**
+     * Snapshot parameter values; does not allocate once laid out
+     */
+    void copy_from(const StateDict& state_dict) {
+        if (mapped_ != nullptr) {
+            throw std::logic_error("FlatWeights view is read-only");
+        }
+        size_t i = 0;
+        for (const auto& [name, matrix] : state_dict.weights) {
+            for (const auto& row : matrix) {
+                for (const auto& val : row) {
+                    data_[i++] = val.data;
+                }
+            }
+        }
+        if (i != data_.size()) {
+            throw std::runtime_error("FlatWeights layout does not match state dict");
+        }
+    }
+
+    /**
+     * Write the buffer back into a state dict of the same shapes
+     */
+    void copy_to(StateDict& state_dict) const {
+        size_t i = 0;
+        for (auto& [name, matrix] : state_dict.weights) {
+            for (auto& row : matrix) {
+                for (auto& val : row) {
+                    if (i >= data_.size()) {
+                        throw std::runtime_error("FlatWeights layout does not match state dict");
+                    }
+                    val.data = data_[i++];
+                }
+            }
+        }
+        if (i != data_.size()) {
+            throw std::runtime_error("FlatWeights layout does not match state dict");
+        }
+    }
+
+    TensorView tensor(const std::string& name) const {
+        auto it = entries_.find(name);
+        if (it == entries_.end()) {
+            throw std::out_of_range("No tensor named " + name);
+        }
+        const double* base = mapped_ != nullptr ? mapped_ : data_.data();
+        return TensorView{base + it->second.offset, it->second.rows, it->second.cols};
+    }
+
+    /**
+     * Read-only view of tensors living elsewhere; entry offsets count doubles from base
+     */
+    static FlatWeights view(const double* base, std::map<std::string, Entry> entries) {
+        FlatWeights weights;
+        weights.mapped_ = base;
+        weights.entries_ = std::move(entries);
+        for (const auto& [name, e] : weights.entries_) {
+            weights.view_size_ += static_cast<size_t>(e.rows) * e.cols;
+        }
+        return weights;
+    }
+
+    /**
+     * Owned, zero-filled buffer for the given layout (offsets count doubles)
+     */
+    static FlatWeights allocate(std::map<std::string, Entry> entries) {
+        FlatWeights weights;
+        size_t total = 0;
+        for (const auto& [name, e] : entries) {
+            total = std::max(total, e.offset + static_cast<size_t>(e.rows) * e.cols);
+        }
+        weights.entries_ = std::move(entries);
+        weights.data_.assign(total, 0.0);
+        return weights;
+    }
+
+    bool is_view() const { return mapped_ != nullptr; }
+
+    const std::map<std::string, Entry>& entries() const { return entries_; }
+    std::span<double> data() { return data_; }               // empty for views
+    std::span<const double> data() const { return data_; }
+    size_t size() const { return mapped_ != nullptr ? view_size_ : data_.size(); }
+
+private:
+    std::vector<double> data_;
+    std::map<std::string, Entry> entries_;
+    const double* mapped_ = nullptr;  // set for views; data_ is then empty
+    size_t view_size_ = 0;
+};
+
+/**
+ * Weights of a model file. When every weight tensor is f64 they are read in
+ * place from the mapping (zero-copy; the file must outlive the view); reduced
+ * precision tensors are decoded once into an owned buffer instead. Either
+ * way every weight tensor's checksum is verified first, tensors in parallel.
+ */
+inline FlatWeights map_weights(const ModelFile& file) {
+    std::vector<const ModelTensorEntry*> weights;
+    bool all_f64 = true;
+    for (const auto& e : file.tensors()) {
+        if (is_state_tensor(e.tensor_name())) {
+            continue;
+        }
+        if (e.rank != 2) {
+            throw std::invalid_argument("map_weights needs 2-D tensors; '" + std::string(e.tensor_name()) +
+                                        "' has rank " + std::to_string(e.rank));
+        }
+        if (e.shape[0] > static_cast<uint64_t>(std::numeric_limits<int>::max()) ||
+            e.shape[1] > static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+            throw std::invalid_argument("Tensor '" + std::string(e.tensor_name()) + "' is too large");
+        }
+        weights.push_back(&e);
+        all_f64 = all_f64 && DType(e.dtype) == DType::F64;
+    }
+
+    std::map<std::string, FlatWeights::Entry> entries;
+    for (const ModelTensorEntry* e : weights) {
+        entries[std::string(e->tensor_name())] =
+            FlatWeights::Entry{e->offset / sizeof(double), static_cast<int>(e->shape[0]), static_cast<int>(e->shape[1])};
+    }
+    if (all_f64) {
+        detail::parallel_for(weights.size(), file.file().size(), 0, [&](size_t i) { file.check(*weights[i]); });
+        return FlatWeights::view(reinterpret_cast<const double*>(file.file().data()), std::move(entries));
+    }
+
+    // Owned buffer in key order, like a FlatWeights laid out from a StateDict
+    size_t offset = 0;
+    for (auto& [name, entry] : entries) {
+        entry.offset = offset;
+        offset += static_cast<size_t>(entry.rows) * entry.cols;
+    }
+    FlatWeights decoded = FlatWeights::allocate(std::move(entries));
+    detail::parallel_for(weights.size(), file.file().size(), 0, [&](size_t i) {
+        const ModelTensorEntry* e = weights[i];
+        const auto& entry = decoded.entries().at(std::string(e->tensor_name()));
+        file.read_f64(*e, decoded.data().subspan(entry.offset, static_cast<size_t>(entry.rows) * entry.cols));
+    });
+    return decoded;
+}
+
+/**
+ * y[b][o] = sum_i x[b][i] * w[o][i] for a batch of rows (x: [batch x in], w: [out x in])
+ *
+ * Rows of x are processed in blocks of tile rows that share each pass over a
+ * weight row. The block size only changes the memory access order; every
+ * output is the same sum in the same order, so results do not depend on it.
+ */
+inline void matmul_nt(const double* x, int batch, const TensorView& w, double* y, int tile = 1) {
+    const int in = w.cols;
+    const int out = w.rows;
+    tile = std::max(1, tile);
+    for (int b0 = 0; b0 < batch; b0 += tile) {
+        const int b1 = std::min(batch, b0 + tile);
+        for (int o = 0; o < out; ++o) {
+            const double* wo = w.row(o);
+            for (int b = b0; b < b1; ++b) {
+                const double* xb = x + static_cast<size_t>(b) * in;
+                double sum = 0.0;
+                for (int i = 0; i < in; ++i) {
+                    sum += wo[i] * xb[i];
+                }
+                y[static_cast<size_t>(b) * out + o] = sum;
+            }
+        }
+    }
+}
+
+/**
+ * In-place RMS normalization of each row of x [batch x n]
+ */
+inline void rmsnorm_rows(double* x, int batch, int n) {
+    for (int b = 0; b < batch; ++b) {
+        double* xb = x + static_cast<size_t>(b) * n;
+        double ms = 0.0;
+        for (int i = 0; i < n; ++i) {
+            ms += xb[i] * xb[i];
+        }
+        const double scale = 1.0 / std::sqrt(ms / n + 1e-5);
+        for (int i = 0; i < n; ++i) {
+            xb[i] *= scale;
+        }
+    }
+}
+
+/**
+ * Batched forward pass without autograd.
+ *
+ * Holds scratch buffers and a per-sequence KV cache sized for max_batch
+ * sequences of block_size positions, so repeated calls do not allocate.
+ * The weights are referenced and must outlive the model. The constructor
+ * checks that every tensor has the shape the config implies, so a config read
+ * from a file header cannot send the kernels past the end of a tensor.
+ */
+class NoGradModel {
+public:
+    NoGradModel(const Config& config, const FlatWeights& weights, int max_batch = 32)
+        : config_(config), weights_(weights), max_batch_(max_batch) {
+        if (max_batch_ <= 0) {
+            throw std::invalid_argument("max_batch must be positive");
+        }
+        // The config may come straight from a file header; the kernels index by it without bounds checks
+        if (config_.vocab_size <= 0 || config_.n_embd <= 0 || config_.n_head <= 0 || config_.n_layer <= 0 ||
+            config_.block_size <= 0) {
+            throw std::invalid_argument("Config dimensions must be positive");
+        }
+        if (config_.n_embd % config_.n_head != 0) {
+            throw std::invalid_argument("n_embd must be divisible by n_head");
+        }
+        // Every tensor must have exactly the shape StateDict::init gives it for this config
+        const int64_t n = config_.n_embd;
+        auto tensor = [&](const std::string& name, int64_t rows, int64_t cols) {
+            const TensorView t = weights_.tensor(name);
+            if (t.rows != rows || t.cols != cols) {
+                throw std::invalid_argument("Tensor " + name + " has the wrong shape for the config");
+            }
+            return t;
+        };
+        for (int li = 0; li < config_.n_layer; ++li) {
+            const std::string prefix = "layer" + std::to_string(li) + ".";
+            layers_.push_back(Layer{tensor(prefix + "attn_wq", n, n), tensor(prefix + "attn_wk", n, n),
+                                    tensor(prefix + "attn_wv", n, n), tensor(prefix + "attn_wo", n, n),
+                                    tensor(prefix + "mlp_fc1", 4 * n, n), tensor(prefix + "mlp_fc2", n, 4 * n)});
+        }
+        wte_ = tensor("wte", config_.vocab_size, n);
+        wpe_ = tensor("wpe", config_.block_size, n);
+        lm_head_ = tensor("lm_head", config_.vocab_size, n);
+
+        const size_t b = max_batch_;
+        const size_t d = config_.n_embd;
+        x_.resize(b * d);
+        xn_.resize(b * d);
+        q_.resize(b * d);
+        k_.resize(b * d);
+        v_.resize(b * d);
+        attn_.resize(b * d);
+        proj_.resize(b * d);
+        hidden_.resize(b * 4 * d);
+        logits_.resize(b * config_.vocab_size);
+        scores_.resize(config_.block_size);
+        kv_keys_.assign(config_.n_layer, std::vector<double>(b * config_.block_size * d));
+        kv_values_.assign(config_.n_layer, std::vector<double>(b * config_.block_size * d));
+        kv_len_.resize(b);
+        pos_.resize(b);
+        order_.resize(b);
+        tokens_.resize(b);
+    }
+
+    const Config& config() const { return config_; }
+    int max_batch() const { return max_batch_; }
+
+    /**
+     * Rows per block in the batched matrix products (see matmul_nt)
+     */
+    void set_matmul_tile(int tile) { tile_ = std::max(1, tile); }
+    int matmul_tile() const { return tile_; }
+
+    /**
+     * Called with the input rows x [batch x w.cols] of every weight matrix
+     * product, e.g. to gather calibration statistics for quantization
+     */
+    using InputObserver = std::function<void(const TensorView& w, const double* x, int batch)>;
+    void set_input_observer(InputObserver observer) { observer_ = std::move(observer); }
+
+    /**
+     * Next-token cross-entropy summed over a batch of sequences
+     * @param sequences Up to max_batch token sequences (inputs followed by the final target)
+     * @param bos Document separator that resets attention and positions, or -1 for none
+     * @return (sum of per-position losses, number of positions)
+     */
+    std::pair<double, size_t> loss(std::span<const std::span<const int>> sequences, int bos = -1) {
+        TraceScope span("nograd.loss", "nograd");
+        const int batch = static_cast<int>(sequences.size());
+        if (batch > max_batch_) {
+            throw std::invalid_argument("Batch larger than max_batch");
+        }
+
+        // Longest first, so the sequences still running at any position form a prefix
+        std::span<int> order(order_.data(), batch);
+        std::iota(order.begin(), order.end(), 0);
+        auto length = [&](int i) {
+            return std::max(0, std::min(config_.block_size, static_cast<int>(sequences[i].size()) - 1));
+        };
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return length(a) > length(b); });
+
+        reset(batch);
+        int* tokens = tokens_.data();
+        double total = 0.0;
+        size_t count = 0;
+        const int longest = batch > 0 ? length(order[0]) : 0;
+        for (int t = 0; t < longest; ++t) {
+            int active = 0;
+            while (active < batch && length(order[active]) > t) {
+                tokens[active] = sequences[order[active]][t];
+                if (t > 0 && tokens[active] == bos) {
+                    kv_len_[active] = 0;
+                    pos_[active] = 0;
+                }
+                ++active;
+            }
+
+            const double* logits = step(tokens, active);
+            for (int r = 0; r < active; ++r) {
+                const int target = sequences[order[r]][t + 1];
+                total += log_sum_exp(logits + static_cast<size_t>(r) * config_.vocab_size)
+                         - logits[static_cast<size_t>(r) * config_.vocab_size + target];
+                ++count;
+            }
+        }
+        return {total, count};
+    }
+
+    /**
+     * Sample n sequences, max_batch at a time, each starting from bos and ending
+     * at the next sampled bos or after block_size positions (see GPT::generate)
+     */
+    std::vector<std::vector<int>> generate(int n, int bos, double temperature = 1.0) {
+        TraceScope span("nograd.generate", "nograd");
+        std::vector<std::vector<int>> samples(n);
+        std::vector<double> probs(config_.vocab_size);
+        std::vector<char> done(max_batch_);
+        for (int first = 0; first < n; first += max_batch_) {
+            const int batch = std::min(max_batch_, n - first);
+            reset(batch);
+            std::fill(tokens_.begin(), tokens_.begin() + batch, bos);
+            std::fill(done.begin(), done.begin() + batch, 0);
+
+            int running = batch;
+            for (int pos = 0; pos < config_.block_size && running > 0; ++pos) {
+                // Finished rows keep stepping in lock-step; their output is ignored
+                const double* logits = step(tokens_.data(), batch);
+                for (int b = 0; b < batch; ++b) {
+                    if (done[b]) {
+                        continue;
+                    }
+                    const double* row = logits + static_cast<size_t>(b) * config_.vocab_size;
+                    const double max_val = *std::max_element(row, row + config_.vocab_size);
+                    for (int i = 0; i < config_.vocab_size; ++i) {
+                        probs[i] = std::exp((row[i] - max_val) / temperature);
+                    }
+                    tokens_[b] = sample_multinomial(probs);
+                    if (tokens_[b] == bos) {
+                        done[b] = 1;
+                        --running;
+                    } else {
+                        samples[first + b].push_back(tokens_[b]);
+                    }
+                }
+            }
+        }
+        return samples;
+    }
+
+    /**
+     * Clear the KV cache of the first batch rows before a new set of sequences
+     */
+    void reset(int batch) {
+        std::fill(kv_len_.begin(), kv_len_.begin() + batch, 0);
+        std::fill(pos_.begin(), pos_.begin() + batch, 0);
+    }
+
+    /**
+     * Advance rows [0, batch) by one token each and return their logits
+     * [batch x vocab_size], valid until the next call
+     */
+    const double* step(const int* tokens, int batch) {
+        const int d = config_.n_embd;
+        for (int b = 0; b < batch; ++b) {
+            if (tokens[b] < 0 || tokens[b] >= config_.vocab_size) {
+                throw std::out_of_range("token_id out of range");
+            }
+            if (pos_[b] >= config_.block_size) {
+                throw std::out_of_range("pos_id out of range");
+            }
+            const double* te = wte_.row(tokens[b]);
+            const double* pe = wpe_.row(pos_[b]);
+            double* xb = x_.data() + static_cast<size_t>(b) * d;
+            for (int i = 0; i < d; ++i) {
+                xb[i] = te[i] + pe[i];
+            }
+            ++pos_[b];
+        }
+        rmsnorm_rows(x_.data(), batch, d);
+
+        for (int li = 0; li < config_.n_layer; ++li) {
+            layer(li, batch);
+        }
+        for (int b = 0; b < batch; ++b) {
+            ++kv_len_[b];
+        }
+
+        matmul(x_.data(), batch, lm_head_, logits_.data());
+        return logits_.data();
+    }
+
+private:
+    struct Layer {
+        TensorView wq, wk, wv, wo, fc1, fc2;
+    };
+
+    Config config_;
+    const FlatWeights& weights_;
+    int max_batch_;
+    int tile_ = 1;
+    InputObserver observer_;
+    std::vector<Layer> layers_;
+    TensorView wte_, wpe_, lm_head_;
+
+    std::vector<double> x_, xn_, q_, k_, v_, attn_, proj_, hidden_, logits_, scores_;
+    std::vector<std::vector<double>> kv_keys_;    // [layer][row][position][n_embd]
+    std::vector<std::vector<double>> kv_values_;
+    std::vector<int> kv_len_;                     // cached positions per row
+    std::vector<int> pos_;                        // next position id per row
+    std::vector<int> order_, tokens_;
+
+    void matmul(const double* x, int batch, const TensorView& w, double* y) {
+        if (observer_) {
+            observer_(w, x, batch);
+        }
+        matmul_nt(x, batch, w, y, tile_);
+    }
+
+    double log_sum_exp(const double* logits_row) const {
+        const int n = config_.vocab_size;
+        const double max_val = *std::max_element(logits_row, logits_row + n);
+        double total = 0.0;
+        for (int i = 0; i < n; ++i) {
+            total += std::exp(logits_row[i] - max_val);
+        }
+        return max_val + std::log(total);
+    }
+
+    void layer(int li, int batch) {
+        const int d = config_.n_embd;
+        const int head_dim = d / config_.n_head;
+        const double scale = std::sqrt(static_cast<double>(head_dim));
+        const Layer& w = layers_[li];
+        const size_t row_stride = static_cast<size_t>(config_.block_size) * d;
+
+        // 1) Multi-head attention
+        std::copy(x_.begin(), x_.begin() + static_cast<size_t>(batch) * d, xn_.begin());
+        rmsnorm_rows(xn_.data(), batch, d);
+        matmul(xn_.data(), batch, w.wq, q_.data());
+        matmul(xn_.data(), batch, w.wk, k_.data());
+        matmul(xn_.data(), batch, w.wv, v_.data());
+
+        for (int b = 0; b < batch; ++b) {
+            double* keys = kv_keys_[li].data() + b * row_stride;
+            double* values = kv_values_[li].data() + b * row_stride;
+            const int t_new = kv_len_[b];
+            std::copy_n(k_.data() + static_cast<size_t>(b) * d, d, keys + static_cast<size_t>(t_new) * d);
+            std::copy_n(v_.data() + static_cast<size_t>(b) * d, d, values + static_cast<size_t>(t_new) * d);
+            const int len = t_new + 1;
+
+            const double* qb = q_.data() + static_cast<size_t>(b) * d;
+            double* out = attn_.data() + static_cast<size_t>(b) * d;
+            for (int h = 0; h < config_.n_head; ++h) {
+                const int hs = h * head_dim;
+                double max_score = -std::numeric_limits<double>::infinity();
+                for (int t = 0; t < len; ++t) {
+                    const double* kt = keys + static_cast<size_t>(t) * d + hs;
+                    double score = 0.0;
+                    for (int j = 0; j < head_dim; ++j) {
+                        score += qb[hs + j] * kt[j];
+                    }
+                    scores_[t] = score / scale;
+                    max_score = std::max(max_score, scores_[t]);
+                }
+                double total = 0.0;
+                for (int t = 0; t < len; ++t) {
+                    scores_[t] = std::exp(scores_[t] - max_score);
+                    total += scores_[t];
+                }
+                for (int j = 0; j < head_dim; ++j) {
+                    out[hs + j] = 0.0;
+                }
+                for (int t = 0; t < len; ++t) {
+                    const double weight = scores_[t] / total;
+                    const double* vt = values + static_cast<size_t>(t) * d + hs;
+                    for (int j = 0; j < head_dim; ++j) {
+                        out[hs + j] += weight * vt[j];
+                    }
+                }
+            }
+        }
+
+        matmul(attn_.data(), batch, w.wo, proj_.data());
+        for (size_t i = 0; i < static_cast<size_t>(batch) * d; ++i) {
+            x_[i] += proj_[i];
+        }
+
+        // 2) MLP block
+        std::copy(x_.begin(), x_.begin() + static_cast<size_t>(batch) * d, xn_.begin());
+        rmsnorm_rows(xn_.data(), batch, d);
+        matmul(xn_.data(), batch, w.fc1, hidden_.data());
+        for (size_t i = 0; i < static_cast<size_t>(batch) * 4 * d; ++i) {
+            const double r = std::max(0.0, hidden_[i]);
+            hidden_[i] = r * r;  // ReLU^2 activation
+        }
+        matmul(hidden_.data(), batch, w.fc2, proj_.data());
+        for (size_t i = 0; i < static_cast<size_t>(batch) * d; ++i) {
+            x_[i] += proj_[i];
+        }
+    }
+};
+
+}  // namespace microgpt
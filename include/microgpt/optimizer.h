@@ -40,6 +40,7 @@ public:
      * @param num_steps Total number of training steps (for cosine schedule)
      */
     void step(const std::vector<Value*>& params, int num_steps) {
+        TraceScope span("adam.step", "optimizer");
         step_count++;
 
         // Cosine learning rate decay
@@ -0,0 +1,74 @@
+#pragma once
+
+/**
+ * Fan-out of I/O-bound work (model file checks, corpus scans) over threads.
+ *
+ * Threads are sized by the bytes the work touches, one per kMinParallelBytes,
+ * so small models and files stay on the calling thread.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace microgpt {
+
+namespace detail {
+
+inline constexpr uint64_t kMinParallelBytes = 1 << 20;  // below this, threads cost more than they save
+
+/**
+ * Threads worth starting for n_tasks tasks over total_bytes: at most n_threads
+ * (0 = hardware concurrency) and n_tasks, at least one
+ */
+inline int parallel_threads(size_t n_tasks, uint64_t total_bytes, int n_threads) {
+    if (n_threads <= 0) {
+        n_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    return static_cast<int>(std::clamp<uint64_t>(total_bytes / kMinParallelBytes, 1,
+                                                 std::min<uint64_t>(n_threads, std::max<size_t>(n_tasks, 1))));
+}
+
+/**
+ * Run fn(i) for every i in [0, n_tasks) on parallel_threads() threads, the
+ * calling thread included. Tasks are claimed dynamically, since their sizes
+ * vary widely; the first exception is rethrown once all threads have stopped.
+ */
+template <typename Fn>
+void parallel_for(size_t n_tasks, uint64_t total_bytes, int n_threads, Fn fn) {
+    n_threads = parallel_threads(n_tasks, total_bytes, n_threads);
+
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    auto work = [&] {
+        for (size_t i = next++; i < n_tasks && !failed; i = next++) {
+            try {
+                fn(i);
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int t = 1; t < n_threads; ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto& w : workers) {
+        w.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace detail
+
+}  // namespace microgpt
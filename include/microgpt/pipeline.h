@@ -0,0 +1,388 @@
+#pragma once
+
+/**
+ * Pipeline-parallel training across transformer layers.
+ *
+ * The layers of a GPT are partitioned into contiguous stages. Each stage runs
+ * on its own thread, owns the parameters of its layers (stage 0 also owns the
+ * embeddings, the last stage the lm_head) and keeps its own ValueStorage per
+ * in-flight micro-batch. Micro-batches flow through the stages in a 1F1B
+ * schedule; activations go forward and gradients go backward through bounded
+ * queues as plain doubles, so no graph node is ever shared between threads.
+ */
+
+#include "model.h"
+#include "optimizer.h"
+#include "value.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Blocking FIFO with a fixed capacity, used to hand activations and gradients
+ * between pipeline stages. close() wakes every waiter so a failing stage can
+ * unblock its neighbours.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {
+        if (capacity_ == 0) {
+            throw std::invalid_argument("BoundedQueue capacity must be positive");
+        }
+    }
+
+    void push(T item) {
+        std::unique_lock lock(mutex_);
+        not_full_.wait(lock, [&] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            throw std::runtime_error("push on closed queue");
+        }
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+
+    T pop() {
+        std::unique_lock lock(mutex_);
+        not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            throw std::runtime_error("pop on closed queue");
+        }
+        T item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return item;
+    }
+
+    void close() {
+        std::lock_guard lock(mutex_);
+        closed_ = true;
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+/**
+ * Timing of the most recent pipelined step
+ */
+struct PipelineStats {
+    int n_stages = 0;
+    int n_micro_batches = 0;
+    int tokens = 0;                    // positions trained on
+    double wall_seconds = 0.0;         // fill + steady state + drain, excluding the optimizer
+    double bubble_fraction = 0.0;      // 1 - busy / (n_stages * wall)
+    std::vector<double> stage_busy;    // seconds each stage spent computing
+
+    double tokens_per_second() const {
+        return wall_seconds > 0.0 ? tokens / wall_seconds : 0.0;
+    }
+};
+
+/**
+ * Trains a GPT with its layers split into pipeline stages.
+ *
+ * One call to train_step() consumes a list of micro-batches (token sequences),
+ * accumulates gradients over all of them and applies a single optimizer step,
+ * so the result is independent of the number of stages. With one stage the
+ * step runs inline on the calling thread, which is the single-threaded baseline.
+ */
+class PipelineTrainer {
+public:
+    PipelineTrainer(GPT& model, int n_stages) : model_(model) {
+        if (n_stages <= 0) {
+            throw std::invalid_argument("n_stages must be positive");
+        }
+        n_stages_ = std::min(n_stages, model_.config.n_layer);
+
+        // Contiguous, evenly sized layer ranges
+        for (int s = 0; s <= n_stages_; ++s) {
+            layer_bounds_.push_back(s * model_.config.n_layer / n_stages_);
+        }
+    }
+
+    int n_stages() const { return n_stages_; }
+
+    // First layer owned by stage s; stage s owns [first_layer(s), first_layer(s + 1))
+    int first_layer(int s) const { return layer_bounds_[s]; }
+
+    const PipelineStats& stats() const { return stats_; }
+
+    /**
+     * Forward and backward over all micro-batches, then one optimizer step
+     * @param micro_batches Token sequences (BOS-delimited, as from Tokenizer::encode)
+     * @param optimizer Adam optimizer, already initialised for all model parameters
+     * @param total_steps Total number of training steps (for cosine schedule)
+     * @return mean loss over the micro-batches
+     */
+    double train_step(const std::vector<std::span<const int>>& micro_batches, Adam& optimizer, int total_steps) {
+        const int n_mb = static_cast<int>(micro_batches.size());
+        if (n_mb == 0) {
+            return 0.0;
+        }
+        for (const auto& mb : micro_batches) {
+            if (std::min(model_.config.block_size, static_cast<int>(mb.size()) - 1) <= 0) {
+                throw std::invalid_argument("Micro-batch needs at least two tokens");
+            }
+        }
+
+        micro_batches_ = &micro_batches;
+        loss_sum_ = 0.0;
+        stats_ = PipelineStats{};
+        stats_.n_stages = n_stages_;
+        stats_.n_micro_batches = n_mb;
+        stats_.stage_busy.assign(n_stages_, 0.0);
+        for (int mb = 0; mb < n_mb; ++mb) {
+            stats_.tokens += positions(mb);
+        }
+
+        // Between neighbouring stages at most n_stages micro-batches are in flight under 1F1B
+        forward_queues_.clear();
+        backward_queues_.clear();
+        for (int s = 0; s + 1 < n_stages_; ++s) {
+            forward_queues_.push_back(std::make_unique<BoundedQueue<Message>>(n_stages_));
+            backward_queues_.push_back(std::make_unique<BoundedQueue<Message>>(n_stages_));
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        if (n_stages_ == 1) {
+            run_stage(0);
+        } else {
+            std::vector<std::exception_ptr> errors(n_stages_);
+            std::vector<std::thread> threads;
+            threads.reserve(n_stages_);
+            for (int s = 0; s < n_stages_; ++s) {
+                threads.emplace_back([this, s, &errors] {
+                    trace_thread_name("pipeline stage " + std::to_string(s));
+                    try {
+                        run_stage(s);
+                    } catch (...) {
+                        errors[s] = std::current_exception();
+                        close_queues();
+                    }
+                });
+            }
+            for (auto& t : threads) {
+                t.join();
+            }
+            for (auto& e : errors) {
+                if (e) {
+                    optimizer.zero_grad(model_.state_dict.get_all_params());
+                    std::rethrow_exception(e);
+                }
+            }
+        }
+        stats_.wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double busy = 0.0;
+        for (double b : stats_.stage_busy) {
+            busy += b;
+        }
+        if (stats_.wall_seconds > 0.0) {
+            stats_.bubble_fraction = std::max(0.0, 1.0 - busy / (n_stages_ * stats_.wall_seconds));
+        }
+
+        // Gradients of every stage are complete once all threads joined
+        optimizer.step(model_.state_dict.get_all_params(), total_steps);
+
+        return loss_sum_;
+    }
+
+private:
+    // Activations (forward) or gradients (backward) for one micro-batch, n positions x n_embd
+    struct Message {
+        int micro_batch = -1;
+        std::vector<double> data;
+    };
+
+    // Graph state a stage keeps between the forward and backward of one micro-batch
+    struct InFlight {
+        std::unique_ptr<ValueStorage> storage;
+        std::vector<std::vector<Value*>> inputs;   // leaves fed from the previous stage
+        std::vector<std::vector<Value*>> outputs;  // hidden states handed to the next stage
+        Value* loss = nullptr;                     // last stage only
+    };
+
+    GPT& model_;
+    int n_stages_;
+    std::vector<int> layer_bounds_;
+    const std::vector<std::span<const int>>* micro_batches_ = nullptr;
+    std::vector<std::unique_ptr<BoundedQueue<Message>>> forward_queues_;   // s -> s + 1
+    std::vector<std::unique_ptr<BoundedQueue<Message>>> backward_queues_;  // s + 1 -> s
+    double loss_sum_ = 0.0;  // written by the last stage only
+    PipelineStats stats_;
+
+    void close_queues() {
+        for (auto& q : forward_queues_) q->close();
+        for (auto& q : backward_queues_) q->close();
+    }
+
+    int positions(int mb) const {
+        const auto& tokens = (*micro_batches_)[mb];
+        return std::min(model_.config.block_size, static_cast<int>(tokens.size()) - 1);
+    }
+
+    /**
+     * 1F1B schedule for one stage: warm up with (n_stages - s - 1) forwards,
+     * then alternate one forward and one backward, then drain the backwards.
+     */
+    void run_stage(int s) {
+        const int n_mb = static_cast<int>(micro_batches_->size());
+        const int warmup = std::min(n_stages_ - s - 1, n_mb);
+        std::map<int, InFlight> in_flight;
+        double busy = 0.0;
+
+        int next_forward = 0;
+        int next_backward = 0;
+        for (int i = 0; i < warmup; ++i) {
+            forward_micro_batch(s, next_forward++, in_flight, busy);
+        }
+        while (next_forward < n_mb) {
+            forward_micro_batch(s, next_forward++, in_flight, busy);
+            backward_micro_batch(s, next_backward++, in_flight, busy);
+        }
+        while (next_backward < n_mb) {
+            backward_micro_batch(s, next_backward++, in_flight, busy);
+        }
+
+        stats_.stage_busy[s] = busy;
+    }
+
+    void forward_micro_batch(int s, int mb, std::map<int, InFlight>& in_flight, double& busy) {
+        TraceScope span("stage.forward", "pipeline", "micro_batch", mb);
+        const int n_embd = model_.config.n_embd;
+        const int n = positions(mb);
+
+        Message in;
+        if (s > 0) {
+            in = forward_queues_[s - 1]->pop();
+            if (in.micro_batch != mb) {
+                throw std::runtime_error("Pipeline received micro-batches out of order");
+            }
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        InFlight& state = in_flight[mb];
+        state.storage = std::make_unique<ValueStorage>();
+        ValueStorage& storage = *state.storage;
+
+        const int layer_begin = layer_bounds_[s];
+        const int layer_end = layer_bounds_[s + 1];
+        std::vector<std::vector<std::vector<Value*>>> keys(layer_end - layer_begin);
+        std::vector<std::vector<std::vector<Value*>>> values(layer_end - layer_begin);
+
+        const auto& tokens = (*micro_batches_)[mb];
+        std::vector<Value*> losses;
+        for (int pos_id = 0; pos_id < n; ++pos_id) {
+            std::vector<Value*> x;
+            if (s == 0) {
+                x = model_.embed(tokens[pos_id], pos_id, storage);
+            } else {
+                x.reserve(n_embd);
+                for (int i = 0; i < n_embd; ++i) {
+                    x.push_back(storage.constant(in.data[pos_id * n_embd + i]));
+                }
+                state.inputs.push_back(x);
+            }
+
+            for (int li = layer_begin; li < layer_end; ++li) {
+                x = model_.layer_forward(li, x, keys[li - layer_begin], values[li - layer_begin], storage);
+            }
+
+            if (s + 1 < n_stages_) {
+                state.outputs.push_back(std::move(x));
+            } else {
+                auto probs = softmax(model_.project_logits(x, storage), storage);
+                losses.push_back(storage.neg(storage.log(probs[tokens[pos_id + 1]])));
+            }
+        }
+
+        if (s + 1 == n_stages_) {
+            // Mean over positions, scaled so gradients average over micro-batches
+            Value* loss = storage.constant(0.0);
+            for (auto* l : losses) {
+                loss = storage.add(loss, l);
+            }
+            const int n_mb = static_cast<int>(micro_batches_->size());
+            state.loss = storage.div(loss, static_cast<double>(n) * n_mb);
+            loss_sum_ += state.loss->data;
+        }
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (s + 1 < n_stages_) {
+            Message out{mb, std::vector<double>(static_cast<size_t>(n) * n_embd)};
+            for (int pos_id = 0; pos_id < n; ++pos_id) {
+                for (int i = 0; i < n_embd; ++i) {
+                    out.data[pos_id * n_embd + i] = state.outputs[pos_id][i]->data;
+                }
+            }
+            forward_queues_[s]->push(std::move(out));
+        }
+    }
+
+    void backward_micro_batch(int s, int mb, std::map<int, InFlight>& in_flight, double& busy) {
+        TraceScope span("stage.backward", "pipeline", "micro_batch", mb);
+        const int n_embd = model_.config.n_embd;
+        const int n = positions(mb);
+
+        Message grad_in;
+        if (s + 1 < n_stages_) {
+            grad_in = backward_queues_[s]->pop();
+            if (grad_in.micro_batch != mb) {
+                throw std::runtime_error("Pipeline received gradients out of order");
+            }
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        InFlight& state = in_flight.at(mb);
+        if (s + 1 == n_stages_) {
+            state.loss->backward();
+        } else {
+            std::vector<Value*> roots;
+            roots.reserve(static_cast<size_t>(n) * n_embd);
+            for (int pos_id = 0; pos_id < n; ++pos_id) {
+                for (int i = 0; i < n_embd; ++i) {
+                    Value* out = state.outputs[pos_id][i];
+                    out->grad += grad_in.data[pos_id * n_embd + i];
+                    roots.push_back(out);
+                }
+            }
+            Value::backward_from(roots);
+        }
+
+        Message grad_out;
+        if (s > 0) {
+            grad_out = Message{mb, std::vector<double>(static_cast<size_t>(n) * n_embd)};
+            for (int pos_id = 0; pos_id < n; ++pos_id) {
+                for (int i = 0; i < n_embd; ++i) {
+                    grad_out.data[pos_id * n_embd + i] = state.inputs[pos_id][i]->grad;
+                }
+            }
+        }
+        in_flight.erase(mb);
+        busy += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (s > 0) {
+            backward_queues_[s - 1]->push(std::move(grad_out));
+        }
+    }
+};
+
+}  // namespace microgpt
@@ -0,0 +1,172 @@
+#pragma once
+
+/**
+ * Opt-in graph profiling: nodes, bytes and backward time per op type and
+ * model region, collected by ValueStorage and Value::backward.
+ *
+ * Compiled out unless MICROGPT_PROFILE is 1 (cmake -DMICROGPT_PROFILE=ON).
+ * Then every stored node records its op and the region active in its storage,
+ * and backward times each node's gradient propagation. The per-node clock
+ * reads make a profiled backward several times slower; their calibrated cost
+ * is subtracted, so the times show how the work divides, not absolute speed.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#ifndef MICROGPT_PROFILE
+#define MICROGPT_PROFILE 0
+#endif
+
+namespace microgpt {
+
+/**
+ * Node-creating ValueStorage ops; sub, neg and div are built from these
+ */
+enum class Op : uint8_t { constant, add, mul, pow, exp, log, relu, other, count };
+
+/**
+ * Parts of the model a node can be attributed to
+ */
+enum class Region : uint8_t { other, embedding, attention, mlp, lm_head, loss, count };
+
+inline const char* op_name(Op op) {
+    static constexpr const char* names[] = {"constant", "add", "mul", "pow", "exp", "log", "relu", "other"};
+    return names[static_cast<size_t>(op)];
+}
+
+inline const char* region_name(Region region) {
+    static constexpr const char* names[] = {"other", "embedding", "attention", "mlp", "lm_head", "loss"};
+    return names[static_cast<size_t>(region)];
+}
+
+/**
+ * Counters for one region and op
+ */
+struct OpCounters {
+    size_t nodes = 0;          // nodes created
+    size_t bytes = 0;          // their footprint (Value::footprint)
+    size_t backward_nodes = 0; // nodes visited by backward
+    double backward_ns = 0.0;  // time propagating their gradients
+};
+
+/**
+ * Counters for every region and op, accumulated until reset()
+ */
+struct GraphProfile {
+    static constexpr size_t kRegions = static_cast<size_t>(Region::count);
+    static constexpr size_t kOps = static_cast<size_t>(Op::count);
+
+    std::array<std::array<OpCounters, kOps>, kRegions> counters{};
+    double topo_ns = 0.0;  // topological sorts in backward, not attributable to an op
+
+    OpCounters& at(Region region, Op op) {
+        return counters[static_cast<size_t>(region)][static_cast<size_t>(op)];
+    }
+    const OpCounters& at(Region region, Op op) const {
+        return counters[static_cast<size_t>(region)][static_cast<size_t>(op)];
+    }
+
+    // Sum over all ops of a region
+    OpCounters region_total(Region region) const {
+        OpCounters total;
+        for (const auto& c : counters[static_cast<size_t>(region)]) {
+            total.nodes += c.nodes;
+            total.bytes += c.bytes;
+            total.backward_nodes += c.backward_nodes;
+            total.backward_ns += c.backward_ns;
+        }
+        return total;
+    }
+
+    // Sum over all regions of an op
+    OpCounters op_total(Op op) const {
+        OpCounters total;
+        for (size_t r = 0; r < kRegions; ++r) {
+            const auto& c = counters[r][static_cast<size_t>(op)];
+            total.nodes += c.nodes;
+            total.bytes += c.bytes;
+            total.backward_nodes += c.backward_nodes;
+            total.backward_ns += c.backward_ns;
+        }
+        return total;
+    }
+
+    void reset() { *this = GraphProfile{}; }
+
+    /**
+     * Per-region totals, then per-op totals, then every non-empty region/op
+     * pair, with each row's share of all nodes and of backward time
+     */
+    void print(std::ostream& out) const {
+        OpCounters all;
+        for (size_t r = 0; r < kRegions; ++r) {
+            const auto c = region_total(static_cast<Region>(r));
+            all.nodes += c.nodes;
+            all.backward_ns += c.backward_ns;
+        }
+        auto row = [&](const std::string& label, const OpCounters& c) {
+            if (c.nodes == 0 && c.backward_nodes == 0) {
+                return;
+            }
+            out << std::left << std::setw(22) << label << std::right << std::setw(10) << c.nodes << std::fixed
+                << std::setprecision(1) << std::setw(8) << (all.nodes ? 100.0 * c.nodes / all.nodes : 0.0)
+                << std::setw(12) << c.bytes / 1024.0 << std::setprecision(3) << std::setw(12)
+                << c.backward_ns / 1e6 << std::setprecision(1) << std::setw(8)
+                << (all.backward_ns > 0.0 ? 100.0 * c.backward_ns / all.backward_ns : 0.0) << std::defaultfloat
+                << std::endl;
+        };
+        auto header = [&](const char* title) {
+            out << std::left << std::setw(22) << title << std::right << std::setw(10) << "nodes" << std::setw(8)
+                << "%" << std::setw(12) << "KiB" << std::setw(12) << "bwd ms" << std::setw(8) << "%" << std::endl;
+        };
+
+        header("region");
+        for (size_t r = 0; r < kRegions; ++r) {
+            row(region_name(static_cast<Region>(r)), region_total(static_cast<Region>(r)));
+        }
+        out << std::endl;
+        header("op");
+        for (size_t o = 0; o < kOps; ++o) {
+            row(op_name(static_cast<Op>(o)), op_total(static_cast<Op>(o)));
+        }
+        out << std::endl;
+        header("region/op");
+        for (size_t r = 0; r < kRegions; ++r) {
+            for (size_t o = 0; o < kOps; ++o) {
+                row(std::string(region_name(static_cast<Region>(r))) + "/" + op_name(static_cast<Op>(o)),
+                    counters[r][o]);
+            }
+        }
+        out << std::fixed << std::setprecision(3) << "topological sort: " << topo_ns / 1e6 << " ms"
+            << std::defaultfloat << std::endl;
+    }
+};
+
+namespace detail {
+
+/**
+ * Cost of one steady_clock read, measured once, subtracted from per-node times
+ */
+inline double clock_overhead_ns() {
+    static const double overhead = [] {
+        double best = 1e9;
+        for (int i = 0; i < 1000; ++i) {
+            const auto t0 = std::chrono::steady_clock::now();
+            const auto t1 = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::nano>(t1 - t0).count());
+        }
+        return best;
+    }();
+    return overhead;
+}
+
+}  // namespace detail
+
+}  // namespace microgpt
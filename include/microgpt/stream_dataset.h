@@ -0,0 +1,418 @@
+#pragma once
+
+/**
+ * Streaming dataset reader for corpora larger than RAM.
+ *
+ * Documents are read from one or many shards, each either a text file (one
+ * document per line) or a pre-tokenized TokenDataset file, detected by its
+ * magic. Text is read in large blocks with several reads in flight, running
+ * ahead into the epoch's next shards; nothing but the current shuffle window
+ * and the read-ahead buffers is ever held in memory.
+ *
+ * Shuffling is approximate: every epoch visits the shards in a fresh random
+ * order, and each shard is consumed in windows of shuffle_buffer consecutive
+ * documents that are emitted in a random order. Both permutations are pure
+ * functions of (seed, epoch, shard, window start), so a StreamCursor pins the
+ * stream exactly and resuming from it replays the same documents.
+ */
+
+#include "async_reader.h"
+#include "token_dataset.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * Position in the stream: the shard (index into the epoch's shard order), the
+ * byte offset (text) or document index (binary) where the current window
+ * starts in it, and how many documents of that window were already returned
+ */
+struct StreamCursor {
+    uint64_t epoch = 0;
+    uint64_t shard = 0;
+    uint64_t offset = 0;
+    uint64_t consumed = 0;
+};
+
+/**
+ * Streaming reader configuration
+ */
+struct StreamOptions {
+    size_t shuffle_buffer = 4096;   // documents per shuffle window (1 = no shuffling)
+    bool shuffle = true;            // permute shard order and window contents
+    uint64_t seed = 42;
+    size_t read_block = 1 << 20;    // bytes per read of text shards
+    int read_ahead = 8;             // text reads in flight
+    bool io_uring = true;           // io_uring when available, else pread threads
+
+    AsyncReadOptions io() const {
+        return {.block_size = read_block, .queue_depth = read_ahead, .use_io_uring = io_uring};
+    }
+};
+
+/**
+ * Line reader over one or several text files, fed by an AsyncShardReader so
+ * the next blocks are already being read while lines are tokenized. Lines are
+ * trimmed like load_docs; blank lines are skipped. Lines that fit in a block
+ * are returned as views into it; only lines spanning two blocks are copied.
+ */
+class TextShardReader {
+public:
+    /**
+     * @param paths Text shards, read in order
+     * @param offset Byte offset to start at in the first shard
+     * @param io Block size, read-ahead depth and I/O backend
+     */
+    TextShardReader(std::vector<std::string> paths, uint64_t offset = 0, AsyncReadOptions io = {})
+        : reader_(std::move(paths), io, offset) {}
+
+    TextShardReader(const std::string& path, uint64_t offset, AsyncReadOptions io = {})
+        : TextShardReader(std::vector<std::string>{path}, offset, io) {}
+
+    /**
+     * Next non-blank trimmed line, valid until the following call
+     * @param end_offset Set to the offset just past the line in its shard
+     * @return false at the end of the last shard
+     */
+    bool next(std::string_view& line, uint64_t& end_offset) {
+        carry_.clear();
+        while (true) {
+            if (!have_block_) {
+                if (!reader_.next(block_)) {
+                    return false;
+                }
+                have_block_ = true;
+                pos_ = 0;
+            }
+
+            const std::span<const char> data = block_.data;
+            const char* begin = data.data() + pos_;
+            const char* nl = static_cast<const char*>(std::memchr(begin, '\n', data.size() - pos_));
+            std::string_view raw;
+            if (nl != nullptr) {
+                pos_ = static_cast<size_t>(nl - data.data()) + 1;
+                if (carry_.empty()) {
+                    raw = std::string_view(begin, static_cast<size_t>(nl - begin));
+                } else {
+                    carry_.append(begin, nl);
+                    raw = carry_;
+                }
+            } else {
+                // Line continues in the next block, or is the shard's last line without newline
+                carry_.append(begin, data.data() + data.size());
+                pos_ = data.size();
+                have_block_ = false;
+                if (!block_.shard_end) {
+                    continue;
+                }
+                raw = carry_;
+            }
+
+            shard_ = block_.shard;
+            end_offset = block_.offset + pos_;
+            const size_t first = raw.find_first_not_of(" \t\r\n");
+            if (first == std::string_view::npos) {
+                carry_.clear();
+                continue;
+            }
+            line = raw.substr(first, raw.find_last_not_of(" \t\r\n") - first + 1);
+            return true;
+        }
+    }
+
+    /**
+     * Index (into the constructor's paths) of the shard the last line came from
+     */
+    size_t shard() const { return shard_; }
+
+    /**
+     * "io_uring" or "pread"
+     */
+    const char* backend() const { return reader_.backend(); }
+
+private:
+    AsyncShardReader reader_;
+    AsyncShardReader::Block block_;
+    bool have_block_ = false;
+    size_t pos_ = 0;              // next unread byte in block_
+    std::string carry_;           // start of a line that spans blocks
+    size_t shard_ = 0;
+};
+
+/**
+ * Tokenizer fitted on text shards in one streaming pass (same result as
+ * Tokenizer::fit on the concatenated documents)
+ */
+inline Tokenizer fit_tokenizer_streaming(const std::vector<std::string>& shards, AsyncReadOptions io = {}) {
+    bool seen[256] = {};
+    TextShardReader reader(shards, 0, io);
+    std::string_view line;
+    uint64_t end = 0;
+    while (reader.next(line, end)) {
+        for (char c : line) {
+            seen[static_cast<unsigned char>(c)] = true;
+        }
+    }
+    // Tokenizer::fit orders characters by char value
+    std::vector<std::string> alphabet(1);
+    for (int c = 0; c < 256; ++c) {
+        if (seen[c]) {
+            alphabet[0].push_back(static_cast<char>(c));
+        }
+    }
+    Tokenizer tokenizer;
+    tokenizer.fit(alphabet);
+    return tokenizer;
+}
+
+/**
+ * Sequential, approximately shuffled reader over shards, looping over epochs.
+ *
+ * Memory use is one shuffle window of tokenized documents plus one read block,
+ * independent of the corpus size.
+ */
+class StreamingDataset {
+public:
+    /**
+     * @param shards Text or TokenDataset files
+     * @param tokenizer Tokenizer for text shards (binary shards carry their own;
+     *                  nullptr uses the first binary shard's)
+     * @param options Reader options
+     * @param start Cursor to resume from
+     */
+    StreamingDataset(std::vector<std::string> shards, const Tokenizer* tokenizer = nullptr,
+                     StreamOptions options = {}, StreamCursor start = {})
+        : shards_(std::move(shards)), options_(options), cursor_(start) {
+        if (shards_.empty()) {
+            throw std::invalid_argument("StreamingDataset needs at least one shard");
+        }
+        options_.shuffle_buffer = std::max<size_t>(options_.shuffle_buffer, 1);
+        binary_.reserve(shards_.size());
+        for (const auto& path : shards_) {
+            binary_.push_back(is_token_dataset(path));
+        }
+        if (tokenizer != nullptr) {
+            tokenizer_ = *tokenizer;
+        } else {
+            const auto first = std::find(binary_.begin(), binary_.end(), true);
+            if (first == binary_.end()) {
+                throw std::invalid_argument("StreamingDataset over text shards needs a tokenizer");
+            }
+            tokenizer_ = TokenDataset(shards_[first - binary_.begin()]).tokenizer();
+        }
+        if (cursor_.shard >= shards_.size()) {
+            throw std::invalid_argument("StreamCursor shard out of range");
+        }
+        window_start_ = cursor_.offset;
+        load_window();
+        if (cursor_.consumed > window_size()) {
+            throw std::invalid_argument("StreamCursor is past the end of its window");
+        }
+    }
+
+    const Tokenizer& tokenizer() const { return tokenizer_; }
+
+    /**
+     * Next document as tokens (BOS ... BOS), valid until the following call
+     */
+    std::span<const int> next() {
+        // Move past exhausted windows; only a shard's last window can be empty,
+        // so more empty windows than shards in a row means there are no documents
+        size_t empty_windows = 0;
+        while (cursor_.consumed >= window_size()) {
+            if (window_size() == 0 && ++empty_windows > shards_.size()) {
+                throw std::runtime_error("StreamingDataset shards contain no documents");
+            }
+            if (shard_done_) {
+                if (++cursor_.shard == shards_.size()) {
+                    cursor_.shard = 0;
+                    ++cursor_.epoch;
+                }
+                window_start_ = 0;
+            } else {
+                window_start_ = window_end_;
+            }
+            cursor_.offset = window_start_;
+            cursor_.consumed = 0;
+            load_window();
+        }
+
+        const uint32_t i = order_[cursor_.consumed++];
+        return std::span<const int>(tokens_).subspan(offsets_[i], offsets_[i + 1] - offsets_[i]);
+    }
+
+    /**
+     * Position after the most recently returned document
+     */
+    StreamCursor cursor() const {
+        return cursor_;
+    }
+
+private:
+    std::vector<std::string> shards_;
+    std::vector<bool> binary_;       // per shard: TokenDataset file (else text)
+    Tokenizer tokenizer_;
+    StreamOptions options_;
+    StreamCursor cursor_;
+    std::unique_ptr<TokenDataset> dataset_;  // mapping of the binary shard being read
+    size_t dataset_shard_ = SIZE_MAX;
+
+    // Text reader over the rest of the epoch's text shards, kept across windows
+    // so its read-ahead is not thrown away. It is reused when the next window
+    // starts where the reader stands; the line read past a window waits in peek_.
+    std::unique_ptr<TextShardReader> text_reader_;
+    std::vector<size_t> text_shards_;   // reader shard index -> dataset shard
+    uint64_t text_epoch_ = 0;
+    size_t text_shard_ = SIZE_MAX;      // where the reader stands: shard and offset
+    uint64_t text_offset_ = 0;
+    bool has_peek_ = false;
+    std::string peek_;
+    uint64_t peek_end_ = 0;
+
+    std::vector<int> tokens_;        // current window, tokenized back to back
+    std::vector<size_t> offsets_;    // document i is tokens_[offsets_[i], offsets_[i + 1])
+    std::vector<uint32_t> order_;    // emission order within the window
+    uint64_t window_start_ = 0;
+    uint64_t window_end_ = 0;        // where the next window of this shard starts
+    bool shard_done_ = false;        // the window reached the end of its shard
+
+    size_t window_size() const {
+        return offsets_.empty() ? 0 : offsets_.size() - 1;
+    }
+
+    static uint64_t mix(uint64_t a, uint64_t b) {
+        return (a ^ (b + 0x9E3779B97F4A7C15ULL + (a << 6) + (a >> 2)));
+    }
+
+    // Shard order of cursor_.epoch
+    std::vector<size_t> shard_order() const {
+        std::vector<size_t> order(shards_.size());
+        std::iota(order.begin(), order.end(), 0);
+        if (options_.shuffle) {
+            std::mt19937_64 rng(mix(options_.seed, cursor_.epoch));
+            std::shuffle(order.begin(), order.end(), rng);
+        }
+        return order;
+    }
+
+    // Shard visited at position cursor_.shard of cursor_.epoch
+    size_t shard_index() const {
+        return shard_order()[cursor_.shard];
+    }
+
+    // Text reader from window_start_ over this and the epoch's following text shards
+    void open_text_reader() {
+        const std::vector<size_t> order = shard_order();
+        std::vector<std::string> paths;
+        text_shards_.clear();
+        for (size_t pos = cursor_.shard; pos < order.size(); ++pos) {
+            if (!binary_[order[pos]]) {
+                text_shards_.push_back(order[pos]);
+                paths.push_back(shards_[order[pos]]);
+            }
+        }
+        has_peek_ = false;
+        text_reader_.reset();  // release the old read-ahead buffers first
+        text_reader_ = std::make_unique<TextShardReader>(std::move(paths), window_start_, options_.io());
+        text_epoch_ = cursor_.epoch;
+        text_shard_ = text_shards_.front();
+        text_offset_ = window_start_;
+    }
+
+    // Next line of the text reader (or the line peeked past the last window)
+    bool next_text_line(std::string_view& line, uint64_t& end, size_t& shard) {
+        if (has_peek_) {
+            has_peek_ = false;
+            line = peek_;
+            end = peek_end_;
+            shard = text_shard_;
+            return true;
+        }
+        if (!text_reader_->next(line, end)) {
+            return false;
+        }
+        shard = text_shards_[text_reader_->shard()];
+        return true;
+    }
+
+    // Read up to shuffle_buffer documents starting at window_start_ and permute them
+    void load_window() {
+        TraceScope span("stream.load_window", "data");
+        tokens_.clear();
+        offsets_.assign(1, 0);
+        const size_t shard = shard_index();
+        const std::string& path = shards_[shard];
+
+        if (binary_[shard]) {
+            if (dataset_shard_ != shard) {
+                dataset_ = std::make_unique<TokenDataset>(path);
+                dataset_shard_ = shard;
+                if (dataset_->header().vocab_size != static_cast<uint32_t>(tokenizer_.vocab_size) ||
+                    dataset_->bos() != tokenizer_.BOS) {
+                    throw std::runtime_error("Shard tokenizer does not match the stream's: " + path);
+                }
+                dataset_->file().advise(MADV_SEQUENTIAL);
+            }
+            const TokenDataset& dataset = *dataset_;
+            const uint64_t end = std::min<uint64_t>(dataset.size(), window_start_ + options_.shuffle_buffer);
+            for (uint64_t d = window_start_; d < end; ++d) {
+                dataset.append_doc(d, tokens_);
+                offsets_.push_back(tokens_.size());
+            }
+            window_end_ = end;
+            shard_done_ = end == dataset.size();
+        } else {
+            if (!text_reader_ || text_epoch_ != cursor_.epoch || text_shard_ != shard ||
+                text_offset_ != window_start_) {
+                open_text_reader();
+            }
+            std::string_view line;
+            uint64_t end = window_start_;
+            uint64_t line_end = 0;
+            size_t line_shard = 0;
+            bool more = false;
+            while (next_text_line(line, line_end, line_shard)) {
+                if (line_shard != shard || window_size() == options_.shuffle_buffer) {
+                    more = true;  // first line past this window
+                    break;
+                }
+                tokenizer_.encode_into(line, tokens_);
+                offsets_.push_back(tokens_.size());
+                end = line_end;
+            }
+            // The shard is done once nothing but blank lines remains in it
+            shard_done_ = !more || line_shard != shard;
+            window_end_ = end;
+            if (more) {
+                peek_.assign(line);
+                peek_end_ = line_end;
+                has_peek_ = true;
+                text_shard_ = line_shard;
+                text_offset_ = shard_done_ ? 0 : end;
+            } else {
+                text_reader_.reset();
+            }
+        }
+
+        order_.resize(window_size());
+        std::iota(order_.begin(), order_.end(), 0u);
+        if (options_.shuffle) {
+            std::mt19937_64 rng(mix(mix(mix(options_.seed, cursor_.epoch), shard), window_start_));
+            std::shuffle(order_.begin(), order_.end(), rng);
+        }
+    }
+};
+
+}  // namespace microgpt
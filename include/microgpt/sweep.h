@@ -0,0 +1,334 @@
+#pragma once
+
+/**
+ * Population-based hyperparameter sweeps.
+ *
+ * Tiny models leave most cores idle, so a sweep trains a population of GPT
+ * instances side by side on a worker pool. Every member reads the same
+ * read-only tokenized dataset. After each exploit interval the weakest members
+ * copy the weights and optimizer state of a stronger member with the same
+ * Config and continue from there with a perturbed learning rate.
+ */
+
+#include "data_loader.h"
+#include "evaluator.h"
+#include "model.h"
+#include "nograd.h"
+#include "optimizer.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <ostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace microgpt {
+
+/**
+ * One member of the population: a model shape and its optimizer settings
+ */
+struct TrialSpec {
+    std::string name;
+    Config config;
+    double learning_rate = 1e-2;
+    double beta1 = 0.9;
+    double beta2 = 0.95;
+    double eps = 1e-8;
+};
+
+/**
+ * Sweep configuration
+ */
+struct SweepOptions {
+    int total_steps = 500;        // training steps per member
+    int exploit_interval = 50;    // steps between exploit/explore rounds (0 = plain grid search)
+    int n_workers = 0;            // worker threads (0 = hardware concurrency)
+    double truncation = 0.25;     // bottom share of the population replaced each round
+    double perturb = 1.2;         // explored learning rates are multiplied or divided by this
+    uint64_t seed = 42;
+};
+
+/**
+ * Final state of one member
+ */
+struct TrialResult {
+    std::string name;
+    Config config;
+    double learning_rate = 0.0;   // after any perturbations
+    double train_loss = 0.0;      // mean training loss over the last interval
+    double val_loss = 0.0;        // 0 when no validation set was given
+    int steps = 0;
+    int exploited = 0;            // times this member was overwritten by a winner
+    std::string lineage;          // members copied from, in order
+    double seconds = 0.0;         // training time summed over intervals
+};
+
+/**
+ * Trains a population concurrently with periodic exploit/explore.
+ *
+ * The datasets are referenced, not copied, and must outlive the sweep. Members
+ * are initialized on the calling thread in spec order, so a sweep is
+ * reproducible for a given global seed regardless of the worker count.
+ */
+class PopulationSweep {
+public:
+    /**
+     * @param specs Population members; vocab_size of every Config must match the dataset
+     * @param train Shared tokenized training set
+     * @param val Optional held-out set used as fitness (nullptr = mean training loss)
+     * @param options Sweep options
+     */
+    PopulationSweep(std::vector<TrialSpec> specs, const TokenizedDocs& train, const TokenizedDocs* val = nullptr,
+                    SweepOptions options = {})
+        : train_(train), val_(val), options_(options), rng_(options.seed) {
+        if (specs.empty()) {
+            throw std::invalid_argument("PopulationSweep needs at least one trial");
+        }
+        if (train_.size() == 0) {
+            throw std::invalid_argument("PopulationSweep needs a non-empty training set");
+        }
+        if (options_.total_steps <= 0) {
+            throw std::invalid_argument("PopulationSweep total_steps must be positive");
+        }
+
+        members_.reserve(specs.size());
+        for (size_t i = 0; i < specs.size(); ++i) {
+            auto member = std::make_unique<Member>(specs[i]);
+            member->params = member->model.state_dict.get_all_params();
+            member->optimizer.init(member->params.size());
+            // Members start at different documents so they do not see identical streams
+            member->next_doc = (i * train_.size()) / specs.size();
+            member->result.name = specs[i].name;
+            member->result.config = specs[i].config;
+            member->result.learning_rate = specs[i].learning_rate;
+            members_.push_back(std::move(member));
+        }
+    }
+
+    /**
+     * Train every member to total_steps; progress lines go to log
+     */
+    const std::vector<TrialResult>& run(std::ostream& log = std::cout) {
+        int n_workers = options_.n_workers > 0 ? options_.n_workers
+                                               : static_cast<int>(std::thread::hardware_concurrency());
+        n_workers = std::clamp(n_workers, 1, static_cast<int>(members_.size()));
+        const int interval = options_.exploit_interval > 0 ? options_.exploit_interval : options_.total_steps;
+
+        for (int done = 0; done < options_.total_steps; done += interval) {
+            const int steps = std::min(interval, options_.total_steps - done);
+            train_round(steps, n_workers);
+            if (val_ != nullptr) {
+                evaluate_round(n_workers);
+            }
+
+            const auto ranking = rank();
+            const auto& best = *members_[ranking.front()];
+            log << std::fixed << std::setprecision(4) << "sweep step " << std::setw(5) << done + steps
+                << " | best " << best.result.name << " fitness " << fitness(best)
+                << " lr " << std::scientific << std::setprecision(2) << best.optimizer.learning_rate
+                << std::defaultfloat << std::endl;
+
+            if (options_.exploit_interval > 0 && done + steps < options_.total_steps) {
+                exploit_and_explore(ranking);
+            }
+        }
+
+        results_.clear();
+        for (size_t i : rank()) {
+            members_[i]->result.learning_rate = members_[i]->optimizer.learning_rate;
+            results_.push_back(members_[i]->result);
+        }
+        return results_;
+    }
+
+    /**
+     * Results of the last run(), best first
+     */
+    const std::vector<TrialResult>& results() const {
+        return results_;
+    }
+
+    /**
+     * Write the results table as CSV
+     */
+    void write_results(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out.is_open()) {
+            throw std::runtime_error("Could not open sweep results file for writing: " + path);
+        }
+        out << "rank,name,n_embd,n_head,n_layer,block_size,learning_rate,train_loss,val_loss,steps,exploited,"
+               "lineage,seconds\n";
+        out << std::setprecision(6);
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const auto& r = results_[i];
+            out << i + 1 << ',' << r.name << ',' << r.config.n_embd << ',' << r.config.n_head << ','
+                << r.config.n_layer << ',' << r.config.block_size << ',' << r.learning_rate << ','
+                << r.train_loss << ',' << r.val_loss << ',' << r.steps << ',' << r.exploited << ','
+                << r.lineage << ',' << r.seconds << '\n';
+        }
+    }
+
+    /**
+     * Print the results table, best first
+     */
+    void print_results(std::ostream& out = std::cout) const {
+        out << std::left << std::setw(16) << "name" << std::right << std::setw(6) << "embd" << std::setw(6)
+            << "head" << std::setw(6) << "layer" << std::setw(10) << "lr" << std::setw(10) << "train"
+            << std::setw(10) << "val" << std::setw(6) << "expl" << "  lineage\n";
+        for (const auto& r : results_) {
+            out << std::left << std::setw(16) << r.name << std::right << std::setw(6) << r.config.n_embd
+                << std::setw(6) << r.config.n_head << std::setw(6) << r.config.n_layer << std::scientific
+                << std::setprecision(2) << std::setw(10) << r.learning_rate << std::fixed << std::setprecision(4)
+                << std::setw(10) << r.train_loss << std::setw(10) << r.val_loss << std::setw(6) << r.exploited
+                << "  " << (r.lineage.empty() ? "-" : r.lineage) << '\n';
+        }
+        out << std::defaultfloat;
+    }
+
+private:
+    struct Member {
+        TrialSpec spec;
+        GPT model;
+        Adam optimizer;
+        std::vector<Value*> params;
+        size_t next_doc = 0;
+        double interval_loss = 0.0;
+        TrialResult result;
+
+        explicit Member(const TrialSpec& s)
+            : spec(s), model(s.config), optimizer(s.learning_rate, s.beta1, s.beta2, s.eps) {}
+    };
+
+    const TokenizedDocs& train_;
+    const TokenizedDocs* val_;
+    SweepOptions options_;
+    std::vector<std::unique_ptr<Member>> members_;
+    std::vector<TrialResult> results_;
+    std::mt19937_64 rng_;  // exploit/explore decisions only
+
+    double fitness(const Member& m) const {
+        return val_ != nullptr ? m.result.val_loss : m.result.train_loss;
+    }
+
+    // Run fn(member) for every member on n_workers threads; rethrows the first failure
+    template <typename Fn>
+    void parallel_for_members(int n_workers, Fn fn) {
+        std::atomic<size_t> next{0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto work = [&] {
+            for (size_t i = next.fetch_add(1); i < members_.size(); i = next.fetch_add(1)) {
+                try {
+                    fn(*members_[i]);
+                } catch (...) {
+                    std::lock_guard lock(error_mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (int w = 1; w < n_workers; ++w) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (auto& t : workers) {
+            t.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    void train_round(int steps, int n_workers) {
+        parallel_for_members(n_workers, [&](Member& m) {
+            const auto start = std::chrono::steady_clock::now();
+            double total = 0.0;
+            for (int s = 0; s < steps; ++s) {
+                ValueStorage storage;
+                const auto doc = train_.doc(m.next_doc);
+                m.next_doc = (m.next_doc + 1) % train_.size();
+                total += m.model.train_step(doc, m.optimizer, storage, options_.total_steps);
+            }
+            m.interval_loss = total / steps;
+            m.result.train_loss = m.interval_loss;
+            m.result.steps += steps;
+            m.result.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        });
+    }
+
+    void evaluate_round(int n_workers) {
+        parallel_for_members(n_workers, [&](Member& m) {
+            FlatWeights weights(m.model.state_dict);
+            NoGradModel evaluator(m.spec.config, weights);
+            m.result.val_loss = evaluate_docs(evaluator, *val_).loss;
+        });
+    }
+
+    // Member indices, best fitness first
+    std::vector<size_t> rank() const {
+        std::vector<size_t> order(members_.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+                         [&](size_t a, size_t b) { return fitness(*members_[a]) < fitness(*members_[b]); });
+        return order;
+    }
+
+    static bool same_shape(const Config& a, const Config& b) {
+        return a.vocab_size == b.vocab_size && a.n_embd == b.n_embd && a.n_head == b.n_head &&
+               a.n_layer == b.n_layer && a.block_size == b.block_size;
+    }
+
+    // Bottom members copy a top member of the same shape, then perturb their learning rate
+    void exploit_and_explore(const std::vector<size_t>& ranking) {
+        const size_t n = ranking.size();
+        const size_t cut = std::max<size_t>(1, static_cast<size_t>(options_.truncation * n));
+        if (2 * cut > n) {
+            return;
+        }
+
+        for (size_t r = n - cut; r < n; ++r) {
+            Member& loser = *members_[ranking[r]];
+            std::vector<size_t> donors;
+            for (size_t t = 0; t < cut; ++t) {
+                if (same_shape(members_[ranking[t]]->spec.config, loser.spec.config)) {
+                    donors.push_back(ranking[t]);
+                }
+            }
+            if (donors.empty()) {
+                continue;  // no compatible winner; keep training as is
+            }
+            const Member& winner = *members_[donors[rng_() % donors.size()]];
+
+            FlatWeights(winner.model.state_dict).copy_to(loser.model.state_dict);
+            loser.optimizer.m = winner.optimizer.m;
+            loser.optimizer.v = winner.optimizer.v;
+            loser.optimizer.step_count = winner.optimizer.step_count;
+            loser.optimizer.beta1 = winner.optimizer.beta1;
+            loser.optimizer.beta2 = winner.optimizer.beta2;
+            loser.optimizer.eps = winner.optimizer.eps;
+            const bool up = (rng_() & 1) != 0;
+            loser.optimizer.learning_rate =
+                up ? winner.optimizer.learning_rate * options_.perturb : winner.optimizer.learning_rate / options_.perturb;
+
+            loser.result.train_loss = winner.result.train_loss;
+            loser.result.val_loss = winner.result.val_loss;
+            ++loser.result.exploited;
+            loser.result.lineage += (loser.result.lineage.empty() ? "" : ">") + winner.result.name;
+        }
+    }
+};
+
+}  // namespace microgpt
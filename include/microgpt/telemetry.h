@@ -0,0 +1,150 @@
+#pragma once
+
+/**
+ * Structured training telemetry: per-step phase timings, tokens, graph size and
+ * storage footprint, written as JSON lines plus a periodic one-line summary.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+
+namespace microgpt {
+
+/**
+ * Measurements for one training step. Phases not run in a step stay at zero.
+ */
+struct StepTelemetry {
+    int step = 0;
+    int tokens = 0;                 // positions trained on
+    double loss = 0.0;
+    double data_ms = 0.0;           // waiting for / preparing the input
+    double forward_ms = 0.0;
+    double backward_ms = 0.0;
+    double optimizer_ms = 0.0;
+    double checkpoint_ms = 0.0;
+    size_t graph_nodes = 0;         // ValueStorage nodes built by the step
+    size_t peak_storage_bytes = 0;  // ValueStorage footprint at its largest
+
+    double total_ms() const {
+        return data_ms + forward_ms + backward_ms + optimizer_ms + checkpoint_ms;
+    }
+};
+
+/**
+ * Stopwatch for timing consecutive phases: each lap_ms() returns the time since
+ * the previous lap (or construction) and restarts the clock.
+ */
+class PhaseTimer {
+public:
+    PhaseTimer() : last_(std::chrono::steady_clock::now()) {}
+
+    double lap_ms() {
+        const auto now = std::chrono::steady_clock::now();
+        const double ms = std::chrono::duration<double, std::milli>(now - last_).count();
+        last_ = now;
+        return ms;
+    }
+
+private:
+    std::chrono::steady_clock::time_point last_;
+};
+
+/**
+ * Writes one JSON object per step to a file and prints a summary line
+ * aggregated over the last summary_every steps.
+ */
+class Telemetry {
+public:
+    /**
+     * @param path JSON-lines output file (truncated)
+     * @param summary_every Print a summary every this many steps (0 disables)
+     * @param summary_out Stream for the summary lines
+     */
+    explicit Telemetry(const std::string& path, int summary_every = 10, std::ostream& summary_out = std::cout)
+        : file_(path), summary_every_(summary_every), summary_out_(summary_out) {
+        if (!file_.is_open()) {
+            throw std::runtime_error("Could not open telemetry file for writing: " + path);
+        }
+    }
+
+    void record(const StepTelemetry& s) {
+        file_ << std::fixed << std::setprecision(4)
+              << "{\"type\":\"step\",\"step\":" << s.step
+              << ",\"tokens\":" << s.tokens
+              << ",\"loss\":" << s.loss
+              << ",\"data_ms\":" << s.data_ms
+              << ",\"forward_ms\":" << s.forward_ms
+              << ",\"backward_ms\":" << s.backward_ms
+              << ",\"optimizer_ms\":" << s.optimizer_ms
+              << ",\"checkpoint_ms\":" << s.checkpoint_ms
+              << ",\"total_ms\":" << s.total_ms()
+              << ",\"graph_nodes\":" << s.graph_nodes
+              << ",\"peak_storage_bytes\":" << s.peak_storage_bytes
+              << "}\n";
+
+        window_.tokens += s.tokens;
+        window_.loss += s.loss;
+        window_.data_ms += s.data_ms;
+        window_.forward_ms += s.forward_ms;
+        window_.backward_ms += s.backward_ms;
+        window_.optimizer_ms += s.optimizer_ms;
+        window_.checkpoint_ms += s.checkpoint_ms;
+        window_.graph_nodes = std::max(window_.graph_nodes, s.graph_nodes);
+        window_.peak_storage_bytes = std::max(window_.peak_storage_bytes, s.peak_storage_bytes);
+        ++window_steps_;
+
+        if (summary_every_ > 0 && window_steps_ >= summary_every_) {
+            print_summary(s.step);
+        }
+    }
+
+    /**
+     * Write an arbitrary pre-formatted JSON object as one line (e.g. evaluation results)
+     */
+    void record_json(const std::string& json_object) {
+        file_ << json_object << '\n';
+    }
+
+    void flush() {
+        file_.flush();
+    }
+
+private:
+    std::ofstream file_;
+    int summary_every_;
+    std::ostream& summary_out_;
+    StepTelemetry window_;
+    int window_steps_ = 0;
+
+    void print_summary(int step) {
+        const double total = window_.total_ms();
+        auto pct = [&](double ms) { return total > 0.0 ? 100.0 * ms / total : 0.0; };
+
+        summary_out_ << std::fixed << std::setprecision(4)
+                     << "step " << std::setw(4) << step
+                     << " | loss " << window_.loss / window_steps_
+                     << std::setprecision(0)
+                     << " | " << (total > 0.0 ? 1000.0 * window_.tokens / total : 0.0) << " tok/s"
+                     << std::setprecision(1)
+                     << " | data " << pct(window_.data_ms)
+                     << "% fwd " << pct(window_.forward_ms)
+                     << "% bwd " << pct(window_.backward_ms)
+                     << "% opt " << pct(window_.optimizer_ms)
+                     << "% ckpt " << pct(window_.checkpoint_ms)
+                     << "% | nodes " << window_.graph_nodes
+                     << " | peak " << window_.peak_storage_bytes / (1024.0 * 1024.0) << " MiB"
+                     << std::endl;
+
+        window_ = StepTelemetry{};
+        window_steps_ = 0;
+    }
+};
+
+}  // namespace microgpt
@@ -0,0 +1,270 @@
+#pragma once
+
+/**
+ * Pre-tokenized binary dataset, memory-mapped for reading.
+ *
+ * File layout (little-endian, native structs):
+ *   TokenDatasetHeader (128 bytes)
+ *   tokenizer characters  [n_chars bytes]
+ *   tokens                [num_tokens x token_bytes], 64-byte aligned
+ *   offsets               [num_docs + 1 x uint64], 8-byte aligned
+ *
+ * The tokens form one stream "BOS d1 BOS d2 ... BOS dn BOS": offsets[i] is the
+ * position of the BOS opening document i, and offsets[num_docs] is the final
+ * BOS. Document i is tokens[offsets[i], offsets[i + 1]] inclusive, i.e. both
+ * of its BOS tokens, exactly what Tokenizer::encode produces for it. Tokens
+ * are stored as uint8_t when the vocabulary fits in a byte, else uint16_t.
+ */
+
+#include "mapped_file.h"
+#include "utils.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace microgpt {
+
+struct TokenDatasetHeader {
+    char magic[8];             // "MGPTTOK\0"
+    uint32_t version;
+    uint32_t endian;           // 0x01020304 as written by the producing host
+    uint32_t token_bytes;      // 1 or 2
+    uint32_t vocab_size;
+    uint32_t bos;
+    uint32_t n_chars;          // tokenizer characters following the header
+    uint64_t num_docs;
+    uint64_t num_tokens;
+    uint64_t tokens_offset;    // byte offset of the token array
+    uint64_t offsets_offset;   // byte offset of the offsets index
+    uint8_t reserved[64];
+};
+static_assert(sizeof(TokenDatasetHeader) == 128, "TokenDatasetHeader must stay 128 bytes");
+
+inline constexpr char kTokenDatasetMagic[8] = {'M', 'G', 'P', 'T', 'T', 'O', 'K', '\0'};
+inline constexpr uint32_t kTokenDatasetVersion = 1;
+
+/**
+ * Whether path starts with the token dataset magic (false for text files)
+ */
+inline bool is_token_dataset(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open " + path);
+    }
+    char magic[sizeof(kTokenDatasetMagic)] = {};
+    in.read(magic, sizeof(magic));
+    return in.gcount() == sizeof(magic) && std::memcmp(magic, kTokenDatasetMagic, sizeof(magic)) == 0;
+}
+
+/**
+ * Tokenize docs (strings or string_views) and write them as a binary dataset
+ * @return Header of the written file
+ */
+template <typename Docs>
+inline TokenDatasetHeader write_token_dataset(const std::string& path, const Docs& docs, const Tokenizer& tokenizer) {
+    if (tokenizer.vocab_size > 65536) {
+        throw std::invalid_argument("Token dataset supports at most 65536 tokens");
+    }
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not open dataset file for writing: " + path);
+    }
+
+    TokenDatasetHeader header{};
+    std::memcpy(header.magic, kTokenDatasetMagic, sizeof(header.magic));
+    header.version = kTokenDatasetVersion;
+    header.endian = kEndianMarker;
+    header.token_bytes = tokenizer.vocab_size <= 256 ? 1 : 2;
+    header.vocab_size = static_cast<uint32_t>(tokenizer.vocab_size);
+    header.bos = static_cast<uint32_t>(tokenizer.BOS);
+    header.n_chars = static_cast<uint32_t>(tokenizer.uchars.size());
+    header.num_docs = docs.size();
+
+    auto pad_to = [&](uint64_t alignment) {
+        static const char zeros[64] = {};
+        const uint64_t pos = static_cast<uint64_t>(out.tellp());
+        out.write(zeros, static_cast<std::streamsize>((alignment - pos % alignment) % alignment));
+    };
+
+    // Placeholder header; rewritten once the sizes are known
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(tokenizer.uchars.data(), static_cast<std::streamsize>(tokenizer.uchars.size()));
+    pad_to(64);
+    header.tokens_offset = static_cast<uint64_t>(out.tellp());
+
+    // Stream the tokens document by document; only the offsets stay in memory
+    std::vector<uint64_t> offsets;
+    offsets.reserve(docs.size() + 1);
+    std::vector<int> tokens;
+    std::vector<uint8_t> packed;
+    uint64_t position = 0;
+    for (size_t i = 0; i <= docs.size(); ++i) {
+        offsets.push_back(position);
+        tokens.clear();
+        if (i < docs.size()) {
+            tokenizer.encode_into(docs[i], tokens);
+            tokens.pop_back();  // the closing BOS opens the next document
+        } else {
+            tokens.push_back(tokenizer.BOS);
+        }
+        packed.resize(tokens.size() * header.token_bytes);
+        for (size_t t = 0; t < tokens.size(); ++t) {
+            if (header.token_bytes == 1) {
+                packed[t] = static_cast<uint8_t>(tokens[t]);
+            } else {
+                const auto v = static_cast<uint16_t>(tokens[t]);
+                std::memcpy(&packed[2 * t], &v, sizeof(v));
+            }
+        }
+        out.write(reinterpret_cast<const char*>(packed.data()), static_cast<std::streamsize>(packed.size()));
+        position += tokens.size();
+    }
+    header.num_tokens = position;
+
+    pad_to(8);
+    header.offsets_offset = static_cast<uint64_t>(out.tellp());
+    out.write(reinterpret_cast<const char*>(offsets.data()),
+              static_cast<std::streamsize>(offsets.size() * sizeof(uint64_t)));
+
+    out.seekp(0);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (!out) {
+        throw std::runtime_error("Failed writing dataset file: " + path);
+    }
+    return header;
+}
+
+/**
+ * Memory-mapped view of a file written by write_token_dataset.
+ *
+ * Opening validates the header and walks the offsets index once, O(num_docs);
+ * the tokens themselves are read through the mapping, so every epoch costs
+ * nothing beyond page faults.
+ */
+class TokenDataset {
+public:
+    explicit TokenDataset(const std::string& path) : file_(path) {
+        if (file_.size() < sizeof(TokenDatasetHeader)) {
+            throw std::runtime_error("Not a token dataset (file too small): " + path);
+        }
+        std::memcpy(&header_, file_.data(), sizeof(header_));
+        if (std::memcmp(header_.magic, kTokenDatasetMagic, sizeof(header_.magic)) != 0) {
+            throw std::runtime_error("Not a token dataset (bad magic): " + path);
+        }
+        if (header_.version != kTokenDatasetVersion) {
+            throw std::runtime_error("Unsupported token dataset version " + std::to_string(header_.version));
+        }
+        if (header_.endian != kEndianMarker) {
+            throw std::runtime_error("Token dataset was written on a host of different endianness: " + path);
+        }
+        if (header_.token_bytes != 1 && header_.token_bytes != 2) {
+            throw std::runtime_error("Invalid token width in dataset: " + path);
+        }
+        // Sizes are compared against the room left, so crafted values cannot wrap around
+        const uint64_t size = file_.size();
+        if (sizeof(TokenDatasetHeader) + header_.n_chars > header_.tokens_offset ||
+            header_.tokens_offset % header_.token_bytes != 0 || header_.tokens_offset > size ||
+            header_.num_tokens > (size - header_.tokens_offset) / header_.token_bytes ||
+            header_.offsets_offset % alignof(uint64_t) != 0 || header_.offsets_offset > size ||
+            header_.num_docs >= (size - header_.offsets_offset) / sizeof(uint64_t)) {
+            throw std::runtime_error("Token dataset is truncated or corrupt: " + path);
+        }
+
+        tokens_ = file_.data() + header_.tokens_offset;
+        offsets_ = reinterpret_cast<const uint64_t*>(file_.data() + header_.offsets_offset);
+        if (offsets_[header_.num_docs] + 1 != header_.num_tokens) {
+            throw std::runtime_error("Token dataset offsets do not match its token count: " + path);
+        }
+        // doc() and doc_length() index the tokens through these without further checks
+        if (offsets_[0] != 0) {
+            throw std::runtime_error("Token dataset offsets do not start at zero: " + path);
+        }
+        for (uint64_t i = 1; i <= header_.num_docs; ++i) {
+            if (offsets_[i] < offsets_[i - 1] || offsets_[i] >= header_.num_tokens) {
+                throw std::runtime_error("Token dataset offsets are out of order or out of range: " + path);
+            }
+        }
+    }
+
+    const TokenDatasetHeader& header() const { return header_; }
+    size_t size() const { return header_.num_docs; }
+    size_t num_tokens() const { return header_.num_tokens; }
+    int token_bytes() const { return static_cast<int>(header_.token_bytes); }
+    int bos() const { return static_cast<int>(header_.bos); }
+
+    /**
+     * The tokenizer the dataset was encoded with
+     */
+    Tokenizer tokenizer() const {
+        Tokenizer tok;
+        const char* chars = reinterpret_cast<const char*>(file_.data() + sizeof(TokenDatasetHeader));
+        tok.uchars.assign(chars, chars + header_.n_chars);
+        tok.BOS = bos();
+        tok.vocab_size = static_cast<int>(header_.vocab_size);
+        tok.build_tables();
+        return tok;
+    }
+
+    /**
+     * Tokens of document i including its opening and closing BOS
+     */
+    size_t doc_length(size_t i) const {
+        return offsets_[i + 1] - offsets_[i] + 1;
+    }
+
+    /**
+     * Zero-copy view of document i; T must match token_bytes()
+     */
+    template <typename T>
+    std::span<const T> doc(size_t i) const {
+        static_assert(std::is_same_v<T, uint8_t> || std::is_same_v<T, uint16_t>, "Tokens are uint8_t or uint16_t");
+        if (sizeof(T) != header_.token_bytes) {
+            throw std::invalid_argument("Token dataset holds " + std::to_string(header_.token_bytes) +
+                                        "-byte tokens");
+        }
+        if (i >= size()) {
+            throw std::out_of_range("Document index out of range");
+        }
+        return {reinterpret_cast<const T*>(tokens_) + offsets_[i], doc_length(i)};
+    }
+
+    /**
+     * Append document i to out, widened to int (same tokens as Tokenizer::encode_into)
+     */
+    void append_doc(size_t i, std::vector<int>& out) const {
+        if (header_.token_bytes == 1) {
+            const auto d = doc<uint8_t>(i);
+            out.insert(out.end(), d.begin(), d.end());
+        } else {
+            const auto d = doc<uint16_t>(i);
+            out.insert(out.end(), d.begin(), d.end());
+        }
+    }
+
+    /**
+     * Length of the longest document, in tokens including both BOS
+     */
+    size_t longest_doc() const {
+        size_t longest = 0;
+        for (size_t i = 0; i < size(); ++i) {
+            longest = std::max(longest, doc_length(i));
+        }
+        return longest;
+    }
+
+    const MappedFile& file() const { return file_; }
+
+private:
+    MappedFile file_;
+    TokenDatasetHeader header_{};
+    const uint8_t* tokens_ = nullptr;
+    const uint64_t* offsets_ = nullptr;
+};
+
+}  // namespace microgpt
@@ -0,0 +1,258 @@
+#pragma once
+
+/**
+ * Lightweight tracing: timed spans recorded into per-thread ring buffers and
+ * written as Chrome trace-event JSON, for chrome://tracing or ui.perfetto.dev.
+ *
+ * Tracing is off until trace_start(). While off, a TraceScope costs one
+ * relaxed atomic load. While on, a span costs two clock reads and one
+ * uncontended lock of its thread's buffer. Each span is stored once, when it
+ * ends, as a complete event holding both its begin and end time. Each thread
+ * keeps the most recent events_per_thread spans and overwrites the oldest.
+ * A full buffer therefore never leaves a begin without its end.
+ *
+ *   trace_start();
+ *   { TraceScope span("attention", "forward", "layer", li); ... }
+ *   trace_write_json("trace.json");
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace microgpt {
+
+namespace detail {
+
+/**
+ * One finished span; names are string literals, so only pointers are kept
+ */
+struct TraceEvent {
+    const char* name = nullptr;
+    const char* category = nullptr;
+    const char* arg_name = nullptr;  // optional integer argument, e.g. "layer"
+    int64_t arg = 0;
+    int64_t start_ns = 0;
+    int64_t duration_ns = 0;
+};
+
+/**
+ * Ring buffer of one thread's events. Only its thread records into it; the
+ * lock lets trace_write_json read it while that thread keeps running.
+ */
+struct TraceBuffer {
+    std::mutex mutex;
+    std::vector<TraceEvent> events;  // allocated on the first event after trace_start
+    uint64_t recorded = 0;           // events recorded since trace_start, including overwritten ones
+    int tid = 0;
+    std::string thread_name;
+};
+
+inline std::atomic<bool> trace_on{false};
+
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;  // kept after their threads exit
+    std::atomic<size_t> capacity{1 << 16};  // read by record_trace_event without the lock
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+inline TraceRegistry& trace_registry() {
+    static TraceRegistry registry;
+    return registry;
+}
+
+inline TraceBuffer& thread_trace_buffer() {
+    thread_local const std::shared_ptr<TraceBuffer> buffer = [] {
+        auto b = std::make_shared<TraceBuffer>();
+        auto& registry = trace_registry();
+        std::lock_guard lock(registry.mutex);
+        b->tid = static_cast<int>(registry.buffers.size()) + 1;
+        registry.buffers.push_back(b);
+        return b;
+    }();
+    return *buffer;
+}
+
+inline int64_t trace_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                                trace_registry().epoch)
+        .count();
+}
+
+inline void record_trace_event(const TraceEvent& event) {
+    TraceBuffer& buffer = thread_trace_buffer();
+    std::lock_guard lock(buffer.mutex);
+    if (buffer.events.empty()) {
+        buffer.events.resize(trace_registry().capacity.load(std::memory_order_relaxed));
+    }
+    buffer.events[buffer.recorded++ % buffer.events.size()] = event;
+}
+
+inline void write_json_string(std::ostream& out, const std::string& text) {
+    out << '"';
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) >= 0x20) {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+}  // namespace detail
+
+inline bool trace_enabled() {
+    return detail::trace_on.load(std::memory_order_relaxed);
+}
+
+/**
+ * Discard earlier events and start recording
+ * @param events_per_thread Ring buffer size; older events of a thread are overwritten
+ */
+inline void trace_start(size_t events_per_thread = 1 << 16) {
+    if (events_per_thread == 0) {
+        throw std::invalid_argument("trace_start needs room for at least one event");
+    }
+    auto& registry = detail::trace_registry();
+    std::lock_guard lock(registry.mutex);
+    registry.capacity = events_per_thread;
+    for (auto& buffer : registry.buffers) {
+        std::lock_guard buffer_lock(buffer->mutex);
+        buffer->events.clear();
+        buffer->events.shrink_to_fit();
+        buffer->recorded = 0;
+    }
+    detail::trace_on.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * Stop recording; recorded events are kept until the next trace_start()
+ */
+inline void trace_stop() {
+    detail::trace_on.store(false, std::memory_order_relaxed);
+}
+
+/**
+ * Name the calling thread in the trace (e.g. "data_loader"); works whether or
+ * not tracing is on, so threads can name themselves once when they start
+ */
+inline void trace_thread_name(std::string name) {
+    auto& buffer = detail::thread_trace_buffer();
+    std::lock_guard lock(buffer.mutex);
+    buffer.thread_name = std::move(name);
+}
+
+/**
+ * Write every thread's retained events as Chrome trace-event JSON
+ * @return events written
+ */
+inline size_t trace_write_json(std::ostream& out) {
+    auto& registry = detail::trace_registry();
+    std::lock_guard lock(registry.mutex);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"microgpt\"}}";
+    size_t written = 0;
+    char ts[64];
+    for (const auto& buffer : registry.buffers) {
+        std::lock_guard buffer_lock(buffer->mutex);
+        if (!buffer->thread_name.empty()) {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":";
+            detail::write_json_string(out, buffer->thread_name);
+            out << "}}";
+        }
+        const uint64_t capacity = buffer->events.size();
+        const uint64_t first = buffer->recorded > capacity ? buffer->recorded - capacity : 0;
+        for (uint64_t i = first; i < buffer->recorded; ++i) {
+            const detail::TraceEvent& e = buffer->events[i % capacity];
+            // Microseconds with nanosecond precision
+            std::snprintf(ts, sizeof(ts), "%.3f,\"dur\":%.3f", e.start_ns / 1e3, e.duration_ns / 1e3);
+            out << ",\n{\"name\":\"" << e.name << "\",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                << buffer->tid << ",\"ts\":" << ts;
+            if (e.arg_name != nullptr) {
+                out << ",\"args\":{\"" << e.arg_name << "\":" << e.arg << "}";
+            }
+            out << "}";
+            ++written;
+        }
+        if (first > 0) {
+            // Mark where this thread's retained history starts
+            std::snprintf(ts, sizeof(ts), "%.3f", buffer->events[first % capacity].start_ns / 1e3);
+            out << ",\n{\"name\":\"" << first << " older events overwritten\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,"
+                << "\"tid\":" << buffer->tid << ",\"ts\":" << ts << "}";
+        }
+    }
+    out << "\n]}\n";
+    return written;
+}
+
+/**
+ * @throws std::runtime_error if the file cannot be written
+ */
+inline size_t trace_write_json(const std::string& path) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        throw std::runtime_error("Cannot open trace file: " + path);
+    }
+    const size_t written = trace_write_json(out);
+    if (!out) {
+        throw std::runtime_error("Failed to write trace file: " + path);
+    }
+    return written;
+}
+
+/**
+ * Records the span from construction to destruction on the calling thread
+ * @param name, category, arg_name String literals (they are stored as pointers)
+ */
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, const char* category = "microgpt", const char* arg_name = nullptr,
+                        int64_t arg = 0) {
+        event_ = {nullptr, category, arg_name, arg, 0, 0};
+        if (trace_enabled()) {
+            event_.name = name;
+            event_.start_ns = detail::trace_now_ns();
+        }
+    }
+
+    ~TraceScope() { finish(); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    /**
+     * End this span and start the next one with the same category and argument,
+     * for consecutive phases of one function (e.g. attention, then MLP)
+     */
+    void next(const char* name) {
+        finish();
+        if (trace_enabled()) {
+            event_.name = name;
+            event_.start_ns = detail::trace_now_ns();
+        }
+    }
+
+private:
+    void finish() {
+        if (event_.name != nullptr) {
+            event_.duration_ns = detail::trace_now_ns() - event_.start_ns;
+            detail::record_trace_event(event_);
+            event_.name = nullptr;
+        }
+    }
+
+    detail::TraceEvent event_;
+};
+
+}  // namespace microgpt
@@ -7,83 +7,214 @@
 
 #include "value.h"
 #include "layers.h"
+#include "corpus.h"
 #include <algorithm>
+#include <array>
 #include <cmath>
+#include <cstdint>
 #include <fstream>
 #include <random>
 #include <set>
+#include <span>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace microgpt {
 
 /**
- * Simple character-level tokenizer
+ * Simple character-level tokenizer.
+ *
+ * Encoding goes through a 256-entry byte -> id table and decoding through the
+ * id -> byte table (uchars), both O(1) per character. fit() builds the table;
+ * code that fills uchars by hand must call build_tables() afterwards (until
+ * then encoding falls back to a linear search).
  */
 class Tokenizer {
 public:
-    std::vector<char> uchars;  // unique characters
+    std::vector<char> uchars;  // unique characters; also the id -> byte table
     int BOS;                    // Beginning of Sequence token
     int vocab_size;
 
     Tokenizer() = default;
 
-    void fit(const std::vector<std::string>& docs) {
-        std::set<char> char_set;
+    /**
+     * Build the vocabulary from the characters of docs (any range of strings or string_views)
+     */
+    template <typename Docs>
+    void fit(const Docs& docs) {
+        bool seen[256] = {};
         for (const auto& doc : docs) {
             for (char c : doc) {
-                char_set.insert(c);
+                seen[static_cast<unsigned char>(c)] = true;
             }
         }
-        uchars = std::vector<char>(char_set.begin(), char_set.end());
-        std::sort(uchars.begin(), uchars.end());
+        uchars.clear();
+        for (int b = 0; b < 256; ++b) {
+            if (seen[b]) {
+                uchars.push_back(static_cast<char>(b));
+            }
+        }
+        std::sort(uchars.begin(), uchars.end());  // char order, as before
         BOS = static_cast<int>(uchars.size());
         vocab_size = static_cast<int>(uchars.size()) + 1;
+        build_tables();
     }
 
-    std::vector<int> encode(const std::string& text) const {
-        std::vector<int> tokens = {BOS};
-        for (char c : text) {
-            auto it = std::find(uchars.begin(), uchars.end(), c);
-            if (it != uchars.end()) {
-                tokens.push_back(static_cast<int>(it - uchars.begin()));
-            }
+    /**
+     * Rebuild the byte -> id table from uchars
+     */
+    void build_tables() {
+        lut_.fill(-1);
+        for (size_t i = 0; i < uchars.size(); ++i) {
+            lut_[static_cast<unsigned char>(uchars[i])] = static_cast<int16_t>(i);
         }
-        tokens.push_back(BOS);
+        has_lut_ = true;
+    }
+
+    std::vector<int> encode(std::string_view text) const {
+        std::vector<int> tokens;
+        tokens.reserve(text.size() + 2);
+        encode_into(text, tokens);
         return tokens;
     }
 
-    std::string decode(const std::vector<int>& tokens) const {
-        std::string text;
+    /**
+     * Append BOS, the text's tokens and a closing BOS to an existing buffer.
+     * Does not allocate when the buffer already has enough capacity.
+     */
+    void encode_into(std::string_view text, std::vector<int>& tokens) const {
+        const size_t start = tokens.size();
+        tokens.resize(start + text.size() + 2);
+        int* end = encode_one(text, tokens.data() + start);
+        tokens.resize(static_cast<size_t>(end - tokens.data()));
+    }
+
+    /**
+     * Tokens needed to encode docs with the batch encode_into
+     */
+    static size_t encoded_capacity(std::span<const std::string_view> docs) {
+        size_t total = 0;
+        for (const auto& doc : docs) {
+            total += doc.size() + 2;
+        }
+        return total;
+    }
+
+    /**
+     * Encode a batch of documents back to back into caller-provided buffers,
+     * without allocating. Document i becomes tokens[offsets[i], offsets[i + 1]).
+     * @param tokens At least encoded_capacity(docs) entries
+     * @param offsets At least docs.size() + 1 entries
+     * @return Number of tokens written
+     */
+    size_t encode_into(std::span<const std::string_view> docs, std::span<int> tokens,
+                       std::span<size_t> offsets) const {
+        if (offsets.size() < docs.size() + 1) {
+            throw std::length_error("encode_into: offsets buffer too small");
+        }
+        if (tokens.size() < encoded_capacity(docs)) {
+            throw std::length_error("encode_into: token buffer too small");
+        }
+        int* out = tokens.data();
+        offsets[0] = 0;
+        for (size_t i = 0; i < docs.size(); ++i) {
+            out = encode_one(docs[i], out);
+            offsets[i + 1] = static_cast<size_t>(out - tokens.data());
+        }
+        return offsets[docs.size()];
+    }
+
+    std::string decode(std::span<const int> tokens) const {
+        std::string text(tokens.size(), '\0');
+        text.resize(decode_into(tokens, text));
+        return text;
+    }
+
+    /**
+     * Write the characters of tokens (BOS and unknown ids skipped) into out,
+     * without allocating
+     * @param out At least tokens.size() bytes
+     * @return Number of bytes written
+     */
+    size_t decode_into(std::span<const int> tokens, std::span<char> out) const {
+        if (out.size() < tokens.size()) {
+            throw std::length_error("decode_into: output buffer too small");
+        }
+        const int n_chars = static_cast<int>(uchars.size());
+        char* dst = out.data();
         for (int token : tokens) {
-            if (token != BOS && token < static_cast<int>(uchars.size())) {
-                text += uchars[token];
+            // Branch-free: always store, advance only for a real character
+            const bool valid = token >= 0 && token < n_chars;
+            *dst = valid ? uchars[token] : '\0';
+            dst += valid;
+        }
+        return static_cast<size_t>(dst - out.data());
+    }
+
+private:
+    std::array<int16_t, 256> lut_{};  // byte -> id, -1 if not in the vocabulary
+    bool has_lut_ = false;
+
+    // BOS, the text's known characters, BOS; out needs text.size() + 2 entries
+    int* encode_one(std::string_view text, int* out) const {
+        *out++ = BOS;
+        if (has_lut_) {
+            // Translate every byte, then compact only if some were not in the vocabulary
+            const size_t n = text.size();
+            int unknown = 0;
+            for (size_t i = 0; i < n; ++i) {
+                const int id = lut_[static_cast<unsigned char>(text[i])];
+                out[i] = id;
+                unknown |= id;
+            }
+            if (unknown >= 0) {
+                out += n;
+            } else {
+                int* dst = out;
+                for (size_t i = 0; i < n; ++i) {
+                    *dst = out[i];
+                    dst += out[i] >= 0;
+                }
+                out = dst;
+            }
+        } else {
+            for (char c : text) {
+                auto it = std::find(uchars.begin(), uchars.end(), c);
+                if (it != uchars.end()) {
+                    *out++ = static_cast<int>(it - uchars.begin());
+                }
             }
         }
-        return text;
+        *out++ = BOS;
+        return out;
     }
 };
 
 /**
- * Load documents from a file
+ * Load documents from a file, one per line (trimmed, blank lines skipped).
+ * Scans the file in parallel; load_corpus avoids the per-document strings.
  */
 inline std::vector<std::string> load_docs(const std::string& filename) {
-    std::vector<std::string> docs;
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        return docs;
-    }
-    std::string line;
-    while (std::getline(file, line)) {
-        // Trim whitespace
-        line.erase(0, line.find_first_not_of(" \t\r\n"));
-        line.erase(line.find_last_not_of(" \t\r\n") + 1);
-        if (!line.empty()) {
-            docs.push_back(line);
-        }
+    const Corpus corpus = load_corpus(filename);
+    return std::vector<std::string>(corpus.docs.begin(), corpus.docs.end());
+}
+
+/**
+ * Split documents into a training set and a held-out validation set.
+ * The last val_fraction of the list becomes the validation set, so shuffle first.
+ */
+template <typename Doc>
+inline std::pair<std::vector<Doc>, std::vector<Doc>> split_docs(const std::vector<Doc>& docs, double val_fraction) {
+    if (val_fraction < 0.0 || val_fraction >= 1.0) {
+        throw std::invalid_argument("val_fraction must be in [0, 1)");
     }
-    return docs;
+    const size_t n_val = static_cast<size_t>(docs.size() * val_fraction);
+    const auto split = docs.end() - static_cast<std::ptrdiff_t>(n_val);
+    return {std::vector<Doc>(docs.begin(), split), std::vector<Doc>(split, docs.end())};
 }
 
 /**
@@ -5,8 +5,11 @@
  * Original Python implementation: https://gist.github.com/karpathy/8627fe009c40f57531cb18360106ce95
  */
 
+#include "profile.h"
+#include "trace.h"
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <deque>
 #include <iostream>
@@ -14,10 +17,13 @@
 #include <memory>
 #include <set>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 namespace microgpt {
 
+class ValueStorage;
+
 /**
  * Stores a single scalar value and its gradient, as a node in a computation graph.
  * Direct port of Python's Value class for scalar autograd.
@@ -305,14 +311,21 @@ public:
 
     // Backward pass with safety checks
     void backward() {
+        TraceScope span("backward", "graph");
         std::vector<Value*> topo;
         std::set<Value*> visited;
+#if MICROGPT_PROFILE
+        const auto topo_start = std::chrono::steady_clock::now();
+#endif
         
         try {
             build_topo(this, topo, visited);
         } catch (const std::exception& e) {
             throw std::runtime_error(std::string("Error building computation graph: ") + e.what());
         }
+#if MICROGPT_PROFILE
+        record_topo(profile_, topo_start);
+#endif
 
         grad = 1.0;
         std::reverse(topo.begin(), topo.end());
@@ -323,6 +336,9 @@ public:
             // Validate this node hasn't been freed
             assert(std::isfinite(v->data) && "Node data is NaN or infinity (possible use-after-free)");
             assert(std::isfinite(v->grad) && "Node grad is NaN or infinity");
+#if MICROGPT_PROFILE
+            const auto node_start = std::chrono::steady_clock::now();
+#endif
             
             for (size_t i = 0; i < v->children_.size(); ++i) {
                 Value* child = v->children_[i];
@@ -343,6 +359,62 @@ public:
                     // Warning: gradient may be exploding (but continue)
                 }
             }
+#if MICROGPT_PROFILE
+            record_backward(v, node_start);
+#endif
+        }
+    }
+
+    /**
+     * Bytes held by this node, including its child and local-gradient arrays
+     */
+    size_t footprint() const {
+        return sizeof(Value) + children_.capacity() * sizeof(Value*) + local_grads_.capacity() * sizeof(double);
+    }
+
+    /**
+     * Backward pass from several output nodes whose grads are already seeded.
+     * Used when one graph is split across pipeline stages: the upstream gradient
+     * arrives from the next stage instead of starting at 1.0.
+     */
+    static void backward_from(const std::vector<Value*>& outputs) {
+        TraceScope span("backward", "graph");
+        std::vector<Value*> topo;
+        std::set<Value*> visited;
+#if MICROGPT_PROFILE
+        const auto topo_start = std::chrono::steady_clock::now();
+#endif
+
+        for (Value* out : outputs) {
+            if (out == nullptr) {
+                throw std::runtime_error("Null output pointer in backward_from");
+            }
+            try {
+                out->build_topo(out, topo, visited);
+            } catch (const std::exception& e) {
+                throw std::runtime_error(std::string("Error building computation graph: ") + e.what());
+            }
+        }
+
+#if MICROGPT_PROFILE
+        record_topo(outputs.empty() ? nullptr : outputs.front()->profile_, topo_start);
+#endif
+
+        std::reverse(topo.begin(), topo.end());
+
+        for (Value* v : topo) {
+            assert(std::isfinite(v->grad) && "Node grad is NaN or infinity");
+#if MICROGPT_PROFILE
+            const auto node_start = std::chrono::steady_clock::now();
+#endif
+            for (size_t i = 0; i < v->children_.size(); ++i) {
+                const double grad_contribution = v->local_grads_[i] * v->grad;
+                assert(std::isfinite(grad_contribution) && "Gradient contribution is NaN or infinity");
+                v->children_[i]->grad += grad_contribution;
+            }
+#if MICROGPT_PROFILE
+            record_backward(v, node_start);
+#endif
         }
     }
 
@@ -350,13 +422,40 @@ private:
     std::vector<Value*> children_;
     std::vector<double> local_grads_;
 
+#if MICROGPT_PROFILE
+    friend class ValueStorage;
+
+    // Set by ValueStorage::store; parameters and other unstored nodes stay unattributed
+    GraphProfile* profile_ = nullptr;
+    Op op_ = Op::other;
+    Region region_ = Region::other;
+
+    static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static void record_topo(GraphProfile* profile, std::chrono::steady_clock::time_point start) {
+        if (profile != nullptr) {
+            profile->topo_ns += elapsed_ns(start);
+        }
+    }
+
+    static void record_backward(const Value* v, std::chrono::steady_clock::time_point start) {
+        if (v->profile_ != nullptr) {
+            auto& c = v->profile_->at(v->region_, v->op_);
+            ++c.backward_nodes;
+            c.backward_ns += std::max(0.0, elapsed_ns(start) - detail::clock_overhead_ns());
+        }
+    }
+#endif
+
     void build_topo(Value* v, std::vector<Value*>& topo, std::set<Value*>& visited) const {
         if (v == nullptr) {
             throw std::runtime_error("Null pointer in computation graph");
         }
         
         // Check for cycles (shouldn't happen in DAG, but detect infinite recursion)
-        if (topo.size() > 100000) {
+        if (topo.size() > 1000000) {
             throw std::runtime_error("Computation graph too large or has cycle");
         }
         
@@ -405,15 +504,28 @@ private:
  * - log(a) - Natural logarithm
  * - exp(a) - Exponential
  * - relu(a) - ReLU activation
+ *
+ * With MICROGPT_PROFILE every stored node is also counted per op and per the
+ * region set with ProfileRegion (see profile.h).
  */
 class ValueStorage {
 public:
     std::deque<Value> values;  // deque ensures pointers remain valid when growing
     
-    Value* store(Value&& v) {
+    Value* store(Value&& v, [[maybe_unused]] Op op = Op::other) {
         // Validate the value before storing
         assert(std::isfinite(v.data) && "Attempting to store NaN or infinity");
         
+#if MICROGPT_PROFILE
+        v.profile_ = profile_.get();
+        v.op_ = op;
+        v.region_ = region_;
+        auto& counters = profile_->at(region_, op);
+        ++counters.nodes;
+        counters.bytes += v.footprint();
+#endif
+        bytes_ += v.footprint();
+        peak_bytes_ = std::max(peak_bytes_, bytes_);
         values.push_back(std::move(v));
         Value* ptr = &values.back();
         
@@ -425,7 +537,7 @@ public:
     
     // Factory method: Create a constant Value
     Value* constant(double data) {
-        return store(Value(data));
+        return store(Value(data), Op::constant);
     }
     
     // Factory method: Addition
@@ -437,13 +549,13 @@ public:
         if (a->data > 0 && b->data > 0 && a->data > std::numeric_limits<double>::max() - b->data) {
             throw std::overflow_error("Addition would overflow");
         }
-        return store(Value(result, {a, b}, {1.0, 1.0}));
+        return store(Value(result, {a, b}, {1.0, 1.0}), Op::add);
     }
     
     Value* add(Value* a, double b) {
         assert(a != nullptr && "Null pointer in add");
         assert(std::isfinite(b) && "Adding NaN or infinity");
-        return store(Value(a->data + b, {a}, {1.0}));
+        return store(Value(a->data + b, {a}, {1.0}), Op::add);
     }
     
     // Factory method: Multiplication
@@ -452,7 +564,7 @@ public:
         assert(b != nullptr && "Null pointer in mul");
         const double result = a->data * b->data;
         assert(std::isfinite(result) && "Multiplication resulted in NaN or infinity");
-        return store(Value(result, {a, b}, {b->data, a->data}));
+        return store(Value(result, {a, b}, {b->data, a->data}), Op::mul);
     }
     
     Value* mul(Value* a, double b) {
@@ -460,7 +572,7 @@ public:
         assert(std::isfinite(b) && "Multiplying by NaN or infinity");
         const double result = a->data * b;
         assert(std::isfinite(result) && "Multiplication resulted in NaN or infinity");
-        return store(Value(result, {a}, {b}));
+        return store(Value(result, {a}, {b}), Op::mul);
     }
     
     // Factory method: Negation
@@ -500,7 +612,7 @@ public:
         const double local_grad = exponent * std::pow(a->data, exponent - 1);
         assert(std::isfinite(local_grad) && "Power gradient is NaN or infinity");
         
-        return store(Value(result, {a}, {local_grad}));
+        return store(Value(result, {a}, {local_grad}), Op::pow);
     }
     
     // Factory method: Division
@@ -531,7 +643,7 @@ public:
         }
         const double result = std::log(a->data);
         assert(std::isfinite(result) && "Log resulted in NaN or infinity");
-        return store(Value(result, {a}, {1.0 / a->data}));
+        return store(Value(result, {a}, {1.0 / a->data}), Op::log);
     }
     
     // Factory method: Exponential
@@ -542,7 +654,7 @@ public:
         }
         const double result = std::exp(a->data);
         assert(std::isfinite(result) && "Exp resulted in NaN or infinity");
-        return store(Value(result, {a}, {result}));
+        return store(Value(result, {a}, {result}), Op::exp);
     }
     
     // Factory method: ReLU
@@ -550,23 +662,97 @@ public:
         assert(a != nullptr && "Null pointer in relu");
         const double result = std::max(0.0, a->data);
         const double local_grad = (a->data > 0) ? 1.0 : 0.0;
-        return store(Value(result, {a}, {local_grad}));
+        return store(Value(result, {a}, {local_grad}), Op::relu);
     }
     
+    // Profile counters are kept across clear() so they can cover several steps
     void clear() {
         values.clear();
+        bytes_ = 0;
     }
     
     size_t size() const {
         return values.size();
     }
+
+    // Approximate bytes held by the stored nodes, and the high-water mark across clear()
+    size_t bytes() const {
+        return bytes_;
+    }
+
+    size_t peak_bytes() const {
+        return peak_bytes_;
+    }
     
+    /**
+     * Region attributed to the nodes created from now on; returns the previous one.
+     * No effect unless MICROGPT_PROFILE is enabled.
+     */
+    Region set_region([[maybe_unused]] Region region) {
+#if MICROGPT_PROFILE
+        return std::exchange(region_, region);
+#else
+        return Region::other;
+#endif
+    }
+
+    /**
+     * Counters of the nodes created by this storage and their backward passes;
+     * always empty unless MICROGPT_PROFILE is enabled
+     */
+    const GraphProfile& profile() const {
+#if MICROGPT_PROFILE
+        return *profile_;
+#else
+        static const GraphProfile empty;
+        return empty;
+#endif
+    }
+
+    void reset_profile() {
+#if MICROGPT_PROFILE
+        profile_->reset();
+#endif
+    }
+
     // Check for memory usage growth
     void check_size_limit(size_t max_size = 1000000) const {
         if (values.size() > max_size) {
             throw std::runtime_error("ValueStorage exceeded size limit - possible memory leak");
         }
     }
+
+private:
+    size_t bytes_ = 0;
+    size_t peak_bytes_ = 0;
+#if MICROGPT_PROFILE
+    // Shared so nodes keep a valid pointer when the storage is moved
+    std::shared_ptr<GraphProfile> profile_ = std::make_shared<GraphProfile>();
+    Region region_ = Region::other;
+#endif
+};
+
+/**
+ * Attributes the nodes a storage creates within a scope to a model region,
+ * restoring the previous region on exit. Compiles to nothing without
+ * MICROGPT_PROFILE.
+ */
+class ProfileRegion {
+public:
+#if MICROGPT_PROFILE
+    ProfileRegion(ValueStorage& storage, Region region) : storage_(storage), previous_(storage.set_region(region)) {}
+    ~ProfileRegion() { storage_.set_region(previous_); }
+
+private:
+    ValueStorage& storage_;
+    Region previous_;
+#else
+    ProfileRegion(ValueStorage&, Region) {}
+#endif
+
+public:
+    ProfileRegion(const ProfileRegion&) = delete;
+    ProfileRegion& operator=(const ProfileRegion&) = delete;
 };
 
 }  // namespace microgpt
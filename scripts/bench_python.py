@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+"""
+End-to-end throughput comparison: microgpt.py against the C++ port.
+
+Runs the reference microgpt.py (with num_steps patched) and the bench_e2e
+driver on the same document order: the names are shuffled here exactly as
+microgpt.py shuffles them (random.seed(42)), written out, and handed to
+bench_e2e with --no-shuffle. Both train n_embd 16, 4 heads, 1 layer, block
+size 8, one document per step, then draw 20 samples at temperature 0.5.
+
+Reports steps/s, tokens/s (positions trained on, or scored without gradients
+in the no-grad modes) and samples/s for Python and every C++ mode, and checks
+that the loss curves agree: the parameter initialization comes from different
+random generators, so per-step losses differ, but the mean loss over every
+window of --window steps must match within --tolerance. Exits 1 if it does not.
+
+usage: scripts/bench_python.py [--build build] [--steps 500] [--out results.md]
+"""
+
+import argparse
+import json
+import os
+import random
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+BLOCK_SIZE = 8
+STEP_LINE = re.compile(r"step\s+(\d+)\s*/\s*\d+\s*\|\s*loss\s+([0-9.]+)")
+
+
+def load_docs(path):
+    # Same parsing and shuffle as microgpt.py
+    with open(path) as f:
+        docs = [l.strip() for l in f.read().strip().split('\n') if l.strip()]
+    random.seed(42)
+    random.shuffle(docs)
+    return docs
+
+
+def run_python(python, workdir, names, steps):
+    source = open(os.path.join(ROOT, 'microgpt.py')).read()
+    patched, count = re.subn(r'^num_steps = \d+', f'num_steps = {steps}', source, flags=re.M)
+    if count != 1:
+        sys.exit('error: could not find num_steps in microgpt.py')
+    script = os.path.join(workdir, 'microgpt.py')
+    with open(script, 'w') as f:
+        f.write(patched)
+    shutil.copyfile(names, os.path.join(workdir, 'input.txt'))
+
+    # Phases are timed from when their first output line arrives (unbuffered)
+    losses = []
+    train_start = train_end = None
+    proc = subprocess.Popen([python, '-u', script], cwd=workdir, stdout=subprocess.PIPE, text=True)
+    for line in proc.stdout:
+        now = time.perf_counter()
+        if line.startswith('num params'):
+            train_start = now
+        elif line.startswith('--- inference ---'):
+            train_end = now
+        else:
+            m = STEP_LINE.match(line)
+            if m:
+                losses.append(float(m.group(2)))
+    end = time.perf_counter()
+    if proc.wait() != 0 or train_start is None or train_end is None:
+        sys.exit('error: microgpt.py failed')
+    return losses, train_end - train_start, end - train_end
+
+
+def run_cpp(binary, workdir, docs_file, steps):
+    result = os.path.join(workdir, 'cpp.json')
+    curve = os.path.join(workdir, 'cpp.csv')
+    subprocess.run([binary, '--docs', docs_file, '--no-shuffle', '--steps', str(steps), '--samples', '20',
+                    '--json', result, '--loss-log', curve], check=True, stdout=subprocess.DEVNULL)
+    with open(result) as f:
+        modes = [json.loads(line) for line in f if line.strip()]
+    with open(curve) as f:
+        losses = [float(line.split(',')[1]) for line in f.readlines()[1:]]
+    return modes, losses
+
+
+def window_means(losses, window):
+    return [sum(losses[i:i + window]) / len(losses[i:i + window]) for i in range(0, len(losses), window)]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare microgpt.py and microgpt-cpp throughput')
+    parser.add_argument('--build', default=os.path.join(ROOT, 'build'), help='CMake build directory')
+    parser.add_argument('--steps', type=int, default=500, help='training steps for both')
+    parser.add_argument('--window', type=int, default=50, help='steps per loss-curve window')
+    parser.add_argument('--tolerance', type=float, default=0.15, help='max difference of window mean losses')
+    parser.add_argument('--python', default=sys.executable, help='interpreter for microgpt.py')
+    parser.add_argument('--data', default=os.path.join(ROOT, 'data', 'names.txt'))
+    parser.add_argument('--out', help='also write the results table (markdown) here')
+    args = parser.parse_args()
+
+    binary = os.path.join(args.build, 'bench_e2e')
+    if not os.path.exists(binary):
+        sys.exit(f'error: {binary} not found; build the bench_e2e target (Release recommended)')
+
+    docs = load_docs(args.data)
+    train_tokens = sum(min(BLOCK_SIZE, len(docs[s % len(docs)]) + 1) for s in range(args.steps))
+
+    with tempfile.TemporaryDirectory() as workdir:
+        docs_file = os.path.join(workdir, 'docs.txt')
+        with open(docs_file, 'w') as f:
+            f.write('\n'.join(docs) + '\n')
+        print(f'running microgpt.py for {args.steps} steps...', file=sys.stderr)
+        py_losses, py_train_s, py_sample_s = run_python(args.python, workdir, args.data, args.steps)
+        print('running bench_e2e...', file=sys.stderr)
+        modes, cpp_losses = run_cpp(binary, workdir, docs_file, args.steps)
+
+    # Results table; speedups are against Python's training or sampling rate
+    py_steps = args.steps / py_train_s
+    py_samples = 20 / py_sample_s
+    rows = [('python', 'scalar', py_steps, train_tokens / py_train_s, py_samples)]
+    rows += [('c++', m['mode'], m['steps_per_sec'] if m['steps'] else None, m['tokens_per_sec'],
+              m['samples_per_sec']) for m in modes]
+    lines = ['| impl | mode | steps/s | tokens/s | samples/s | train speedup | sample speedup |',
+             '|------|------|--------:|---------:|----------:|--------------:|---------------:|']
+    for impl, mode, steps, tokens, samples in rows:
+        steps_cell = f'{steps:.2f}' if steps else '-'
+        speedup = f'{steps / py_steps:.1f}x' if steps else '-'
+        lines.append(f'| {impl} | {mode} | {steps_cell} | {tokens:.1f} | {samples:.2f} | {speedup} | '
+                     f'{samples / py_samples:.1f}x |')
+
+    # Loss-curve agreement
+    py_windows = window_means(py_losses, args.window)
+    cpp_windows = window_means(cpp_losses, args.window)
+    diffs = [abs(a - b) for a, b in zip(py_windows, cpp_windows)]
+    agree = len(py_losses) == len(cpp_losses) == args.steps and max(diffs) <= args.tolerance
+    lines.append('')
+    lines.append(f'loss per {args.window}-step window (python / c++): ' +
+                 ', '.join(f'{a:.3f}/{b:.3f}' for a, b in zip(py_windows, cpp_windows)))
+    lines.append(f'max window difference {max(diffs):.3f} (tolerance {args.tolerance}): '
+                 f'{"agree" if agree else "DISAGREE"}')
+
+    report = '\n'.join(lines)
+    print(report)
+    if args.out:
+        with open(args.out, 'w') as f:
+            f.write(report + '\n')
+    return 0 if agree else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())